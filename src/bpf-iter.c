@@ -0,0 +1,332 @@
+/*
+ bpf-iter.c
+
+ Date Created: Sat Oct 17 10:20:44 2026
+
+ Collect socket queue information using BPF socket iterators
+
+ The iterator programs in qui-iter.bpf.c evaluate the threshold,
+ input/output selection and port filter in the kernel, so only the
+ sockets that would be reported are copied to user space.  Every
+ round creates a new iterator instance for each relevant protocol
+ and reads its records.
+
+ If qui was built without BPF support, or the object cannot be
+ loaded (missing privileges, kernel too old), init_bpf_iter() fails
+ and the caller falls back to another collection method.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "bpf-iter.h"
+#include "timestamp.h"
+#include "instrument.h"
+
+#ifdef HAVE_BPF
+
+#include <linux/types.h>
+#include <bpf/libbpf.h>
+#include <bpf/bpf.h>
+
+#include "qui-bpf.h"
+
+#ifndef QUI_BPF_OBJECT
+#define QUI_BPF_OBJECT "qui-iter.bpf.o"
+#endif
+
+#define ENTRIES_PER_READ 1024
+
+typedef struct BpfIterRec *BpfIter;
+
+static int attach_iter (BpfIter);
+static int read_iter (BpfIter, SockEntryCallback, void *);
+
+typedef struct BpfIterRec
+{
+  const char  *	progname;
+  int		proto;
+  struct bpf_link *link;
+}
+BpfIterRec;
+
+static BpfIterRec
+bpf_iters[] = {
+  { .progname = "dump_udp", .proto = IPPROTO_UDP, .link = 0, },
+  { .progname = "dump_tcp", .proto = IPPROTO_TCP, .link = 0, },
+  { .progname = 0,          .proto = 0,           .link = 0, },
+};
+
+static struct bpf_object *iter_obj = 0;
+
+int
+init_bpf_iter (p)
+     Preferences p;
+{
+  struct QuiBpfConfig cfg;
+  struct bpf_map *map;
+  BpfIter it;
+  uint32_t key = 0;
+  int err;
+
+  iter_obj = bpf_object__open_file (QUI_BPF_OBJECT, 0);
+  if ((err = libbpf_get_error (iter_obj)) != 0)
+    {
+      fprintf (stderr, "Cannot open BPF object %s: %s\n",
+	       QUI_BPF_OBJECT, strerror (-err));
+      iter_obj = 0;
+      return -1;
+    }
+  if ((err = bpf_object__load (iter_obj)) != 0)
+    {
+      fprintf (stderr, "Cannot load BPF object %s: %s\n",
+	       QUI_BPF_OBJECT, strerror (-err));
+      goto fail;
+    }
+  if ((map = bpf_object__find_map_by_name (iter_obj, "qui_config")) == 0)
+    {
+      fprintf (stderr, "BPF object lacks qui_config map\n");
+      goto fail;
+    }
+  memset (&cfg, 0, sizeof cfg);
+  cfg.threshold = p->filter_threshold;
+  cfg.want_input = p->want_input;
+  cfg.want_output = p->want_output;
+  cfg.want_ipv4 = p->want_ipv4;
+  cfg.want_ipv6 = p->want_ipv6;
+  cfg.specific_port = p->specific_port;
+  cfg.portno = p->portno;
+  if (bpf_map_update_elem (bpf_map__fd (map), &key, &cfg, BPF_ANY) != 0)
+    {
+      fprintf (stderr, "Cannot configure BPF filter: %s\n",
+	       strerror (errno));
+      goto fail;
+    }
+  for (it = &bpf_iters[0]; it->progname != 0; ++it)
+    {
+      if (it->proto == IPPROTO_TCP && !p->want_tcp)
+	continue;
+      if (it->proto == IPPROTO_UDP && !p->want_udp)
+	continue;
+      if (attach_iter (it) != 0)
+	goto fail;
+    }
+  return 0;
+
+ fail:
+  for (it = &bpf_iters[0]; it->progname != 0; ++it)
+    {
+      if (it->link)
+	{
+	  bpf_link__destroy (it->link);
+	  it->link = 0;
+	}
+    }
+  bpf_object__close (iter_obj);
+  iter_obj = 0;
+  return -1;
+}
+
+int
+parse_bpf_iter (p, callback, closure)
+     Preferences p;
+     SockEntryCallback callback;
+     void *closure;
+{
+  BpfIter it;
+
+  for (it = &bpf_iters[0]; it->progname != 0; ++it)
+    {
+      if (it->link != 0 && read_iter (it, callback, closure) != 0)
+	return -1;
+    }
+  return 0;
+}
+
+static int
+attach_iter (it)
+     BpfIter it;
+{
+  struct bpf_program *prog;
+  int err;
+
+  if ((prog = bpf_object__find_program_by_name (iter_obj, it->progname)) == 0)
+    {
+      fprintf (stderr, "BPF object lacks program %s\n", it->progname);
+      return -1;
+    }
+  it->link = bpf_program__attach_iter (prog, 0);
+  if ((err = libbpf_get_error (it->link)) != 0)
+    {
+      fprintf (stderr, "Cannot attach BPF iterator %s: %s\n",
+	       it->progname, strerror (-err));
+      it->link = 0;
+      return -1;
+    }
+  return 0;
+}
+
+static int
+read_iter (it, callback, closure)
+     BpfIter it;
+     SockEntryCallback callback;
+     void *closure;
+{
+  static struct QuiBpfEntry entries[ENTRIES_PER_READ];
+  char *buf = (char *) entries;
+  size_t have = 0, k;
+  ssize_t len;
+  struct timeval tv;
+  ProcFileEntryRec pfe;
+  uint64_t start_ns, read_start_ns, end_ns, have_start_ns = 0;
+  int fd;
+
+  if ((fd = bpf_iter_create (bpf_link__fd (it->link))) < 0)
+    {
+      fprintf (stderr, "Cannot create BPF iterator %s: %s\n",
+	       it->progname, strerror (errno));
+      return -1;
+    }
+  /* A read may end in the middle of a record; the partial record is
+     kept at the start of the buffer for the next read. */
+  for (;;)
+    {
+      /* With a partial record from the previous read, the records
+	 of this one are stamped as if read by both. */
+      read_start_ns = monotonic_ns ();
+      start_ns = have > 0 ? have_start_ns : read_start_ns;
+      len = read (fd, buf + have, sizeof entries - have);
+      end_ns = monotonic_ns ();
+      if (len < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  fprintf (stderr, "Error reading BPF iterator %s: %s\n",
+		   it->progname, strerror (errno));
+	  close (fd);
+	  return -1;
+	}
+      note_read (read_start_ns, end_ns, len);
+      if (len == 0)
+	break;
+      have += len;
+      for (k = 0; (k + 1) * sizeof (struct QuiBpfEntry) <= have; ++k)
+	{
+	  bpf_key_to_entry (&entries[k].key, &pfe);
+	  pfe.iq = entries[k].iq;
+	  pfe.oq = entries[k].oq;
+	  stamp_entry (&pfe, start_ns, end_ns);
+	  timestamp_to_timeval (pfe.ts, &tv);
+	  (* callback) (&pfe, &tv, closure);
+	}
+      note_lines (k);
+      have -= k * sizeof (struct QuiBpfEntry);
+      have_start_ns = start_ns;
+      memmove (buf, buf + k * sizeof (struct QuiBpfEntry), have);
+    }
+  close (fd);
+  return 0;
+}
+
+void
+bpf_key_to_entry (k, pfe)
+     const struct QuiBpfKey *k;
+     ProcFileEntry pfe;
+{
+  if (k->family == AF_INET)
+    {
+      struct sockaddr_in *la = (struct sockaddr_in *) &(pfe->la);
+      struct sockaddr_in *ra = (struct sockaddr_in *) &(pfe->ra);
+
+      memset (la, 0, sizeof (struct sockaddr_in));
+      memset (ra, 0, sizeof (struct sockaddr_in));
+      la->sin_family = ra->sin_family = AF_INET;
+      la->sin_port = k->sport;
+      ra->sin_port = k->dport;
+      la->sin_addr.s_addr = k->saddr[0];
+      ra->sin_addr.s_addr = k->daddr[0];
+    }
+  else
+    {
+      struct sockaddr_in6 *la = (struct sockaddr_in6 *) &(pfe->la);
+      struct sockaddr_in6 *ra = (struct sockaddr_in6 *) &(pfe->ra);
+
+      memset (la, 0, sizeof (struct sockaddr_in6));
+      memset (ra, 0, sizeof (struct sockaddr_in6));
+      la->sin6_family = ra->sin6_family = AF_INET6;
+      la->sin6_port = k->sport;
+      ra->sin6_port = k->dport;
+      memcpy (&(la->sin6_addr), k->saddr, sizeof (struct in6_addr));
+      memcpy (&(ra->sin6_addr), k->daddr, sizeof (struct in6_addr));
+    }
+  pfe->iq = 0;
+  pfe->oq = 0;
+  pfe->proto = k->proto;
+  pfe->inode = 0;
+  pfe->netns = 0;
+  pfe->drops = 0;
+}
+
+void
+entry_to_bpf_key (pfe, k)
+     ProcFileEntry pfe;
+     struct QuiBpfKey *k;
+{
+  memset (k, 0, sizeof (struct QuiBpfKey));
+  k->family = ((struct sockaddr *) &(pfe->la))->sa_family;
+  k->proto = pfe->proto;
+  if (k->family == AF_INET)
+    {
+      struct sockaddr_in *la = (struct sockaddr_in *) &(pfe->la);
+      struct sockaddr_in *ra = (struct sockaddr_in *) &(pfe->ra);
+
+      k->sport = la->sin_port;
+      k->dport = ra->sin_port;
+      k->saddr[0] = la->sin_addr.s_addr;
+      k->daddr[0] = ra->sin_addr.s_addr;
+    }
+  else
+    {
+      struct sockaddr_in6 *la = (struct sockaddr_in6 *) &(pfe->la);
+      struct sockaddr_in6 *ra = (struct sockaddr_in6 *) &(pfe->ra);
+
+      k->sport = la->sin6_port;
+      k->dport = ra->sin6_port;
+      memcpy (k->saddr, &(la->sin6_addr), sizeof (struct in6_addr));
+      memcpy (k->daddr, &(ra->sin6_addr), sizeof (struct in6_addr));
+    }
+}
+
+#else /* not HAVE_BPF */
+
+int
+init_bpf_iter (p)
+     Preferences p;
+{
+  fprintf (stderr, "qui was built without BPF support\n");
+  return -1;
+}
+
+int
+parse_bpf_iter (p, callback, closure)
+     Preferences p;
+     SockEntryCallback callback;
+     void *closure;
+{
+  return -1;
+}
+
+#endif /* not HAVE_BPF */
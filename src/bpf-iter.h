@@ -0,0 +1,22 @@
+/*
+ bpf-iter.h
+
+ Date Created: Sat Oct 17 10:21:07 2026
+ */
+
+#ifndef __QUI_BPF_ITER_H__
+#define __QUI_BPF_ITER_H__ 1
+
+#include "preferences.h"
+#include "proc-net.h"
+
+extern int init_bpf_iter (Preferences);
+extern int parse_bpf_iter (Preferences, SockEntryCallback, void *);
+
+/* Conversion between ProcFileEntryRec and the key the BPF programs
+   use; only available when built with BPF support. */
+struct QuiBpfKey;
+extern void bpf_key_to_entry (const struct QuiBpfKey *, ProcFileEntry);
+extern void entry_to_bpf_key (ProcFileEntry, struct QuiBpfKey *);
+
+#endif /* not __QUI_BPF_ITER_H__ */
@@ -0,0 +1,323 @@
+/*
+ bpf-peak.c
+
+ Date Created: Sat Oct 17 11:24:31 2026
+
+ Collect the receive queue high-water marks recorded by the probes in
+ qui-peak.bpf.c
+
+ At the start of every round, collect_bpf_peaks() empties the kernel
+ map into a sorted array.  While the round's entries are processed,
+ lookup_bpf_peak() finds the peak since the previous round for each
+ socket.  Sockets whose peak was recorded but which were not looked
+ up during the round (because they were closed in the meantime, or
+ filtered out before reaching the callback) can be listed afterwards
+ using map_unmatched_bpf_peaks().
+
+ Each peak is taken out of the map with a single lookup-and-delete.
+ Kernels before 5.14 cannot do that on a hash map; on those, the
+ first attempt fails, and peaks are looked up and deleted in two
+ steps from then on, so that a peak recorded between the two is
+ lost.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "bpf-iter.h"
+#include "bpf-peak.h"
+
+#ifdef HAVE_BPF
+
+#include <linux/types.h>
+#include <bpf/libbpf.h>
+#include <bpf/bpf.h>
+
+#include "qui-bpf.h"
+
+#ifndef QUI_BPF_PEAK_OBJECT
+#define QUI_BPF_PEAK_OBJECT "qui-peak.bpf.o"
+#endif
+
+typedef struct PeakRec *Peak;
+
+static int take_peak (const struct QuiBpfKey *, struct QuiBpfPeak *);
+static void detach_bpf_peak (void);
+static int compare_peaks (const void *, const void *);
+
+typedef struct PeakRec
+{
+  struct QuiBpfKey	key;
+  struct QuiBpfPeak	val;
+  int			matched;
+}
+PeakRec;
+
+#define MAX_PEAK_LINKS 4
+
+static struct bpf_object *peak_obj = 0;
+static struct bpf_link *peak_links[MAX_PEAK_LINKS];
+static unsigned n_peak_links = 0;
+static int peak_map_fd = -1;
+
+/* whether the kernel can look up and delete a map element in one
+   step: -1 until it has been tried */
+static int can_lookup_and_delete = -1;
+
+static Peak peaks = 0;
+static unsigned n_peaks = 0;
+static unsigned peaks_size = 0;
+
+int
+init_bpf_peak (p)
+     Preferences p;
+{
+  struct QuiBpfConfig cfg;
+  struct bpf_program *prog;
+  struct bpf_link *link;
+  struct bpf_map *map;
+  uint32_t key = 0;
+  int err;
+
+  peak_obj = bpf_object__open_file (QUI_BPF_PEAK_OBJECT, 0);
+  if ((err = libbpf_get_error (peak_obj)) != 0)
+    {
+      fprintf (stderr, "Cannot open BPF object %s: %s\n",
+	       QUI_BPF_PEAK_OBJECT, strerror (-err));
+      peak_obj = 0;
+      return -1;
+    }
+  if ((err = bpf_object__load (peak_obj)) != 0)
+    {
+      fprintf (stderr, "Cannot load BPF object %s: %s\n",
+	       QUI_BPF_PEAK_OBJECT, strerror (-err));
+      goto fail;
+    }
+  if ((map = bpf_object__find_map_by_name (peak_obj, "qui_config")) == 0
+      || (peak_map_fd = bpf_object__find_map_fd_by_name (peak_obj,
+							 "qui_peaks")) < 0)
+    {
+      fprintf (stderr, "BPF object lacks qui_config/qui_peaks maps\n");
+      goto fail;
+    }
+  memset (&cfg, 0, sizeof cfg);
+  cfg.threshold = p->threshold;
+  cfg.want_input = p->want_input;
+  cfg.want_output = p->want_output;
+  cfg.want_ipv4 = p->want_ipv4;
+  cfg.want_ipv6 = p->want_ipv6;
+  cfg.specific_port = p->specific_port;
+  cfg.portno = p->portno;
+  if (bpf_map_update_elem (bpf_map__fd (map), &key, &cfg, BPF_ANY) != 0)
+    {
+      fprintf (stderr, "Cannot configure BPF filter: %s\n",
+	       strerror (errno));
+      goto fail;
+    }
+  bpf_object__for_each_program (prog, peak_obj)
+    {
+      if ((strcmp (bpf_program__name (prog), "udp_enqueue") == 0
+	   && !p->want_udp)
+	  || (strcmp (bpf_program__name (prog), "tcp_established") == 0
+	      && !p->want_tcp))
+	continue;
+      if (n_peak_links == MAX_PEAK_LINKS)
+	break;
+      link = bpf_program__attach (prog);
+      if ((err = libbpf_get_error (link)) != 0)
+	{
+	  fprintf (stderr, "Cannot attach BPF program %s: %s\n",
+		   bpf_program__name (prog), strerror (-err));
+	  goto fail;
+	}
+      peak_links[n_peak_links++] = link;
+    }
+  return 0;
+
+ fail:
+  detach_bpf_peak ();
+  return -1;
+}
+
+int
+collect_bpf_peaks ()
+{
+  struct QuiBpfKey key, next;
+  struct QuiBpfKey *prev = 0;
+
+  n_peaks = 0;
+  if (peak_map_fd == -1)
+    return 0;
+  while (bpf_map_get_next_key (peak_map_fd, prev, &next) == 0)
+    {
+      if (n_peaks == peaks_size)
+	{
+	  unsigned new_size = peaks_size ? peaks_size * 2 : 256;
+	  Peak new_peaks = realloc (peaks, new_size * sizeof (PeakRec));
+
+	  if (new_peaks == 0)
+	    {
+	      fprintf (stderr, "Out of memory\n");
+	      return -1;
+	    }
+	  peaks = new_peaks;
+	  peaks_size = new_size;
+	}
+      if (take_peak (&next, &(peaks[n_peaks].val)) == 0)
+	{
+	  peaks[n_peaks].key = next;
+	  peaks[n_peaks].matched = 0;
+	  ++n_peaks;
+	  /* The key is gone, so restart from the beginning. */
+	  prev = 0;
+	}
+      else
+	{
+	  key = next;
+	  prev = &key;
+	}
+    }
+  qsort (peaks, n_peaks, sizeof (PeakRec), compare_peaks);
+  return 0;
+}
+
+int
+lookup_bpf_peak (pfe, peakp, fullp)
+     ProcFileEntry pfe;
+     uint32_t *peakp;
+     uint32_t *fullp;
+{
+  PeakRec probe;
+  Peak found;
+
+  if (n_peaks == 0)
+    return 0;
+  entry_to_bpf_key (pfe, &(probe.key));
+  found = bsearch (&probe, peaks, n_peaks, sizeof (PeakRec), compare_peaks);
+  if (found == 0)
+    return 0;
+  found->matched = 1;
+  *peakp = found->val.peak;
+  *fullp = found->val.full;
+  return 1;
+}
+
+void
+map_unmatched_bpf_peaks (callback, closure)
+     SockPeakCallback callback;
+     void *closure;
+{
+  ProcFileEntryRec pfe;
+  unsigned k;
+
+  for (k = 0; k < n_peaks; ++k)
+    {
+      if (!peaks[k].matched)
+	{
+	  bpf_key_to_entry (&(peaks[k].key), &pfe);
+	  (* callback) (&pfe, peaks[k].val.peak, peaks[k].val.full, closure);
+	}
+    }
+}
+
+/* Look up the peak of KEY into VAL, and delete it from the map, so
+   that the probes start a new one.  Returns -1 if there is none, or
+   if it cannot be deleted, in which case peaks are not collected any
+   more: they would otherwise be reported again in every round. */
+static int
+take_peak (key, val)
+     const struct QuiBpfKey *key;
+     struct QuiBpfPeak *val;
+{
+  if (can_lookup_and_delete != 0)
+    {
+      if (bpf_map_lookup_and_delete_elem (peak_map_fd, key, val) == 0)
+	{
+	  can_lookup_and_delete = 1;
+	  return 0;
+	}
+      /* The element may have been evicted meanwhile. */
+      if (errno == ENOENT || can_lookup_and_delete == 1)
+	return -1;
+      fprintf (stderr, "Cannot look up and delete BPF peaks in one step: "
+	       "%s\nLooking them up and deleting them separately\n",
+	       strerror (errno));
+      can_lookup_and_delete = 0;
+    }
+  if (bpf_map_lookup_elem (peak_map_fd, key, val) != 0)
+    return -1;
+  if (bpf_map_delete_elem (peak_map_fd, key) != 0 && errno != ENOENT)
+    {
+      fprintf (stderr, "Cannot delete BPF peak: %s\n"
+	       "Not capturing peaks between rounds\n", strerror (errno));
+      detach_bpf_peak ();
+      return -1;
+    }
+  return 0;
+}
+
+/* Detach the probes and close the object with its maps, after which
+   no more peaks are collected. */
+static void
+detach_bpf_peak ()
+{
+  while (n_peak_links > 0)
+    bpf_link__destroy (peak_links[--n_peak_links]);
+  bpf_object__close (peak_obj);
+  peak_obj = 0;
+  peak_map_fd = -1;
+}
+
+static int
+compare_peaks (a, b)
+     const void *a;
+     const void *b;
+{
+  return memcmp (&(((const PeakRec *) a)->key), &(((const PeakRec *) b)->key),
+		 sizeof (struct QuiBpfKey));
+}
+
+#else /* not HAVE_BPF */
+
+int
+init_bpf_peak (p)
+     Preferences p;
+{
+  fprintf (stderr, "qui was built without BPF support\n");
+  return -1;
+}
+
+int
+collect_bpf_peaks ()
+{
+  return 0;
+}
+
+int
+lookup_bpf_peak (pfe, peakp, fullp)
+     ProcFileEntry pfe;
+     uint32_t *peakp;
+     uint32_t *fullp;
+{
+  return 0;
+}
+
+void
+map_unmatched_bpf_peaks (callback, closure)
+     SockPeakCallback callback;
+     void *closure;
+{
+}
+
+#endif /* not HAVE_BPF */
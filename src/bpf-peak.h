@@ -0,0 +1,21 @@
+/*
+ bpf-peak.h
+
+ Date Created: Sat Oct 17 11:24:50 2026
+ */
+
+#ifndef __QUI_BPF_PEAK_H__
+#define __QUI_BPF_PEAK_H__ 1
+
+#include "preferences.h"
+#include "proc-net.h"
+
+typedef void (* SockPeakCallback)
+  (ProcFileEntry, uint32_t, uint32_t, void *);
+
+extern int init_bpf_peak (Preferences);
+extern int collect_bpf_peaks (void);
+extern int lookup_bpf_peak (ProcFileEntry, uint32_t *, uint32_t *);
+extern void map_unmatched_bpf_peaks (SockPeakCallback, void *);
+
+#endif /* not __QUI_BPF_PEAK_H__ */
@@ -0,0 +1,34 @@
+#! /bin/sh
+#
+# check-reader.sh
+#
+# Date Created: Sat Oct 17 23:58:14 2026
+#
+# Run by "make check": generates tables with CHECK_SOCKETS sockets
+# each (four tables, so several million lines) with qui-gen, and reads
+# them with qui-bench through --proc-root, once with the files read
+# one after the other and once with CHECK_THREADS worker threads.  The
+# number of lines decoded in a round with a threshold of 0 must be the
+# number of sockets generated, so that no line is lost or read twice
+# where it crosses the boundary between two read() calls.
+
+: ${CHECK_SOCKETS:=750000}
+: ${CHECK_THREADS:=4}
+
+dir=check-reader.$$
+trap 'rm -rf $dir' 0 1 2 15
+
+./qui-gen -n $CHECK_SOCKETS $dir || exit 1
+expected=`expr 4 \* $CHECK_SOCKETS`
+status=0
+for options in "" "-P $CHECK_THREADS"; do
+  lines=`./qui-bench -R $dir $options 1 | sed -n 's/ lines per round.*//p'`
+  if test "x$lines" = "x$expected"; then
+    echo "ok: $expected lines decoded${options:+ with $options}"
+  else
+    echo "FAIL: ${lines:-no} lines decoded${options:+ with $options}," \
+      "expected $expected"
+    status=1
+  fi
+done
+exit $status
@@ -0,0 +1,297 @@
+/*
+ drops.c
+
+ Date Created: Sat Oct 17 23:47:05 2026
+
+ Counting the packets that UDP sockets drop
+
+ The kernel counts the packets each UDP socket has dropped, mostly
+ because its receive queue was full, in the last column of
+ /proc/net/udp{,6}, and in the memory information of sock_diag.  With
+ --drops, the collection methods read that count in the same pass as
+ the queue sizes, and keep all UDP sockets whatever their queue sizes,
+ so that the summary of a round covers every one of them, not only
+ those at or above the threshold.  Here the count of each socket that
+ has dropped packets is remembered from round to round, so that its
+ line can say how many packets it dropped since the last round.
+ Sockets that have never dropped anything are not remembered: when one
+ shows up with a count, all of it is new, except in the first round,
+ which only sets the baseline.
+
+ Once per round, the host-wide InErrors and RcvbufErrors counters of
+ UDP are read from /proc/net/snmp, and those of UDP over IPv6 from
+ /proc/net/snmp6.  When they or the counts of the sockets went up in
+ a round, a line sums it up, with the receive queues of the UDP
+ sockets seen at that moment.  Only the counters of our own network
+ namespace are read, even with --all-netns.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "history.h"
+#include "sock-table.h"
+#include "output.h"
+#include "timestamp.h"
+#include "instrument.h"
+#include "drops.h"
+
+/* enough for /proc/net/snmp and /proc/net/snmp6 */
+#define SNMP_BUFFER_SIZE 16384
+
+typedef struct UdpCountersRec *UdpCounters;
+
+typedef struct UdpCountersRec
+{
+  uint64_t	in_errors;
+  uint64_t	rcvbuf_errors;
+}
+UdpCountersRec;
+
+static int open_snmp_file (Preferences, const char *);
+static int read_snmp_file (int, const char *);
+static void read_counters (UdpCounters);
+static int parse_snmp (UdpCounters);
+static int parse_snmp6 (UdpCounters);
+static uint64_t snmp6_value (const char *);
+
+static SockTable sockets = 0;	/* last count of those that dropped */
+static int snmp_fd = -1;	/* /proc/net/snmp, if wanted */
+static int snmp6_fd = -1;	/* /proc/net/snmp6, if wanted */
+static char snmp_buffer[SNMP_BUFFER_SIZE];
+static UdpCountersRec last_counters;
+static int first_round = 1;
+
+/* What the current round has seen of UDP sockets. */
+static uint32_t round_lost;
+static uint32_t round_sockets;
+static uint64_t round_total_iq;
+static uint32_t round_max_iq;
+
+int
+init_drops (p)
+     Preferences p;
+{
+  if ((sockets = make_sock_table (p->max_sockets, sizeof (uint32_t))) == 0)
+    return -1;
+  if (p->want_ipv4)
+    snmp_fd = open_snmp_file (p, "snmp");
+  if (p->want_ipv6)
+    snmp6_fd = open_snmp_file (p, "snmp6");
+  return 0;
+}
+
+void
+begin_drops_round ()
+{
+  advance_sock_table (sockets);
+  round_lost = round_sockets = round_max_iq = 0;
+  round_total_iq = 0;
+}
+
+/* Return how many packets the socket PFE dropped since the last
+   round, and count its receive queue in the summary. */
+uint32_t
+update_drops (pfe)
+     ProcFileEntry pfe;
+{
+  SockKeyRec key;
+  uint32_t *last, lost;
+  long i;
+  int is_new;
+
+  if (pfe->proto != IPPROTO_UDP)
+    return 0;
+  ++round_sockets;
+  round_total_iq += pfe->iq;
+  if (pfe->iq > round_max_iq)
+    round_max_iq = pfe->iq;
+  if (pfe->drops == 0)
+    return 0;
+  sock_key_from_entry (&key, pfe);
+  if ((i = intern_sock (sockets, &key, &is_new)) == -1)
+    return 0;
+  last = (uint32_t *) sock_value (sockets, i);
+  /* The kernel's count is 32 bits, so this is right across a wrap. */
+  lost = is_new ? (first_round ? 0 : pfe->drops) : pfe->drops - *last;
+  *last = pfe->drops;
+  round_lost += lost;
+  return lost;
+}
+
+/* Read the host-wide counters, and report the round if anything was
+   dropped in it. */
+void
+end_drops_round ()
+{
+  UdpCountersRec counters;
+  struct timeval tv;
+
+  sweep_sock_table (sockets, 0, 0);
+  read_counters (&counters);
+  if (!first_round
+      && (counters.in_errors != last_counters.in_errors
+	  || counters.rcvbuf_errors != last_counters.rcvbuf_errors
+	  || round_lost > 0))
+    {
+      current_timeval (&tv);
+      output_drops (&tv, counters.in_errors - last_counters.in_errors,
+		    counters.rcvbuf_errors - last_counters.rcvbuf_errors,
+		    round_lost, round_sockets, round_total_iq, round_max_iq);
+    }
+  last_counters = counters;
+  first_round = 0;
+}
+
+void
+finish_drops ()
+{
+  if (snmp_fd != -1)
+    close (snmp_fd);
+  if (snmp6_fd != -1)
+    close (snmp6_fd);
+  destroy_sock_table (sockets);
+}
+
+/* Open NAME under the net directory of /proc or --proc-root.  If it
+   is not there, only the host-wide counters are missing. */
+static int
+open_snmp_file (p, name)
+     Preferences p;
+     const char *name;
+{
+  char pathname[1024];
+  int fd;
+
+  snprintf (pathname, sizeof pathname, "%s/net/%s",
+	    p->proc_root ? p->proc_root : "/proc", name);
+  if ((fd = open (pathname, O_RDONLY)) == -1)
+    fprintf (stderr, "Cannot open %s, not counting its UDP errors: %s\n",
+	     pathname, strerror (errno));
+  return fd;
+}
+
+/* Read the file open on FD into snmp_buffer, as a string. */
+static int
+read_snmp_file (fd, name)
+     int fd;
+     const char *name;
+{
+  size_t len = 0;
+  ssize_t n;
+  uint64_t start_ns, end_ns;
+
+  if (lseek (fd, 0, SEEK_SET) == (off_t) -1)
+    {
+      fprintf (stderr, "Error rewinding %s: %s\n", name, strerror (errno));
+      return -1;
+    }
+  do
+    {
+      start_ns = monotonic_ns ();
+      n = read (fd, snmp_buffer + len, sizeof snmp_buffer - 1 - len);
+      end_ns = monotonic_ns ();
+      if (n == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  fprintf (stderr, "Error reading %s: %s\n", name, strerror (errno));
+	  return -1;
+	}
+      note_read (start_ns, end_ns, n);
+      len += n;
+    }
+  while (n != 0 && len < sizeof snmp_buffer - 1);
+  snmp_buffer[len] = 0;
+  return 0;
+}
+
+/* The sum of the UDP and UDPv6 counters, or what there is of them. */
+static void
+read_counters (c)
+     UdpCounters c;
+{
+  c->in_errors = c->rcvbuf_errors = 0;
+  if (snmp_fd != -1 && read_snmp_file (snmp_fd, "snmp") == 0
+      && parse_snmp (c) != 0)
+    fprintf (stderr, "No UDP counters in snmp\n");
+  if (snmp6_fd != -1 && read_snmp_file (snmp6_fd, "snmp6") == 0
+      && parse_snmp6 (c) != 0)
+    fprintf (stderr, "No UDP counters in snmp6\n");
+}
+
+/* /proc/net/snmp has a line with the names of the UDP counters,
+   followed by one with their values:
+
+     Udp: InDatagrams NoPorts InErrors OutDatagrams RcvbufErrors ...
+     Udp: 17000 8 0 18608 0 ...
+*/
+static int
+parse_snmp (c)
+     UdpCounters c;
+{
+  const char *names, *values, *name_end;
+  char *end;
+  uint64_t val;
+  int found = 0;
+
+  if ((names = strstr (snmp_buffer, "\nUdp: ")) == 0
+      || (values = strstr (names + 1, "\nUdp: ")) == 0)
+    return -1;
+  names += 6;
+  values += 6;
+  while (*names != '\n' && *names != 0)
+    {
+      name_end = names + strcspn (names, " \n");
+      val = strtoull (values, &end, 10);
+      if (end == values)
+	return -1;
+      values = end;
+      if (name_end - names == 8 && memcmp (names, "InErrors", 8) == 0)
+	{
+	  c->in_errors += val;
+	  ++found;
+	}
+      else if (name_end - names == 12
+	       && memcmp (names, "RcvbufErrors", 12) == 0)
+	{
+	  c->rcvbuf_errors += val;
+	  ++found;
+	}
+      names = *name_end == ' ' ? name_end + 1 : name_end;
+    }
+  return found == 2 ? 0 : -1;
+}
+
+/* /proc/net/snmp6 has one counter per line, as NAME VALUE. */
+static int
+parse_snmp6 (c)
+     UdpCounters c;
+{
+  const char *in, *rcvbuf;
+
+  if ((in = strstr (snmp_buffer, "Udp6InErrors ")) == 0
+      || (rcvbuf = strstr (snmp_buffer, "Udp6RcvbufErrors ")) == 0)
+    return -1;
+  c->in_errors += snmp6_value (in);
+  c->rcvbuf_errors += snmp6_value (rcvbuf);
+  return 0;
+}
+
+static uint64_t
+snmp6_value (cp)
+     const char *cp;
+{
+  cp += strcspn (cp, " \t");
+  return strtoull (cp, 0, 10);
+}
@@ -0,0 +1,16 @@
+/*
+ drops.h
+
+ Date Created: Sat Oct 17 23:47:05 2026
+ */
+
+#ifndef __QUI_DROPS_H__
+#define __QUI_DROPS_H__ 1
+
+extern int init_drops (Preferences);
+extern void begin_drops_round (void);
+extern uint32_t update_drops (ProcFileEntry);
+extern void end_drops_round (void);
+extern void finish_drops (void);
+
+#endif /* not __QUI_DROPS_H__ */
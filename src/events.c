@@ -0,0 +1,228 @@
+/*
+ events.c
+
+ Date Created: Sat Oct 17 15:47:36 2026
+
+ Turn per-round samples into one record per burst
+
+ For every socket that is seen with a queue at or above the low
+ threshold, the state of a possible burst on each selected queue is
+ kept across rounds.  A burst starts when a queue reaches the
+ (high) threshold, and ends in the first round where it is below the
+ low threshold, or where the socket is not seen at all, because it
+ has been closed or because the collection method has filtered it
+ out for being below the low threshold.  For each burst, the start,
+ the peak and the end are recorded in a BufferEventRec, and the
+ occupancy is integrated over time, each sample counting until the
+ next one.
+
+ Sockets are kept in a SockTable, which only holds sockets seen in the
+ current round.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "history.h"
+#include "sock-table.h"
+#include "events.h"
+
+typedef struct BurstRec *Burst;
+typedef struct SockStateRec *SockState;
+
+/* the burst, if any, going on in one queue of a socket */
+typedef struct BurstRec
+{
+  int		active;
+  BufferEventRec ev;
+  struct timeval last_ts;	/* latest sample */
+  uint32_t	last_occ;
+  double	byte_seconds;
+}
+BurstRec;
+
+/* what is kept in the socket table for each socket */
+typedef struct SockStateRec
+{
+  uint32_t	iq;		/* as last seen */
+  uint32_t	oq;
+  char	       *netns;		/* own copy, the namespace may go away */
+  BurstRec	burst[2];	/* indexed by BURST_INPUT/BURST_OUTPUT */
+}
+SockStateRec;
+
+/* what end_stale_bursts() needs */
+typedef struct SweepContextRec
+{
+  const struct timeval *tv;
+  BurstCallback	callback;
+  void	       *closure;
+}
+SweepContextRec;
+
+static Preferences prefs;
+static SockTable sockets = 0;
+static int table_full = 0;
+
+static void update_burst (SockTable, long, int, const struct timeval *,
+			  uint32_t, BurstCallback, void *);
+static void end_stale_bursts (SockTable, long, void *);
+static double timeval_diff (const struct timeval *, const struct timeval *);
+
+int
+init_events (p)
+     Preferences p;
+{
+  prefs = p;
+  if ((sockets = make_sock_table (p->max_sockets, sizeof (SockStateRec))) == 0)
+    return -1;
+  return 0;
+}
+
+void
+begin_events_round ()
+{
+  advance_sock_table (sockets);
+}
+
+/* Account for a sample of socket PFE taken at TV.  Bursts that end
+   with this sample are passed to CALLBACK. */
+int
+update_events (pfe, tv, callback, closure)
+     ProcFileEntry pfe;
+     const struct timeval *tv;
+     BurstCallback callback;
+     void *closure;
+{
+  SockKeyRec key;
+  SockState s;
+  long i;
+  int is_new;
+
+  sock_key_from_entry (&key, pfe);
+  if ((i = intern_sock (sockets, &key, &is_new)) == -1)
+    {
+      if (!table_full)
+	fprintf (stderr, "More than %u sockets above the low threshold, "
+		 "ignoring the rest\n", prefs->max_sockets);
+      table_full = 1;
+      return -1;
+    }
+  s = (SockState) sock_value (sockets, i);
+  if (is_new && pfe->netns && (s->netns = strdup (pfe->netns)) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      return -1;
+    }
+  s->iq = pfe->iq;
+  s->oq = pfe->oq;
+  if (prefs->want_input)
+    update_burst (sockets, i, BURST_INPUT, tv, pfe->iq, callback, closure);
+  if (prefs->want_output)
+    update_burst (sockets, i, BURST_OUTPUT, tv, pfe->oq, callback, closure);
+  return 0;
+}
+
+/* End the bursts of sockets that were not seen in this round, as of
+   TV, and forget those sockets. */
+void
+end_events_round (tv, callback, closure)
+     const struct timeval *tv;
+     BurstCallback callback;
+     void *closure;
+{
+  SweepContextRec ctx;
+
+  ctx.tv = tv;
+  ctx.callback = callback;
+  ctx.closure = closure;
+  sweep_sock_table (sockets, end_stale_bursts, &ctx);
+  table_full = 0;
+}
+
+/* End all bursts that are still going on, as of TV.  Used when qui
+   stops. */
+void
+flush_events (tv, callback, closure)
+     const struct timeval *tv;
+     BurstCallback callback;
+     void *closure;
+{
+  advance_sock_table (sockets);
+  end_events_round (tv, callback, closure);
+}
+
+static void
+end_stale_bursts (t, i, closure)
+     SockTable t;
+     long i;
+     void *closure;
+{
+  SweepContextRec *ctx = (SweepContextRec *) closure;
+  SockState s = (SockState) sock_value (t, i);
+
+  update_burst (t, i, BURST_INPUT, ctx->tv, 0, ctx->callback, ctx->closure);
+  update_burst (t, i, BURST_OUTPUT, ctx->tv, 0, ctx->callback, ctx->closure);
+  free (s->netns);
+}
+
+static void
+update_burst (t, i, which, tv, occ, callback, closure)
+     SockTable t;
+     long i;
+     int which;
+     const struct timeval *tv;
+     uint32_t occ;
+     BurstCallback callback;
+     void *closure;
+{
+  SockState s = (SockState) sock_value (t, i);
+  Burst b = &(s->burst[which]);
+  ProcFileEntryRec pfe;
+
+  if (!b->active)
+    {
+      if (occ < prefs->threshold)
+	return;
+      b->active = 1;
+      b->ev.s_ts = b->ev.m_ts = *tv;
+      b->ev.s_occ = b->ev.m_occ = occ;
+      b->byte_seconds = 0;
+      b->last_ts = *tv;
+      b->last_occ = occ;
+      return;
+    }
+  b->byte_seconds += b->last_occ * timeval_diff (tv, &b->last_ts);
+  b->last_ts = *tv;
+  b->last_occ = occ;
+  if (occ > b->ev.m_occ)
+    {
+      b->ev.m_ts = *tv;
+      b->ev.m_occ = occ;
+    }
+  if (occ < prefs->low_threshold)
+    {
+      b->ev.e_ts = *tv;
+      b->ev.e_occ = occ;
+      b->active = 0;
+      sock_key_to_entry (sock_key (t, i), &pfe);
+      pfe.iq = s->iq;
+      pfe.oq = s->oq;
+      pfe.netns = s->netns;
+      (* callback) (&pfe, which, &(b->ev), b->byte_seconds, closure);
+    }
+}
+
+static double
+timeval_diff (a, b)
+     const struct timeval *a;
+     const struct timeval *b;
+{
+  return (a->tv_sec - b->tv_sec) + (a->tv_usec - b->tv_usec) / 1e6;
+}
@@ -0,0 +1,31 @@
+/*
+ events.h
+
+ Date Created: Sat Oct 17 15:48:20 2026
+ */
+
+#ifndef __QUI_EVENTS_H__
+#define __QUI_EVENTS_H__ 1
+
+#include <sys/time.h>
+
+#include "history.h"
+
+/* which queue of a socket a burst was seen on */
+#define BURST_INPUT	0
+#define BURST_OUTPUT	1
+
+/* Called once per burst, when it has ended, with the queue it was
+   seen on and the integral of occupancy over the duration of the
+   burst, in byte-seconds. */
+typedef void (* BurstCallback)
+  (ProcFileEntry, int, BufferEvent, double, void *);
+
+extern int init_events (Preferences);
+extern void begin_events_round (void);
+extern int update_events (ProcFileEntry, const struct timeval *,
+			  BurstCallback, void *);
+extern void end_events_round (const struct timeval *, BurstCallback, void *);
+extern void flush_events (const struct timeval *, BurstCallback, void *);
+
+#endif /* not __QUI_EVENTS_H__ */
@@ -0,0 +1,708 @@
+/*
+ exporter.c
+
+ Date Created: Sat Oct 17 23:58:12 2026
+
+ Serve metrics over HTTP in the OpenMetrics text format
+
+ With --listen, the sampling loop keeps, per protocol and queue, the
+ number of sockets, the sum and the maximum of the queue sizes in the
+ current round, and a histogram of the queue sizes over all samples
+ so far; sockets with a queue at or above the threshold also get
+ gauges of their own, labelled with the inode as well as the
+ endpoints, since several sockets can share the same endpoints with
+ SO_REUSEPORT.  The text of each metric is written as the sockets
+ come along, into the back one of two response bodies, and the
+ aggregates are added at the end of the round; then the two bodies
+ are swapped under a lock.
+
+ A server thread accepts connections, reads the request, and sends
+ the front body as it is.  A scrape therefore costs the same however
+ many sockets there are, and never reads /proc or formats anything.
+ A connection holds a reference to the body it is sending; while a
+ slow client still holds the back body, the sampling loop does not
+ touch it and skips a round of updates, rather than wait.  Requests
+ are answered with Connection: close, one at a time per connection,
+ and connections that take longer than CONNECTION_TIMEOUT seconds are
+ dropped.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "history.h"
+#include "sock-table.h"
+#include "output.h"
+#include "format.h"
+#include "timestamp.h"
+#include "exporter.h"
+
+/* enough for one line of text for a socket, with every character of
+   the namespace escaped */
+#define LINE_ROOM		(256 + 2 * MAX_ENDPOINT_STRING \
+				 + 2 * MAX_NETNS_LABEL)
+#define MAX_CONNECTIONS		16
+#define MAX_REQUEST		4096
+#define CONNECTION_TIMEOUT	10
+#define N_PROTOS		2
+#define N_QUEUES		2
+/* le="0.0", le="256.0", le="1024.0" ... le="268435456.0", le="+Inf" */
+#define N_BUCKETS		13
+
+typedef struct BodyRec *Body;
+typedef struct ConnectionRec *Connection;
+
+/* A response body.  refs is the number of connections sending it. */
+typedef struct BodyRec
+{
+  char	       *data;
+  size_t	len;
+  size_t	size;
+  unsigned	refs;
+}
+BodyRec;
+
+typedef struct ConnectionRec
+{
+  int		fd;		/* -1 if the slot is free */
+  uint64_t	deadline;
+  char		request[MAX_REQUEST];
+  size_t	request_len;
+  char		header[256];
+  size_t	header_len;
+  int		responding;	/* whether the request has been read */
+  Body		body;		/* to send, if any */
+  size_t	sent;		/* of header and body together */
+}
+ConnectionRec;
+
+/* per protocol and queue */
+typedef struct AggregateRec
+{
+  unsigned long	sockets;	/* in this round */
+  uint64_t	sum;
+  uint32_t	max;
+  uint64_t	buckets[N_BUCKETS];	/* over all rounds */
+  uint64_t	samples;
+  uint64_t	total;
+}
+AggregateRec;
+
+/* what add_aggregate_lines() writes */
+typedef enum
+{
+  AGGREGATE_SUM,
+  AGGREGATE_MAX,
+  AGGREGATE_HISTOGRAM
+}
+AggregateKind;
+
+static int open_listener (const char *);
+static void *server (void *);
+static void accept_connection (void);
+static void serve_connection (Connection);
+static void start_response (Connection);
+static void close_connection (Connection);
+static char *escape_label (char *, const char *);
+static char *body_room (size_t);
+static void body_used (char *);
+static int add_aggregates (void);
+static int add_aggregate_lines (const char *, AggregateKind, const char *);
+
+static const char *const proto_names[N_PROTOS] = { "tcp", "udp" };
+static const char *const queue_names[N_QUEUES] = { "receive", "send" };
+static const uint32_t bucket_limits[N_BUCKETS - 1] = {
+  0, 256, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216,
+  67108864, 268435456,
+};
+
+static Preferences prefs;
+
+/* Used by the sampling thread only. */
+static AggregateRec aggregates[N_PROTOS][N_QUEUES];
+static unsigned long rounds = 0;
+static int building = 0;	/* whether back can be written this round */
+
+/* Shared with the server, under lock. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static BodyRec bodies[2];
+static Body front = &bodies[0];
+static Body back = &bodies[1];
+
+/* Used by the server thread only. */
+static pthread_t server_thread;
+static int listen_fd = -1;
+static int stop_fd = -1;
+static ConnectionRec connections[MAX_CONNECTIONS];
+
+int
+init_exporter (p)
+     Preferences p;
+{
+  sigset_t all, saved;
+  unsigned k;
+  int err;
+
+  prefs = p;
+  for (k = 0; k < MAX_CONNECTIONS; ++k)
+    connections[k].fd = -1;
+  if ((front->data = strdup ("# EOF\n")) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      return -1;
+    }
+  front->len = front->size = strlen (front->data);
+  if ((listen_fd = open_listener (p->listen_address)) == -1)
+    return -1;
+  if ((stop_fd = eventfd (0, EFD_NONBLOCK)) == -1)
+    {
+      fprintf (stderr, "Cannot create eventfd: %s\n", strerror (errno));
+      return -1;
+    }
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &saved);
+  err = pthread_create (&server_thread, 0, server, 0);
+  pthread_sigmask (SIG_SETMASK, &saved, 0);
+  if (err != 0)
+    {
+      fprintf (stderr, "Cannot create server thread: %s\n", strerror (err));
+      return -1;
+    }
+  return 0;
+}
+
+/* Start writing the back body, unless a connection is still sending
+   it. */
+void
+begin_exporter_round ()
+{
+  unsigned k, q;
+  char *cp;
+
+  for (k = 0; k < N_PROTOS; ++k)
+    for (q = 0; q < N_QUEUES; ++q)
+      {
+	aggregates[k][q].sockets = 0;
+	aggregates[k][q].sum = 0;
+	aggregates[k][q].max = 0;
+      }
+  building = __atomic_load_n (&back->refs, __ATOMIC_ACQUIRE) == 0;
+  if (!building)
+    return;
+  back->len = 0;
+  if ((cp = body_room (LINE_ROOM)) == 0)
+    return;
+  cp += sprintf (cp, "# TYPE qui_socket_queue_bytes gauge\n"
+		 "# UNIT qui_socket_queue_bytes bytes\n"
+		 "# HELP qui_socket_queue_bytes Queue size of a socket "
+		 "at or above the threshold.\n");
+  body_used (cp);
+}
+
+void
+update_exporter (pfe)
+     ProcFileEntry pfe;
+{
+  AggregateRec *a;
+  uint32_t val[N_QUEUES];
+  unsigned q, b;
+  int k = pfe->proto == IPPROTO_UDP;
+  char endpoints[2 * MAX_ENDPOINT_STRING + 2], *cp, *sep;
+  SockKeyRec key;
+
+  val[0] = pfe->iq;
+  val[1] = pfe->oq;
+  for (q = 0; q < N_QUEUES; ++q)
+    {
+      a = &aggregates[k][q];
+      ++a->sockets;
+      a->sum += val[q];
+      if (val[q] > a->max)
+	a->max = val[q];
+      for (b = 0; b < N_BUCKETS - 1 && val[q] > bucket_limits[b]; ++b)
+	;
+      ++a->buckets[b];
+      ++a->samples;
+      a->total += val[q];
+    }
+  if (!building
+      || !((prefs->want_input && pfe->iq >= prefs->threshold)
+	   || (prefs->want_output && pfe->oq >= prefs->threshold)))
+    return;
+  sock_key_from_entry (&key, pfe);
+  cp = format_endpoint (endpoints, key.af, key.laddr, key.lport);
+  sep = cp;
+  *cp++ = 0;
+  cp = format_endpoint (cp, key.af, key.raddr, key.rport);
+  *cp = 0;
+  for (q = 0; q < N_QUEUES; ++q)
+    {
+      if (!(q == 0 ? prefs->want_input : prefs->want_output))
+	continue;
+      if ((cp = body_room (LINE_ROOM)) == 0)
+	return;
+      cp += sprintf (cp, "qui_socket_queue_bytes{proto=\"%s\",local=\"%s\","
+		     "remote=\"%s\",inode=\"%lu\",",
+		     proto_names[k], endpoints, sep + 1,
+		     (unsigned long) pfe->inode);
+      if (pfe->netns)
+	{
+	  memcpy (cp, "netns=\"", 7);
+	  cp = escape_label (cp + 7, pfe->netns);
+	  memcpy (cp, "\",", 2);
+	  cp += 2;
+	}
+      cp += sprintf (cp, "queue=\"%s\"} %lu\n", queue_names[q],
+		     (unsigned long) val[q]);
+      body_used (cp);
+    }
+}
+
+/* Add the aggregates to the back body, and swap it with the front
+   one, if the server is not looking at them right now. */
+void
+end_exporter_round ()
+{
+  Body b;
+
+  ++rounds;
+  if (!building || add_aggregates () != 0)
+    return;
+  if (pthread_mutex_trylock (&lock) != 0)
+    return;
+  b = front;
+  front = back;
+  back = b;
+  pthread_mutex_unlock (&lock);
+}
+
+void
+finish_exporter ()
+{
+  uint64_t one = 1;
+  unsigned k;
+
+  if (write (stop_fd, &one, sizeof one) == -1)
+    fprintf (stderr, "Cannot stop server thread: %s\n", strerror (errno));
+  pthread_join (server_thread, 0);
+  for (k = 0; k < MAX_CONNECTIONS; ++k)
+    if (connections[k].fd != -1)
+      close_connection (&connections[k]);
+  close (listen_fd);
+  close (stop_fd);
+  free (bodies[0].data);
+  free (bodies[1].data);
+}
+
+/* ADDRESS is [HOST:]PORT, where HOST defaults to 127.0.0.1, and an
+   IPv6 address must be written in brackets. */
+static int
+open_listener (address)
+     const char *address;
+{
+  char host[256];
+  const char *port, *colon, *start = address;
+  size_t len;
+  struct addrinfo hints, *ai;
+  int fd, err, one = 1;
+
+  strcpy (host, "127.0.0.1");
+  port = address;
+  if ((colon = strrchr (address, ':')) != 0)
+    {
+      len = colon - address;
+      if (address[0] == '[' && len >= 2 && colon[-1] == ']')
+	{
+	  ++start;
+	  len -= 2;
+	}
+      if (len >= sizeof host)
+	{
+	  fprintf (stderr, "Host name too long in %s\n", address);
+	  return -1;
+	}
+      memcpy (host, start, len);
+      host[len] = 0;
+      port = colon + 1;
+    }
+  memset (&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+  if ((err = getaddrinfo (host, port, &hints, &ai)) != 0)
+    {
+      fprintf (stderr, "Cannot listen on %s: %s\n", address,
+	       gai_strerror (err));
+      return -1;
+    }
+  if ((fd = socket (ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK
+		    | SOCK_CLOEXEC, 0)) == -1
+      || setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) == -1
+      || bind (fd, ai->ai_addr, ai->ai_addrlen) == -1
+      || listen (fd, MAX_CONNECTIONS) == -1)
+    {
+      fprintf (stderr, "Cannot listen on %s: %s\n", address, strerror (errno));
+      if (fd != -1)
+	close (fd);
+      freeaddrinfo (ai);
+      return -1;
+    }
+  freeaddrinfo (ai);
+  return fd;
+}
+
+static void *
+server (arg)
+     void *arg;
+{
+  struct pollfd pfds[MAX_CONNECTIONS + 2];
+  Connection conns[MAX_CONNECTIONS];
+  unsigned k, n, n_conns;
+  uint64_t now;
+
+  for (;;)
+    {
+      pfds[0].fd = stop_fd;
+      pfds[0].events = POLLIN;
+      n = 1;
+      n_conns = 0;
+      now = monotonic_ns ();
+      for (k = 0; k < MAX_CONNECTIONS; ++k)
+	{
+	  if (connections[k].fd == -1)
+	    continue;
+	  if (now > connections[k].deadline)
+	    {
+	      close_connection (&connections[k]);
+	      continue;
+	    }
+	  conns[n_conns++] = &connections[k];
+	  pfds[n].fd = connections[k].fd;
+	  pfds[n].events = connections[k].responding ? POLLOUT : POLLIN;
+	  ++n;
+	}
+      /* With all slots taken, new connections wait in the backlog. */
+      if (n_conns < MAX_CONNECTIONS)
+	{
+	  pfds[n].fd = listen_fd;
+	  pfds[n].events = POLLIN;
+	  ++n;
+	}
+      if (poll (pfds, n, 1000) == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  fprintf (stderr, "Cannot wait for connections: %s\n",
+		   strerror (errno));
+	  break;
+	}
+      if (pfds[0].revents)
+	break;
+      for (k = 0; k < n_conns; ++k)
+	if (pfds[k + 1].revents)
+	  serve_connection (conns[k]);
+      if (n_conns < MAX_CONNECTIONS && pfds[n - 1].revents)
+	accept_connection ();
+    }
+  return 0;
+}
+
+static void
+accept_connection ()
+{
+  Connection c;
+  unsigned k;
+  int fd;
+
+  if ((fd = accept (listen_fd, 0, 0)) == -1)
+    return;
+  if (fcntl (fd, F_SETFL, O_NONBLOCK) == -1
+      || fcntl (fd, F_SETFD, FD_CLOEXEC) == -1)
+    {
+      close (fd);
+      return;
+    }
+  for (k = 0; k < MAX_CONNECTIONS && connections[k].fd != -1; ++k)
+    ;
+  c = &connections[k];
+  c->fd = fd;
+  c->deadline = monotonic_ns () + CONNECTION_TIMEOUT * NSECS_PER_SEC;
+  c->request_len = 0;
+  c->responding = 0;
+  c->body = 0;
+  c->sent = 0;
+}
+
+/* Read the request until the empty line that ends its header, then
+   send the response. */
+static void
+serve_connection (c)
+     Connection c;
+{
+  ssize_t n;
+  size_t body_len;
+
+  if (!c->responding)
+    {
+      n = read (c->fd, c->request + c->request_len,
+		MAX_REQUEST - 1 - c->request_len);
+      if (n <= 0)
+	{
+	  if (n == 0 || (errno != EINTR && errno != EAGAIN))
+	    close_connection (c);
+	  return;
+	}
+      c->request_len += n;
+      c->request[c->request_len] = 0;
+      if (strstr (c->request, "\r\n\r\n") == 0
+	  && strstr (c->request, "\n\n") == 0)
+	{
+	  if (c->request_len == MAX_REQUEST - 1)
+	    close_connection (c);
+	  return;
+	}
+      start_response (c);
+    }
+  body_len = c->body ? c->body->len : 0;
+  for (;;)
+    {
+      if (c->sent < c->header_len)
+	n = write (c->fd, c->header + c->sent, c->header_len - c->sent);
+      else if (c->sent < c->header_len + body_len)
+	n = write (c->fd, c->body->data + (c->sent - c->header_len),
+		   body_len - (c->sent - c->header_len));
+      else
+	{
+	  close_connection (c);
+	  return;
+	}
+      if (n == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if (errno != EAGAIN)
+	    close_connection (c);
+	  return;
+	}
+      c->sent += n;
+    }
+}
+
+/* Take a reference to the front body for a request for the metrics,
+   and make up the header. */
+static void
+start_response (c)
+     Connection c;
+{
+  const char *status = "404 Not Found";
+  size_t len = 0;
+
+  if (strncmp (c->request, "GET / ", 6) == 0
+      || strncmp (c->request, "GET /metrics ", 13) == 0
+      || strncmp (c->request, "GET /metrics?", 13) == 0)
+    {
+      pthread_mutex_lock (&lock);
+      c->body = front;
+      __atomic_add_fetch (&c->body->refs, 1, __ATOMIC_ACQ_REL);
+      pthread_mutex_unlock (&lock);
+      status = "200 OK";
+      len = c->body->len;
+    }
+  c->header_len = snprintf (c->header, sizeof c->header,
+			    "HTTP/1.1 %s\r\n"
+			    "Content-Type: application/openmetrics-text;"
+			    " version=1.0.0; charset=utf-8\r\n"
+			    "Content-Length: %lu\r\n"
+			    "Connection: close\r\n\r\n",
+			    status, (unsigned long) len);
+  c->responding = 1;
+  c->sent = 0;
+}
+
+static void
+close_connection (c)
+     Connection c;
+{
+  if (c->body)
+    __atomic_sub_fetch (&c->body->refs, 1, __ATOMIC_ACQ_REL);
+  c->body = 0;
+  close (c->fd);
+  c->fd = -1;
+}
+
+/* Return a pointer to the end of the back body, after making sure
+   there are at least N bytes free, or 0 if there is no memory. */
+static char *
+body_room (n)
+     size_t n;
+{
+  size_t size;
+  char *data;
+
+  if (back->len + n > back->size)
+    {
+      size = back->size ? 2 * back->size : 65536;
+      while (back->len + n > size)
+	size *= 2;
+      if ((data = realloc (back->data, size)) == 0)
+	{
+	  fprintf (stderr, "Out of memory\n");
+	  building = 0;
+	  return 0;
+	}
+      back->data = data;
+      back->size = size;
+    }
+  return back->data + back->len;
+}
+
+static void
+body_used (end)
+     char *end;
+{
+  back->len = end - back->data;
+}
+
+/* The metrics that are not per socket, and the end of the body. */
+static int
+add_aggregates ()
+{
+  struct timeval tv;
+  unsigned k;
+  char *cp;
+
+  if ((cp = body_room (LINE_ROOM)) == 0)
+    return -1;
+  current_timeval (&tv);
+  cp += sprintf (cp, "# TYPE qui_rounds counter\n"
+		 "# HELP qui_rounds Sampling rounds.\n"
+		 "qui_rounds_total %lu\n"
+		 "# TYPE qui_round_timestamp_seconds gauge\n"
+		 "# UNIT qui_round_timestamp_seconds seconds\n"
+		 "# HELP qui_round_timestamp_seconds When the last round "
+		 "ended.\n"
+		 "qui_round_timestamp_seconds %ld.%06ld\n"
+		 "# TYPE qui_sockets gauge\n"
+		 "# HELP qui_sockets Sockets seen in the last round.\n",
+		 rounds, (long) tv.tv_sec, (long) tv.tv_usec);
+  body_used (cp);
+  for (k = 0; k < N_PROTOS; ++k)
+    {
+      if ((cp = body_room (LINE_ROOM)) == 0)
+	return -1;
+      cp += sprintf (cp, "qui_sockets{proto=\"%s\"} %lu\n",
+		     proto_names[k], aggregates[k][0].sockets);
+      body_used (cp);
+    }
+  if (add_aggregate_lines ("qui_queue_bytes", AGGREGATE_SUM, "Sum of the "
+			   "queue sizes of all sockets in the last round.") != 0
+      || add_aggregate_lines ("qui_queue_max_bytes", AGGREGATE_MAX, "Largest "
+			      "queue of any socket in the last round.") != 0
+      || add_aggregate_lines ("qui_queue_occupancy_bytes", AGGREGATE_HISTOGRAM,
+			      "Queue sizes of all sockets in all rounds.") != 0
+      || (cp = body_room (LINE_ROOM)) == 0)
+    return -1;
+  cp += sprintf (cp, "# EOF\n");
+  body_used (cp);
+  return 0;
+}
+
+/* Copy label value VAL to CP with backslashes, double quotes and
+   newlines escaped, cut off at MAX_NETNS_LABEL - 1 characters as in
+   the output lines.  Returns the end. */
+static char *
+escape_label (cp, val)
+     char *cp;
+     const char *val;
+{
+  const char *end = val + strnlen (val, MAX_NETNS_LABEL - 1);
+
+  for (; val < end; ++val)
+    switch (*val)
+      {
+      case '\\': *cp++ = '\\'; *cp++ = '\\'; break;
+      case '"': *cp++ = '\\'; *cp++ = '"'; break;
+      case '\n': *cp++ = '\\'; *cp++ = 'n'; break;
+      default: *cp++ = *val; break;
+      }
+  return cp;
+}
+
+/* A metric family with a sample, or for the histogram a set of
+   samples, per protocol and queue. */
+static int
+add_aggregate_lines (name, kind, help)
+     const char *name;
+     AggregateKind kind;
+     const char *help;
+{
+  AggregateRec *a;
+  unsigned k, q, b;
+  uint64_t cumulative;
+  char *cp;
+
+  if ((cp = body_room (LINE_ROOM)) == 0)
+    return -1;
+  cp += sprintf (cp, "# TYPE %s %s\n# UNIT %s bytes\n# HELP %s %s\n",
+		 name, kind == AGGREGATE_HISTOGRAM ? "histogram" : "gauge",
+		 name, name, help);
+  body_used (cp);
+  for (k = 0; k < N_PROTOS; ++k)
+    for (q = 0; q < N_QUEUES; ++q)
+      {
+	a = &aggregates[k][q];
+	if (kind != AGGREGATE_HISTOGRAM)
+	  {
+	    if ((cp = body_room (LINE_ROOM)) == 0)
+	      return -1;
+	    cp += sprintf (cp, "%s{proto=\"%s\",queue=\"%s\"} %llu\n",
+			   name, proto_names[k], queue_names[q],
+			   (unsigned long long) (kind == AGGREGATE_MAX
+						 ? a->max : a->sum));
+	    body_used (cp);
+	    continue;
+	  }
+	cumulative = 0;
+	for (b = 0; b < N_BUCKETS; ++b)
+	  {
+	    if ((cp = body_room (LINE_ROOM)) == 0)
+	      return -1;
+	    cumulative += a->buckets[b];
+	    cp += sprintf (cp, "%s_bucket{proto=\"%s\",queue=\"%s\",le=\"",
+			   name, proto_names[k], queue_names[q]);
+	    if (b < N_BUCKETS - 1)
+	      cp += sprintf (cp, "%lu.0", (unsigned long) bucket_limits[b]);
+	    else
+	      cp += sprintf (cp, "+Inf");
+	    cp += sprintf (cp, "\"} %llu\n", (unsigned long long) cumulative);
+	    body_used (cp);
+	  }
+	if ((cp = body_room (LINE_ROOM)) == 0)
+	  return -1;
+	cp += sprintf (cp, "%s_count{proto=\"%s\",queue=\"%s\"} %llu\n"
+		       "%s_sum{proto=\"%s\",queue=\"%s\"} %llu\n",
+		       name, proto_names[k], queue_names[q],
+		       (unsigned long long) a->samples,
+		       name, proto_names[k], queue_names[q],
+		       (unsigned long long) a->total);
+	body_used (cp);
+      }
+  return 0;
+}
@@ -0,0 +1,16 @@
+/*
+ exporter.h
+
+ Date Created: Sat Oct 17 23:58:12 2026
+ */
+
+#ifndef __QUI_EXPORTER_H__
+#define __QUI_EXPORTER_H__ 1
+
+extern int init_exporter (Preferences);
+extern void begin_exporter_round (void);
+extern void update_exporter (ProcFileEntry);
+extern void end_exporter_round (void);
+extern void finish_exporter (void);
+
+#endif /* not __QUI_EXPORTER_H__ */
@@ -0,0 +1,210 @@
+/*
+ format.c
+
+ Date Created: Sat Oct 17 17:57:40 2026
+
+ Formatting of numbers, socket endpoints and time stamps
+
+ These produce the same text as getnameinfo() with NI_NUMERICHOST and
+ NI_NUMERICSERV, and strftime() with "%H:%M:%S", but without going
+ through the resolver and stdio machinery for every line.  Each
+ function writes into a caller-supplied buffer, which must have room
+ for the longest possible result, does not terminate the string, and
+ returns a pointer just past what it has written.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "format.h"
+
+static char *format_ipv4 (char *, const uint8_t *);
+static char *format_ipv6 (char *, const uint8_t *);
+static char *format_hex16 (char *, unsigned);
+static char *format_2digits (char *, unsigned);
+
+static const char hex_digits[] = "0123456789abcdef";
+
+char *
+format_unsigned (cp, val)
+     char *cp;
+     unsigned long val;
+{
+  char digits[MAX_UNSIGNED_STRING];
+  char *dp = digits + sizeof digits;
+
+  do
+    {
+      *--dp = '0' + val % 10;
+      val /= 10;
+    }
+  while (val != 0);
+  memcpy (cp, dp, digits + sizeof digits - dp);
+  return cp + (digits + sizeof digits - dp);
+}
+
+/* ADDR is in network byte order, PORT in host byte order.  IPv6
+   addresses are put in brackets. */
+char *
+format_endpoint (cp, af, addr, port)
+     char *cp;
+     int af;
+     const uint8_t *addr;
+     uint16_t port;
+{
+  if (af == AF_INET6)
+    {
+      *cp++ = '[';
+      cp = format_ipv6 (cp, addr);
+      *cp++ = ']';
+    }
+  else
+    cp = format_ipv4 (cp, addr);
+  *cp++ = ':';
+  return format_unsigned (cp, port);
+}
+
+/* The broken-down local time is only recomputed when the second
+   changes, which makes this function unsafe to use from more than one
+   thread. */
+char *
+format_time (cp, tv, usecs)
+     char *cp;
+     const struct timeval *tv;
+     int usecs;
+{
+  static time_t cached_sec = -1;
+  static char hms[8];
+  struct tm tm;
+  time_t t;
+  unsigned long frac;
+  int k;
+
+  if (tv->tv_sec != cached_sec)
+    {
+      t = tv->tv_sec;
+      if (localtime_r (&t, &tm) == 0)
+	{
+	  fprintf (stderr, "Cannot convert time\n");
+	  memcpy (hms, "??:??:??", 8);
+	}
+      else
+	{
+	  format_2digits (hms, tm.tm_hour);
+	  hms[2] = ':';
+	  format_2digits (hms + 3, tm.tm_min);
+	  hms[5] = ':';
+	  format_2digits (hms + 6, tm.tm_sec);
+	}
+      cached_sec = tv->tv_sec;
+    }
+  memcpy (cp, hms, 8);
+  cp += 8;
+  *cp++ = '.';
+  frac = usecs ? tv->tv_usec : tv->tv_usec / 1000;
+  for (k = usecs ? 5 : 2; k >= 0; --k)
+    {
+      cp[k] = '0' + frac % 10;
+      frac /= 10;
+    }
+  return cp + (usecs ? 6 : 3);
+}
+
+static char *
+format_ipv4 (cp, a)
+     char *cp;
+     const uint8_t *a;
+{
+  int k;
+
+  for (k = 0; k < 4; ++k)
+    {
+      if (k > 0)
+	*cp++ = '.';
+      cp = format_unsigned (cp, a[k]);
+    }
+  return cp;
+}
+
+/* Like inet_ntop(): the longest run of at least two zero groups, the
+   first one if there is a tie, is replaced by "::", and IPv4-mapped
+   and IPv4-compatible addresses end in dotted-quad notation. */
+static char *
+format_ipv6 (cp, a)
+     char *cp;
+     const uint8_t *a;
+{
+  unsigned words[8];
+  int best_base = -1, best_len = 0, cur_base = -1, cur_len = 0;
+  int k;
+
+  for (k = 0; k < 8; ++k)
+    {
+      words[k] = (a[2 * k] << 8) | a[2 * k + 1];
+      if (words[k] == 0)
+	{
+	  if (cur_base == -1)
+	    {
+	      cur_base = k;
+	      cur_len = 0;
+	    }
+	  if (++cur_len > best_len)
+	    {
+	      best_base = cur_base;
+	      best_len = cur_len;
+	    }
+	}
+      else
+	cur_base = -1;
+    }
+  if (best_len < 2)
+    best_base = -1;
+  for (k = 0; k < 8; ++k)
+    {
+      if (best_base != -1 && k >= best_base && k < best_base + best_len)
+	{
+	  if (k == best_base)
+	    *cp++ = ':';
+	  continue;
+	}
+      if (k != 0)
+	*cp++ = ':';
+      if (k == 6 && best_base == 0
+	  && (best_len == 6 || (best_len == 5 && words[5] == 0xffff)))
+	return format_ipv4 (cp, a + 12);
+      cp = format_hex16 (cp, words[k]);
+    }
+  if (best_base != -1 && best_base + best_len == 8)
+    *cp++ = ':';
+  return cp;
+}
+
+static char *
+format_hex16 (cp, val)
+     char *cp;
+     unsigned val;
+{
+  int shift;
+
+  for (shift = 12; shift > 0 && (val >> shift) == 0; shift -= 4)
+    ;
+  for (; shift >= 0; shift -= 4)
+    *cp++ = hex_digits[(val >> shift) & 0xf];
+  return cp;
+}
+
+static char *
+format_2digits (cp, val)
+     char *cp;
+     unsigned val;
+{
+  cp[0] = '0' + val / 10;
+  cp[1] = '0' + val % 10;
+  return cp + 2;
+}
@@ -0,0 +1,26 @@
+/*
+ format.h
+
+ Date Created: Sat Oct 17 17:58:12 2026
+ */
+
+#ifndef __QUI_FORMAT_H__
+#define __QUI_FORMAT_H__ 1
+
+#include <stdint.h>
+#include <sys/time.h>
+
+/* "[" IPv6 address with embedded IPv4 address "]:" port */
+#define MAX_ENDPOINT_STRING 56
+
+/* HH:MM:SS.uuuuuu */
+#define MAX_TIME_STRING 16
+
+/* a 64-bit number in decimal */
+#define MAX_UNSIGNED_STRING 20
+
+extern char *format_unsigned (char *, unsigned long);
+extern char *format_endpoint (char *, int, const uint8_t *, uint16_t);
+extern char *format_time (char *, const struct timeval *, int);
+
+#endif /* not __QUI_FORMAT_H__ */
@@ -0,0 +1,184 @@
+/*
+ hex.c
+
+ Date Created: Sat Oct 17 12:09:48 2026
+
+ Fixed-width hex decoding for the fields of /proc/net/{tcp,udp}{,6}
+
+ The kernel prints addresses, ports and queue sizes as upper-case
+ hex numbers of fixed width (%08X, %04X, and four %08X for IPv6
+ addresses).  Rather than checking and converting byte by byte, the
+ decoders here handle a whole field at once: 4 and 8 digits with
+ SWAR arithmetic on a 32/64-bit word, and the 32 digits of an IPv6
+ address either with four SWAR steps or, where the CPU supports
+ SSSE3, with two 16-byte vectors.  The 32-digit variant is selected
+ at run time by init_hex_decoder().
+
+ All decoders return -1 without storing anything if one of the
+ characters is not a hex digit.  Lower-case digits are accepted.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hex.h"
+
+#if defined (__x86_64__) && defined (__GNUC__)
+#define HAVE_SSSE3_DECODER 1
+#include <immintrin.h>
+#endif
+
+static int hex_decode_32_swar (const char *, uint32_t *);
+#ifdef HAVE_SSSE3_DECODER
+static int hex_decode_32_ssse3 (const char *, uint32_t *);
+#endif
+
+int (* hex_decode_32) (const char *, uint32_t *) = hex_decode_32_swar;
+
+#define ONES64	0x0101010101010101ULL
+#define HIGH64	0x8080808080808080ULL
+#define ONES32	0x01010101U
+#define HIGH32	0x80808080U
+
+void
+init_hex_decoder ()
+{
+#ifdef HAVE_SSSE3_DECODER
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("ssse3"))
+    {
+      hex_decode_32 = hex_decode_32_ssse3;
+      return;
+    }
+#endif
+  hex_decode_32 = hex_decode_32_swar;
+}
+
+const char *
+hex_decoder_name ()
+{
+#ifdef HAVE_SSSE3_DECODER
+  if (hex_decode_32 == hex_decode_32_ssse3)
+    return "ssse3";
+#endif
+  return "swar";
+}
+
+/* Eight characters are loaded into a 64-bit word, first character in
+   the least significant byte.  For each byte, the high bit of
+   `digit' and `letter' is set if it is in '0'..'9' or 'a'..'f'
+   respectively (after folding to lower case); the additions cannot
+   carry into the neighbouring byte because all bytes are known to be
+   below 0x80.  The nibble value of a letter is its low four bits plus
+   nine.  The nibbles are then packed pairwise into bytes and those
+   into a 32-bit word, which comes out byte-swapped. */
+int
+hex_decode_8 (s, valp)
+     const char *s;
+     uint32_t *valp;
+{
+  uint64_t v, lv, digit, letter, nib, t;
+
+  memcpy (&v, s, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64 (v);
+#endif
+  if (v & HIGH64)
+    return -1;
+  lv = v | (ONES64 * 0x20);
+  digit = (v + ONES64 * (0x80 - '0')) & ~(v + ONES64 * (0x80 - '9' - 1));
+  letter = (lv + ONES64 * (0x80 - 'a')) & ~(lv + ONES64 * (0x80 - 'f' - 1));
+  if (((digit | letter) & HIGH64) != HIGH64)
+    return -1;
+  nib = (v & (ONES64 * 0x0f)) + ((letter & HIGH64) >> 7) * 9;
+  t = ((nib & 0x000f000f000f000fULL) << 4) | ((nib >> 8) & 0x000f000f000f000fULL);
+  t = (t | (t >> 8)) & 0x0000ffff0000ffffULL;
+  t = (t | (t >> 16)) & 0xffffffffULL;
+  *valp = __builtin_bswap32 ((uint32_t) t);
+  return 0;
+}
+
+int
+hex_decode_4 (s, valp)
+     const char *s;
+     uint16_t *valp;
+{
+  uint32_t v, lv, digit, letter, nib, t;
+
+  memcpy (&v, s, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap32 (v);
+#endif
+  if (v & HIGH32)
+    return -1;
+  lv = v | (ONES32 * 0x20);
+  digit = (v + ONES32 * (0x80 - '0')) & ~(v + ONES32 * (0x80 - '9' - 1));
+  letter = (lv + ONES32 * (0x80 - 'a')) & ~(lv + ONES32 * (0x80 - 'f' - 1));
+  if (((digit | letter) & HIGH32) != HIGH32)
+    return -1;
+  nib = (v & (ONES32 * 0x0f)) + ((letter & HIGH32) >> 7) * 9;
+  t = ((nib & 0x000f000fU) << 4) | ((nib >> 8) & 0x000f000fU);
+  t = (t | (t >> 8)) & 0xffffU;
+  *valp = __builtin_bswap16 ((uint16_t) t);
+  return 0;
+}
+
+/* An IPv6 address is printed as four %08X words, each the host-order
+   value of one 32-bit word of the address. */
+static int
+hex_decode_32_swar (s, words)
+     const char *s;
+     uint32_t *words;
+{
+  uint32_t w[4];
+
+  if (hex_decode_8 (s, &w[0]) == -1
+      || hex_decode_8 (s + 8, &w[1]) == -1
+      || hex_decode_8 (s + 16, &w[2]) == -1
+      || hex_decode_8 (s + 24, &w[3]) == -1)
+    return -1;
+  memcpy (words, w, sizeof w);
+  return 0;
+}
+
+#ifdef HAVE_SSSE3_DECODER
+
+static inline __attribute__ ((target ("ssse3"))) int
+hex_nibbles_ssse3 (__m128i v, __m128i *nibp)
+{
+  __m128i lv = _mm_or_si128 (v, _mm_set1_epi8 (0x20));
+  __m128i digit = _mm_and_si128 (_mm_cmpgt_epi8 (v, _mm_set1_epi8 ('0' - 1)),
+				 _mm_cmplt_epi8 (v, _mm_set1_epi8 ('9' + 1)));
+  __m128i letter = _mm_and_si128 (_mm_cmpgt_epi8 (lv, _mm_set1_epi8 ('a' - 1)),
+				  _mm_cmplt_epi8 (lv, _mm_set1_epi8 ('f' + 1)));
+
+  if (_mm_movemask_epi8 (_mm_or_si128 (digit, letter)) != 0xffff)
+    return -1;
+  *nibp = _mm_add_epi8 (_mm_and_si128 (v, _mm_set1_epi8 (0x0f)),
+			_mm_and_si128 (letter, _mm_set1_epi8 (9)));
+  return 0;
+}
+
+/* Pairs of nibbles are combined with a multiply-add (16 * high +
+   low), packed to bytes in character order, and finally each group
+   of four bytes is reversed to give host-order (little-endian)
+   words. */
+static __attribute__ ((target ("ssse3"))) int
+hex_decode_32_ssse3 (const char *s, uint32_t *words)
+{
+  __m128i lo, hi, bytes;
+
+  if (hex_nibbles_ssse3 (_mm_loadu_si128 ((const __m128i *) s), &lo) == -1
+      || hex_nibbles_ssse3 (_mm_loadu_si128 ((const __m128i *) (s + 16)),
+			    &hi) == -1)
+    return -1;
+  lo = _mm_maddubs_epi16 (lo, _mm_set1_epi16 (0x0110));
+  hi = _mm_maddubs_epi16 (hi, _mm_set1_epi16 (0x0110));
+  bytes = _mm_packus_epi16 (lo, hi);
+  bytes = _mm_shuffle_epi8 (bytes, _mm_setr_epi8 (3, 2, 1, 0, 7, 6, 5, 4,
+						  11, 10, 9, 8, 15, 14, 13, 12));
+  _mm_storeu_si128 ((__m128i *) words, bytes);
+  return 0;
+}
+
+#endif /* HAVE_SSSE3_DECODER */
@@ -0,0 +1,18 @@
+/*
+ hex.h
+
+ Date Created: Sat Oct 17 12:10:05 2026
+ */
+
+#ifndef __QUI_HEX_H__
+#define __QUI_HEX_H__ 1
+
+#include <stdint.h>
+
+extern void init_hex_decoder (void);
+extern const char *hex_decoder_name (void);
+extern int hex_decode_4 (const char *, uint16_t *);
+extern int hex_decode_8 (const char *, uint32_t *);
+extern int (* hex_decode_32) (const char *, uint32_t *);
+
+#endif /* not __QUI_HEX_H__ */
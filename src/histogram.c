@@ -0,0 +1,122 @@
+/*
+ histogram.c
+
+ Date Created: Sat Oct 17 22:48:12 2026
+
+ Histograms of 64-bit values with fixed, logarithmic buckets
+
+ As in HdrHistogram, each power of two is divided into the same number
+ of linear sub-buckets, so the relative error of a value is bounded
+ over the whole range, and finding the bucket of a value only takes a
+ count-leading-zeros and a shift.  Values below 2^HISTOGRAM_BITS
+ have buckets of their own.  There are no allocations and no locks:
+ the buckets are updated with relaxed atomic additions, so that any
+ thread can record into the same histogram.  A histogram that is read
+ while another thread records into it may be off by the values being
+ recorded at that moment, which is fine for reporting.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "histogram.h"
+
+void
+init_histogram (h)
+     Histogram h;
+{
+  memset (h, 0, sizeof (HistogramRec));
+  h->min = ~(uint64_t) 0;
+}
+
+void
+histogram_record (h, val)
+     Histogram h;
+     uint64_t val;
+{
+  uint64_t old;
+
+  __atomic_fetch_add (&h->buckets[log_bucket_index (val, HISTOGRAM_BITS)], 1,
+		      __ATOMIC_RELAXED);
+  __atomic_fetch_add (&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&h->sum, val, __ATOMIC_RELAXED);
+  old = __atomic_load_n (&h->max, __ATOMIC_RELAXED);
+  while (val > old
+	 && !__atomic_compare_exchange_n (&h->max, &old, val, 1,
+					  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  old = __atomic_load_n (&h->min, __ATOMIC_RELAXED);
+  while (val < old
+	 && !__atomic_compare_exchange_n (&h->min, &old, val, 1,
+					  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+/* The smallest value such that a fraction Q (between 0 and 1) of the
+   recorded values are at most that, as far as the buckets tell; that
+   is, the upper end of the bucket in which the quantile falls, but
+   never more than the maximum. */
+uint64_t
+histogram_percentile (h, q)
+     Histogram h;
+     double q;
+{
+  uint64_t count = __atomic_load_n (&h->count, __ATOMIC_RELAXED);
+  uint64_t rank, seen = 0, high;
+  unsigned k;
+
+  if (count == 0)
+    return 0;
+  rank = q * count;
+  if (rank < q * count || rank < 1)
+    ++rank;
+  for (k = 0; k < HISTOGRAM_BUCKETS; ++k)
+    {
+      seen += __atomic_load_n (&h->buckets[k], __ATOMIC_RELAXED);
+      if (seen >= rank)
+	break;
+    }
+  high = log_bucket_high (k < HISTOGRAM_BUCKETS ? k : HISTOGRAM_BUCKETS - 1,
+			  HISTOGRAM_BITS);
+  return high < h->max ? high : h->max;
+}
+
+double
+histogram_mean (h)
+     Histogram h;
+{
+  uint64_t count = __atomic_load_n (&h->count, __ATOMIC_RELAXED);
+
+  return count ? (double) __atomic_load_n (&h->sum, __ATOMIC_RELAXED) / count
+    : 0;
+}
+
+/* The bucket of VAL when values are kept with BITS significant bits.
+   Values below 2^BITS have a bucket each; above that, the values whose
+   highest bit is at BITS - 1 + b go into 2^(BITS-1) buckets that are
+   2^b wide.  Values below 2^N take (N - BITS + 2) * 2^(BITS-1)
+   buckets. */
+unsigned
+log_bucket_index (val, bits)
+     uint64_t val;
+     unsigned bits;
+{
+  unsigned b;
+
+  b = 63 - __builtin_clzll (val | ((1 << bits) - 1)) - (bits - 1);
+  return (b << (bits - 1)) + (unsigned) (val >> b);
+}
+
+/* The largest value that goes into bucket K. */
+uint64_t
+log_bucket_high (k, bits)
+     unsigned k;
+     unsigned bits;
+{
+  unsigned half = 1 << (bits - 1);
+  unsigned b = k < 2 * half ? 0 : k / half - 1;
+  uint64_t sub = k - b * half;
+
+  return ((sub + 1) << b) - 1;
+}
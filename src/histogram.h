@@ -0,0 +1,37 @@
+/*
+ histogram.h
+
+ Date Created: Sat Oct 17 22:48:12 2026
+ */
+
+#ifndef __QUI_HISTOGRAM_H__
+#define __QUI_HISTOGRAM_H__ 1
+
+#include <stdint.h>
+
+/* Values are kept with HISTOGRAM_BITS significant bits, that is to
+   within 1 part in 2^(HISTOGRAM_BITS-1). */
+#define HISTOGRAM_BITS		5
+#define HISTOGRAM_HALF		(1 << (HISTOGRAM_BITS - 1))
+#define HISTOGRAM_BUCKETS	((64 - HISTOGRAM_BITS + 2) * HISTOGRAM_HALF)
+
+typedef struct HistogramRec *Histogram;
+
+typedef struct HistogramRec
+{
+  uint64_t	count;
+  uint64_t	sum;
+  uint64_t	min;
+  uint64_t	max;
+  uint64_t	buckets[HISTOGRAM_BUCKETS];
+}
+HistogramRec;
+
+extern void init_histogram (Histogram);
+extern void histogram_record (Histogram, uint64_t);
+extern uint64_t histogram_percentile (Histogram, double);
+extern double histogram_mean (Histogram);
+extern unsigned log_bucket_index (uint64_t, unsigned);
+extern uint64_t log_bucket_high (unsigned, unsigned);
+
+#endif /* not __QUI_HISTOGRAM_H__ */
@@ -69,7 +69,7 @@ insert_sample (h, tv, val)
     }
   if (h->last_sample == h->first_sample)
     {
-      h->first_sample = (h->first_sample + 1 % h->n_samples);
+      h->first_sample = (h->first_sample + 1) % h->n_samples;
     }
   s = &(h->samples[insert_pointer]);
   s->ts = *tv;
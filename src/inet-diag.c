@@ -0,0 +1,346 @@
+/*
+ inet-diag.c
+
+ Date Created: Sat Oct 17 09:12:33 2026
+
+ Collect socket queue information using NETLINK_SOCK_DIAG dumps
+
+ This is an alternative to parsing /proc/net/{udp,tcp}{,6}.  The
+ kernel sends binary inet_diag_msg records, so it does not have to
+ format every socket as hex text only for us to parse it back.  If a
+ specific port was requested, the filter is compiled to inet_diag
+ bytecode so that the kernel only sends the sockets we care about.
+
+ Like the /proc parser, entries below the threshold are dropped
+ before their addresses are converted.  The others are converted to
+ the same ProcFileEntryRec, and handed to the same callback.  With
+ --drops, the memory information of UDP sockets is asked for as well,
+ for its drop count.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "inet-diag.h"
+#include "timestamp.h"
+#include "instrument.h"
+
+typedef struct DiagTableRec *DiagTable;
+
+static int relevant_diag_table_p (DiagTable, Preferences);
+static int open_diag_socket (void);
+static int dump_diag_table (DiagTable, Preferences, SockEntryCallback, void *);
+static int send_diag_request (DiagTable, Preferences);
+static size_t build_port_filter (uint16_t, struct inet_diag_bc_op *);
+static uint32_t diag_drops (struct nlmsghdr *);
+static void convert_diag_msg (const struct inet_diag_msg *, int, ProcFileEntry);
+
+#define RECVBUFSIZE 65536
+
+typedef struct DiagTableRec
+{
+  const char  *	name;
+  int		af;
+  int		proto;
+}
+DiagTableRec;
+
+static DiagTableRec
+diag_tables[] = {
+  { .name = "udp",  .af = AF_INET,  .proto = IPPROTO_UDP, },
+  { .name = "udp6", .af = AF_INET6, .proto = IPPROTO_UDP, },
+  { .name = "tcp",  .af = AF_INET,  .proto = IPPROTO_TCP, },
+  { .name = "tcp6", .af = AF_INET6, .proto = IPPROTO_TCP, },
+  { .name = 0,      .af = 0,        .proto = 0, },
+};
+
+/* The netlink socket is kept open across rounds. */
+static int diag_fd = -1;
+static uint32_t diag_seq = 0;
+
+int
+parse_inet_diag (p, callback, closure)
+     Preferences p;
+     SockEntryCallback callback;
+     void *closure;
+{
+  DiagTable table;
+
+  if (diag_fd == -1 && (diag_fd = open_diag_socket ()) == -1)
+    return -1;
+  for (table = &diag_tables[0]; table->name != 0; ++table)
+    {
+      if (relevant_diag_table_p (table, p))
+	{
+	  if (dump_diag_table (table, p, callback, closure) != 0)
+	    {
+	      fprintf (stderr, "error dumping %s sockets\n", table->name);
+	      return -1;
+	    }
+	}
+    }
+  return 0;
+}
+
+static int
+relevant_diag_table_p (table, p)
+     DiagTable table;
+     Preferences p;
+{
+  if (table->proto == IPPROTO_TCP && !p->want_tcp)
+    return 0;
+  if (table->proto == IPPROTO_UDP && !p->want_udp)
+    return 0;
+  if (table->af == AF_INET && !p->want_ipv4)
+    return 0;
+  if (table->af == AF_INET6 && !p->want_ipv6)
+    return 0;
+  return 1;
+}
+
+static int
+open_diag_socket ()
+{
+  int fd;
+
+  fd = socket (AF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+  if (fd == -1)
+    {
+      fprintf (stderr, "Error opening sock_diag socket: %s\n",
+	       strerror (errno));
+      return -1;
+    }
+  return fd;
+}
+
+static int
+dump_diag_table (table, p, callback, closure)
+     DiagTable table;
+     Preferences p;
+     SockEntryCallback callback;
+     void *closure;
+{
+  static char buf[RECVBUFSIZE] __attribute__ ((aligned (NLMSG_ALIGNTO)));
+  struct timeval tv;
+  ProcFileEntryRec pfe;
+  ssize_t len;
+  struct nlmsghdr *nlh;
+  const struct inet_diag_msg *r;
+  uint64_t start_ns, end_ns;
+  uint32_t drops;
+
+  if (send_diag_request (table, p) != 0)
+    return -1;
+  for (;;)
+    {
+      /* The kernel fills each batch of the dump on the recv() that
+	 asks for it. */
+      start_ns = monotonic_ns ();
+      len = recv (diag_fd, buf, sizeof buf, 0);
+      end_ns = monotonic_ns ();
+      if (len == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  fprintf (stderr, "Error receiving %s dump: %s\n",
+		   table->name, strerror (errno));
+	  return -1;
+	}
+      note_read (start_ns, end_ns, len);
+      if (len == 0)
+	{
+	  fprintf (stderr, "Unexpected EOF in %s dump\n", table->name);
+	  return -1;
+	}
+      for (nlh = (struct nlmsghdr *) buf;
+	   NLMSG_OK (nlh, len);
+	   nlh = NLMSG_NEXT (nlh, len))
+	{
+	  if (nlh->nlmsg_seq != diag_seq)
+	    continue;
+	  if (nlh->nlmsg_type == NLMSG_DONE)
+	    return 0;
+	  if (nlh->nlmsg_type == NLMSG_ERROR)
+	    {
+	      struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA (nlh);
+
+	      fprintf (stderr, "sock_diag error for %s: %s\n",
+		       table->name, strerror (-err->error));
+	      return -1;
+	    }
+	  if (nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY
+	      || nlh->nlmsg_len < NLMSG_LENGTH (sizeof (struct inet_diag_msg)))
+	    continue;
+	  note_lines (1);
+	  r = (struct inet_diag_msg *) NLMSG_DATA (nlh);
+	  drops = p->want_drops && table->proto == IPPROTO_UDP
+	    ? diag_drops (nlh) : 0;
+	  if (!(p->want_drops && table->proto == IPPROTO_UDP)
+	      && !((p->want_input && (r->idiag_rqueue >= p->filter_threshold))
+		   || (p->want_output
+		       && (r->idiag_wqueue >= p->filter_threshold))))
+	    continue;
+	  convert_diag_msg (r, table->proto, &pfe);
+	  pfe.drops = drops;
+	  stamp_entry (&pfe, start_ns, end_ns);
+	  timestamp_to_timeval (pfe.ts, &tv);
+	  (* callback) (&pfe, &tv, closure);
+	}
+    }
+}
+
+static int
+send_diag_request (table, p)
+     DiagTable table;
+     Preferences p;
+{
+  struct
+  {
+    struct nlmsghdr		nlh;
+    struct inet_diag_req_v2	req;
+    struct rtattr		rta;
+    struct inet_diag_bc_op	bc[9];
+  } msg;
+  struct sockaddr_nl sa;
+  size_t bc_len = 0;
+
+  memset (&msg, 0, sizeof msg);
+  msg.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+  msg.nlh.nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+  msg.nlh.nlmsg_seq = ++diag_seq;
+  msg.req.sdiag_family = table->af;
+  msg.req.sdiag_protocol = table->proto;
+  msg.req.idiag_states = ~0U;
+  if (p->want_drops && table->proto == IPPROTO_UDP)
+    msg.req.idiag_ext |= 1 << (INET_DIAG_SKMEMINFO - 1);
+  if (p->specific_port)
+    {
+      bc_len = build_port_filter (p->portno, msg.bc);
+      msg.rta.rta_type = INET_DIAG_REQ_BYTECODE;
+      msg.rta.rta_len = RTA_LENGTH (bc_len);
+      msg.nlh.nlmsg_len = NLMSG_LENGTH (sizeof msg.req) + RTA_SPACE (bc_len);
+    }
+  else
+    {
+      msg.nlh.nlmsg_len = NLMSG_LENGTH (sizeof msg.req);
+    }
+
+  memset (&sa, 0, sizeof sa);
+  sa.nl_family = AF_NETLINK;
+  if (sendto (diag_fd, &msg, msg.nlh.nlmsg_len, 0,
+	      (struct sockaddr *) &sa, sizeof sa) == -1)
+    {
+      fprintf (stderr, "Error sending %s dump request: %s\n",
+	       table->name, strerror (errno));
+      return -1;
+    }
+  return 0;
+}
+
+/* Compile "local port == PORT || remote port == PORT" to inet_diag
+   bytecode.  A comparison with an operand takes two ops, the second
+   one carrying the port in its `no' field.  Jumping to the end of the
+   program accepts the socket, jumping four bytes beyond it rejects
+   it.  The kernel audits the program by following the `yes' chain, so
+   every op must be reachable by falling through; the accepting jump
+   after a successful local port match is an explicit JMP. */
+static size_t
+build_port_filter (port, bc)
+     uint16_t port;
+     struct inet_diag_bc_op *bc;
+{
+  const size_t len = 9 * sizeof (struct inet_diag_bc_op);
+
+  /* 0: sport >= PORT, else try dport */
+  bc[0].code = INET_DIAG_BC_S_GE;
+  bc[0].yes = 8; bc[0].no = 20;
+  bc[1].no = port;
+  /* 8: sport <= PORT, else try dport */
+  bc[2].code = INET_DIAG_BC_S_LE;
+  bc[2].yes = 8; bc[2].no = 12;
+  bc[3].no = port;
+  /* 16: local port matched, accept */
+  bc[4].code = INET_DIAG_BC_JMP;
+  bc[4].yes = 4; bc[4].no = len - 16;
+  /* 20: dport >= PORT, else reject */
+  bc[5].code = INET_DIAG_BC_D_GE;
+  bc[5].yes = 8; bc[5].no = len - 20 + 4;
+  bc[6].no = port;
+  /* 28: dport <= PORT accepts, else reject */
+  bc[7].code = INET_DIAG_BC_D_LE;
+  bc[7].yes = 8; bc[7].no = len - 28 + 4;
+  bc[8].no = port;
+  return len;
+}
+
+/* The drop count from the INET_DIAG_SKMEMINFO attribute that follows
+   the message, or 0 if there is none. */
+static uint32_t
+diag_drops (nlh)
+     struct nlmsghdr *nlh;
+{
+  struct rtattr *rta = (struct rtattr *)
+    ((char *) NLMSG_DATA (nlh) + NLMSG_ALIGN (sizeof (struct inet_diag_msg)));
+  int len = nlh->nlmsg_len - NLMSG_LENGTH (sizeof (struct inet_diag_msg));
+
+  for (; RTA_OK (rta, len); rta = RTA_NEXT (rta, len))
+    {
+      if (rta->rta_type == INET_DIAG_SKMEMINFO
+	  && RTA_PAYLOAD (rta) > SK_MEMINFO_DROPS * sizeof (uint32_t))
+	return ((const uint32_t *) RTA_DATA (rta))[SK_MEMINFO_DROPS];
+    }
+  return 0;
+}
+
+static void
+convert_diag_msg (r, proto, pfe)
+     const struct inet_diag_msg *r;
+     int proto;
+     ProcFileEntry pfe;
+{
+  if (r->idiag_family == AF_INET)
+    {
+      struct sockaddr_in *la = (struct sockaddr_in *) &(pfe->la);
+      struct sockaddr_in *ra = (struct sockaddr_in *) &(pfe->ra);
+
+      memset (la, 0, sizeof (struct sockaddr_in));
+      memset (ra, 0, sizeof (struct sockaddr_in));
+      la->sin_family = ra->sin_family = AF_INET;
+      la->sin_port = r->id.idiag_sport;
+      ra->sin_port = r->id.idiag_dport;
+      la->sin_addr.s_addr = r->id.idiag_src[0];
+      ra->sin_addr.s_addr = r->id.idiag_dst[0];
+    }
+  else
+    {
+      struct sockaddr_in6 *la = (struct sockaddr_in6 *) &(pfe->la);
+      struct sockaddr_in6 *ra = (struct sockaddr_in6 *) &(pfe->ra);
+
+      memset (la, 0, sizeof (struct sockaddr_in6));
+      memset (ra, 0, sizeof (struct sockaddr_in6));
+      la->sin6_family = ra->sin6_family = AF_INET6;
+      la->sin6_port = r->id.idiag_sport;
+      ra->sin6_port = r->id.idiag_dport;
+      memcpy (&(la->sin6_addr), r->id.idiag_src, sizeof (struct in6_addr));
+      memcpy (&(ra->sin6_addr), r->id.idiag_dst, sizeof (struct in6_addr));
+    }
+  pfe->iq = r->idiag_rqueue;
+  pfe->oq = r->idiag_wqueue;
+  pfe->proto = proto;
+  pfe->inode = r->idiag_inode;
+  pfe->netns = 0;
+}
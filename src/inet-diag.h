@@ -0,0 +1,15 @@
+/*
+ inet-diag.h
+
+ Date Created: Sat Oct 17 09:12:40 2026
+ */
+
+#ifndef __QUI_INET_DIAG_H__
+#define __QUI_INET_DIAG_H__ 1
+
+#include "preferences.h"
+#include "proc-net.h"
+
+extern int parse_inet_diag (Preferences, SockEntryCallback, void *);
+
+#endif /* not __QUI_INET_DIAG_H__ */
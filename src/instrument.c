@@ -0,0 +1,222 @@
+/*
+ instrument.c
+
+ Date Created: Sat Oct 17 23:02:40 2026
+
+ Measurements of qui itself
+
+ Where the time of each round goes, and how much work it is, is kept
+ in histograms: per read() call, its latency; per round, the number
+ of reads and bytes, the time spent parsing per line, the number of
+ entries seen and reported, and the duration of the round; per batch
+ of the output thread, the time spent formatting and writing per
+ record; and how late each round starts.  Recording is a few atomic
+ additions per read() call and per round, and nothing per line, so
+ this is always on.  The summary is printed on standard error when qui
+ gets SIGUSR1, and when it exits.
+
+ The parse time per line is the time the collection method took in a
+ round, less the time spent in read() calls, divided by the number of
+ socket lines, without the headers (or netlink messages, or BPF
+ records).  With --threads, reads of different threads overlap, so
+ this is an underestimate.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "histogram.h"
+#include "timestamp.h"
+#include "instrument.h"
+
+typedef struct InstrumentRec
+{
+  const char   *name;
+  HistogramRec	h;
+}
+InstrumentRec;
+
+enum
+{
+  I_ROUND_NS,
+  I_WAKEUP_NS,
+  I_READ_NS,
+  I_READS,
+  I_BYTES,
+  I_PARSE_NS,
+  I_SEEN,
+  I_REPORTED,
+  I_FORMAT_NS,
+  N_INSTRUMENTS
+};
+
+static InstrumentRec instruments[N_INSTRUMENTS] = {
+  { .name = "round time (ns)" },
+  { .name = "start delay (ns)" },
+  { .name = "read() latency (ns)" },
+  { .name = "reads per round" },
+  { .name = "bytes per round" },
+  { .name = "parse time per line (ns)" },
+  { .name = "entries seen per round" },
+  { .name = "entries reported per round" },
+  { .name = "output time per record (ns)" },
+};
+
+/* running totals, from any thread */
+static uint64_t total_reads = 0;
+static uint64_t total_bytes = 0;
+static uint64_t total_read_ns = 0;
+static uint64_t total_lines = 0;
+static uint64_t total_overruns = 0;
+static uint64_t total_skipped = 0;
+
+/* Used by the sampling thread only: the totals as of the start of the
+   round, and when it started and its collection ended. */
+static uint64_t round_reads, round_bytes, round_read_ns, round_lines;
+static uint64_t round_start_ns, collection_end_ns;
+static uint64_t total_rounds = 0;
+static uint64_t total_seen = 0;
+static uint64_t total_reported = 0;
+
+void
+init_instruments ()
+{
+  unsigned k;
+
+  for (k = 0; k < N_INSTRUMENTS; ++k)
+    init_histogram (&instruments[k].h);
+}
+
+/* A read() (or recv()) from START_NS to END_NS that returned BYTES. */
+void
+note_read (start_ns, end_ns, bytes)
+     uint64_t start_ns;
+     uint64_t end_ns;
+     size_t bytes;
+{
+  histogram_record (&instruments[I_READ_NS].h, end_ns - start_ns);
+  __atomic_fetch_add (&total_reads, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&total_bytes, bytes, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&total_read_ns, end_ns - start_ns, __ATOMIC_RELAXED);
+}
+
+void
+note_lines (n)
+     unsigned long n;
+{
+  __atomic_fetch_add (&total_lines, n, __ATOMIC_RELAXED);
+}
+
+/* A round started LATE_NS after its deadline. */
+void
+note_wakeup (late_ns)
+     uint64_t late_ns;
+{
+  histogram_record (&instruments[I_WAKEUP_NS].h, late_ns);
+}
+
+/* A round overran, and SKIPPED deadlines were skipped. */
+void
+note_overrun (skipped)
+     unsigned long skipped;
+{
+  ++total_overruns;
+  total_skipped += skipped;
+}
+
+/* The output thread took NS to format and write N records. */
+void
+note_format (ns, n)
+     uint64_t ns;
+     unsigned long n;
+{
+  histogram_record (&instruments[I_FORMAT_NS].h, ns / n);
+}
+
+void
+begin_instrumented_round ()
+{
+  round_reads = __atomic_load_n (&total_reads, __ATOMIC_RELAXED);
+  round_bytes = __atomic_load_n (&total_bytes, __ATOMIC_RELAXED);
+  round_read_ns = __atomic_load_n (&total_read_ns, __ATOMIC_RELAXED);
+  round_lines = __atomic_load_n (&total_lines, __ATOMIC_RELAXED);
+  round_start_ns = collection_end_ns = monotonic_ns ();
+}
+
+/* The collection method is done for this round. */
+void
+end_collection ()
+{
+  collection_end_ns = monotonic_ns ();
+}
+
+/* The round is over; SEEN entries were handed to qui by the
+   collection method, and REPORTED records were queued for output. */
+void
+end_instrumented_round (seen, reported)
+     unsigned long seen;
+     unsigned long reported;
+{
+  uint64_t now = monotonic_ns ();
+  uint64_t lines, read_ns, collect_ns;
+
+  ++total_rounds;
+  total_seen += seen;
+  total_reported += reported;
+  histogram_record (&instruments[I_ROUND_NS].h, now - round_start_ns);
+  histogram_record (&instruments[I_READS].h,
+		    __atomic_load_n (&total_reads, __ATOMIC_RELAXED)
+		    - round_reads);
+  histogram_record (&instruments[I_BYTES].h,
+		    __atomic_load_n (&total_bytes, __ATOMIC_RELAXED)
+		    - round_bytes);
+  histogram_record (&instruments[I_SEEN].h, seen);
+  histogram_record (&instruments[I_REPORTED].h, reported);
+  lines = __atomic_load_n (&total_lines, __ATOMIC_RELAXED) - round_lines;
+  read_ns = __atomic_load_n (&total_read_ns, __ATOMIC_RELAXED) - round_read_ns;
+  collect_ns = collection_end_ns - round_start_ns;
+  if (lines > 0)
+    histogram_record (&instruments[I_PARSE_NS].h,
+		      collect_ns > read_ns ? (collect_ns - read_ns) / lines : 0);
+}
+
+void
+print_instruments ()
+{
+  Histogram h;
+  unsigned k;
+
+  fprintf (stderr, "%llu rounds, %llu overran, %llu deadlines skipped; "
+	   "%llu reads, %llu bytes, %llu lines, %llu entries seen, "
+	   "%llu reported\n",
+	   (unsigned long long) total_rounds,
+	   (unsigned long long) total_overruns,
+	   (unsigned long long) total_skipped,
+	   (unsigned long long) __atomic_load_n (&total_reads, __ATOMIC_RELAXED),
+	   (unsigned long long) __atomic_load_n (&total_bytes, __ATOMIC_RELAXED),
+	   (unsigned long long) __atomic_load_n (&total_lines, __ATOMIC_RELAXED),
+	   (unsigned long long) total_seen,
+	   (unsigned long long) total_reported);
+  fprintf (stderr, "%-28s %10s %12s %10s %10s %10s %10s %10s\n",
+	   "", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+  for (k = 0; k < N_INSTRUMENTS; ++k)
+    {
+      h = &instruments[k].h;
+      if (h->count == 0)
+	continue;
+      fprintf (stderr, "%-28s %10llu %12.1f %10llu %10llu %10llu %10llu %10llu\n",
+	       instruments[k].name,
+	       (unsigned long long) h->count, histogram_mean (h),
+	       (unsigned long long) histogram_percentile (h, 0.5),
+	       (unsigned long long) histogram_percentile (h, 0.9),
+	       (unsigned long long) histogram_percentile (h, 0.99),
+	       (unsigned long long) histogram_percentile (h, 0.999),
+	       (unsigned long long) h->max);
+    }
+}
@@ -0,0 +1,24 @@
+/*
+ instrument.h
+
+ Date Created: Sat Oct 17 23:02:40 2026
+ */
+
+#ifndef __QUI_INSTRUMENT_H__
+#define __QUI_INSTRUMENT_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern void init_instruments (void);
+extern void note_read (uint64_t, uint64_t, size_t);
+extern void note_lines (unsigned long);
+extern void note_wakeup (uint64_t);
+extern void note_overrun (unsigned long);
+extern void note_format (uint64_t, unsigned long);
+extern void begin_instrumented_round (void);
+extern void end_collection (void);
+extern void end_instrumented_round (unsigned long, unsigned long);
+extern void print_instruments (void);
+
+#endif /* not __QUI_INSTRUMENT_H__ */
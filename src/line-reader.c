@@ -0,0 +1,256 @@
+/*
+ line-reader.c
+
+ Date Created: Sat Oct 17 13:02:11 2026
+
+ Read a file as a stream of lines, using a reusable buffer
+
+ The buffer is allocated once per file and kept across rounds.  Each
+ read() asks for as much as fits into it, so that reading a big table
+ takes few system calls.  Complete lines are handed to the callback
+ directly from the buffer; a partial line at the end of a chunk is
+ moved to the start of the buffer and completed by the next read.  The buffer
+ only grows if a single line does not fit, so memory use does not
+ depend on the number of lines in the file.
+
+ Each read() is bracketed by readings of CLOCK_MONOTONIC, so that the
+ callers can tell when the kernel produced each line.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "line-reader.h"
+#include "timestamp.h"
+#include "instrument.h"
+
+static int grow_line_reader (LineReader, size_t);
+static int note_read_span (LineReader, size_t, uint64_t, uint64_t);
+
+LineReader
+make_line_reader (chunk)
+     size_t chunk;
+{
+  LineReader lr;
+
+  if ((lr = malloc (sizeof (LineReaderRec))) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      return 0;
+    }
+  lr->buf = 0;
+  lr->size = 0;
+  lr->chunk = chunk;
+  lr->reads = 0;
+  lr->bytes = 0;
+  lr->line_start_ns = lr->line_end_ns = 0;
+  lr->spans = 0;
+  lr->n_spans = lr->max_spans = 0;
+  if (grow_line_reader (lr, chunk) != 0)
+    {
+      free (lr);
+      return 0;
+    }
+  return lr;
+}
+
+void
+destroy_line_reader (lr)
+     LineReader lr;
+{
+  free (lr->buf);
+  free (lr->spans);
+  free (lr);
+}
+
+/* Call CALLBACK for each line read from FD until end of file, with
+   pointers to the start of the line and to its terminating newline
+   (or the end of the data for an unterminated last line).
+   line_start_ns and line_end_ns tell the callback when the line was
+   read.  Returns -1 on read errors, or if the callback returns -1. */
+int
+read_lines (lr, fd, callback, closure)
+     LineReader lr;
+     int fd;
+     LineCallback callback;
+     void *closure;
+{
+  size_t have = 0;		/* bytes of an incomplete line in buf */
+  ssize_t len;
+  const char *cp, *lim, *nl;
+  uint64_t start_ns, have_start_ns = 0;
+
+  for (;;)
+    {
+      if (have == lr->size && grow_line_reader (lr, have + 1) != 0)
+	return -1;
+      start_ns = monotonic_ns ();
+      len = read (fd, lr->buf + have, lr->size - have);
+      if (len == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      lr->line_end_ns = monotonic_ns ();
+      note_read (start_ns, lr->line_end_ns, len);
+      ++lr->reads;
+      lr->bytes += len;
+      /* An incomplete line was started by an earlier read(). */
+      lr->line_start_ns = have > 0 ? have_start_ns : start_ns;
+      if (len == 0)
+	{
+	  if (have > 0
+	      && (* callback) (lr->buf, lr->buf + have, closure) == -1)
+	    return -1;
+	  return 0;
+	}
+      cp = lr->buf;
+      lim = lr->buf + have + len;
+      while ((nl = memchr (cp, '\n', lim - cp)) != 0)
+	{
+	  if ((* callback) (cp, nl, closure) == -1)
+	    return -1;
+	  lr->line_start_ns = start_ns;
+	  cp = nl + 1;
+	}
+      if (cp < lim)
+	have_start_ns = lr->line_start_ns;
+      have = lim - cp;
+      if (have > 0 && cp != lr->buf)
+	memmove (lr->buf, cp, have);
+    }
+}
+
+/* Read everything from FD into the buffer, growing it as needed, and
+   store the number of bytes read in *LENP.  For callers that want to
+   split the contents themselves; the buffer then takes as much memory
+   as the file is long.  Each read() still asks for no more than the
+   chunk size given to make_line_reader(), so that the time stamps of
+   the reads stay fine-grained. */
+int
+read_whole_file (lr, fd, lenp)
+     LineReader lr;
+     int fd;
+     size_t *lenp;
+{
+  size_t have = 0;
+  ssize_t len;
+  uint64_t start_ns, end_ns;
+
+  lr->n_spans = 0;
+  for (;;)
+    {
+      if (have == lr->size && grow_line_reader (lr, have + 1) != 0)
+	return -1;
+      start_ns = monotonic_ns ();
+      len = read (fd, lr->buf + have, (lr->size - have < lr->chunk
+				       ? lr->size - have : lr->chunk));
+      if (len == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      end_ns = monotonic_ns ();
+      note_read (start_ns, end_ns, len);
+      ++lr->reads;
+      lr->bytes += len;
+      if (len == 0)
+	{
+	  *lenp = have;
+	  return 0;
+	}
+      have += len;
+      if (note_read_span (lr, have, start_ns, end_ns) != 0)
+	return -1;
+    }
+}
+
+/* After read_whole_file(): store in *STARTP when the read() that
+   returned offset START of the buffer started, and in *ENDP when the
+   one that returned offset END - 1 ended.  START must be below END. */
+void
+line_read_time (lr, start, end, startp, endp)
+     LineReader lr;
+     size_t start;
+     size_t end;
+     uint64_t *startp;
+     uint64_t *endp;
+{
+  unsigned lo = 0, hi = lr->n_spans - 1, mid;
+
+  /* the first span that ends beyond START */
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (lr->spans[mid].end <= start)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  *startp = lr->spans[lo].start_ns;
+  while (lo < lr->n_spans - 1 && lr->spans[lo].end < end)
+    ++lo;
+  *endp = lr->spans[lo].end_ns;
+}
+
+static int
+note_read_span (lr, end, start_ns, end_ns)
+     LineReader lr;
+     size_t end;
+     uint64_t start_ns;
+     uint64_t end_ns;
+{
+  if (lr->n_spans == lr->max_spans)
+    {
+      unsigned max = lr->max_spans ? lr->max_spans * 2 : 16;
+      LineReadSpan spans;
+
+      if ((spans = realloc (lr->spans, max * sizeof (LineReadSpanRec))) == 0)
+	{
+	  fprintf (stderr, "Out of memory\n");
+	  return -1;
+	}
+      lr->spans = spans;
+      lr->max_spans = max;
+    }
+  lr->spans[lr->n_spans].end = end;
+  lr->spans[lr->n_spans].start_ns = start_ns;
+  lr->spans[lr->n_spans].end_ns = end_ns;
+  ++lr->n_spans;
+  return 0;
+}
+
+static int
+grow_line_reader (lr, min_size)
+     LineReader lr;
+     size_t min_size;
+{
+  size_t pagesize = sysconf (_SC_PAGESIZE);
+  size_t size = lr->size ? lr->size : pagesize;
+  void *buf;
+
+  while (size < min_size)
+    size *= 2;
+  if (posix_memalign (&buf, pagesize, size) != 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      return -1;
+    }
+  if (lr->buf)
+    {
+      memcpy (buf, lr->buf, lr->size);
+      free (lr->buf);
+    }
+  lr->buf = buf;
+  lr->size = size;
+  return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ line-reader.h
+
+ Date Created: Sat Oct 17 13:02:26 2026
+ */
+
+#ifndef __QUI_LINE_READER_H__
+#define __QUI_LINE_READER_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct LineReaderRec *LineReader;
+typedef struct LineReadSpanRec *LineReadSpan;
+
+typedef int (* LineCallback) (const char *, const char *, void *);
+
+/* With read_whole_file(): the data that one read() returned */
+typedef struct LineReadSpanRec
+{
+  size_t	end;		/* offset just past it in buf */
+  uint64_t	start_ns;	/* CLOCK_MONOTONIC before the read() */
+  uint64_t	end_ns;		/* and after */
+}
+LineReadSpanRec;
+
+typedef struct LineReaderRec
+{
+  char	       *buf;		/* page-aligned */
+  size_t	size;		/* allocated size of buf */
+  size_t	chunk;		/* most read_whole_file() asks for at once */
+  unsigned long	reads;		/* read() calls since creation */
+  unsigned long	bytes;		/* bytes read since creation */
+
+  /* with read_lines(): during the callback, when the read() that
+     returned the start of the line started, and when the one that
+     returned its end ended */
+  uint64_t	line_start_ns;
+  uint64_t	line_end_ns;
+
+  /* with read_whole_file(): the reads of the latest file */
+  LineReadSpan	spans;
+  unsigned	n_spans;
+  unsigned	max_spans;
+}
+LineReaderRec;
+
+extern LineReader make_line_reader (size_t);
+extern void destroy_line_reader (LineReader);
+extern int read_lines (LineReader, int, LineCallback, void *);
+extern int read_whole_file (LineReader, int, size_t *);
+extern void line_read_time (LineReader, size_t, size_t,
+			    uint64_t *, uint64_t *);
+
+#endif /* not __QUI_LINE_READER_H__ */
@@ -0,0 +1,235 @@
+/*
+ netns.c
+
+ Date Created: Sat Oct 17 15:09:58 2026
+
+ Find the network namespaces on the system
+
+ A namespace is identified by the device and inode numbers of its
+ nsfs file.  Namespaces are found through the names that "ip netns"
+ creates under /run/netns, and through /proc/PID/ns/net for every
+ process, so that namespaces of containers that are not named
+ anywhere are found as well.  Each namespace is listed once, however
+ many processes share it.
+
+ Files under /proc/PID/net show the namespace of process PID, and a
+ descriptor for such a file stays bound to that namespace when the
+ process exits, so open_netns_file() only has to enter a namespace
+ (with setns(), which needs CAP_SYS_ADMIN) if no process was found
+ in it.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sched.h>
+
+#include "netns.h"
+
+static NetNs note_netns (NetNs *, const struct stat *, const char *);
+static int same_netns_p (NetNs, pid_t);
+
+/* Update the list at *LISTP to the namespaces that exist now.  New
+   namespaces are added at the end, with DATA set to 0.  Namespaces
+   that were not found again are taken off the list and passed to
+   FORGET before they are freed. */
+int
+scan_netns (listp, forget, closure)
+     NetNs *listp;
+     NetNsCallback forget;
+     void *closure;
+{
+  char path[PATH_MAX];
+  struct stat st;
+  DIR *dir;
+  struct dirent *de;
+  NetNs ns, *nsp;
+  char *end;
+  long pid;
+
+  for (ns = *listp; ns != 0; ns = ns->next)
+    {
+      ns->seen = 0;
+      ns->pid = 0;
+    }
+  if ((dir = opendir ("/run/netns")) != 0)
+    {
+      while ((de = readdir (dir)) != 0)
+	{
+	  if (de->d_name[0] == '.')
+	    continue;
+	  snprintf (path, sizeof path, "/run/netns/%s", de->d_name);
+	  if (stat (path, &st) != 0
+	      || (ns = note_netns (listp, &st, de->d_name)) == 0)
+	    continue;
+	  if (ns->nspath == 0)
+	    {
+	      if ((ns->nspath = strdup (path)) == 0)
+		{
+		  fprintf (stderr, "Out of memory\n");
+		  closedir (dir);
+		  return -1;
+		}
+	    }
+	}
+      closedir (dir);
+    }
+  if ((dir = opendir ("/proc")) == 0)
+    {
+      fprintf (stderr, "Cannot read /proc: %s\n", strerror (errno));
+      return -1;
+    }
+  while ((de = readdir (dir)) != 0)
+    {
+      if ((pid = strtol (de->d_name, &end, 10)) <= 0 || *end != 0)
+	continue;
+      snprintf (path, sizeof path, "/proc/%ld/ns/net", pid);
+      /* Processes may exit while we look, and those of other users
+	 cannot be looked at unless we are root. */
+      if (stat (path, &st) != 0 || (ns = note_netns (listp, &st, 0)) == 0)
+	continue;
+      if (ns->pid == 0)
+	ns->pid = pid;
+    }
+  closedir (dir);
+  nsp = listp;
+  while ((ns = *nsp) != 0)
+    {
+      if (ns->seen)
+	{
+	  nsp = &ns->next;
+	  continue;
+	}
+      *nsp = ns->next;
+      if (forget)
+	(* forget) (ns, closure);
+      free (ns->label);
+      free (ns->nspath);
+      free (ns);
+    }
+  return 0;
+}
+
+/* Open NAME (such as "tcp6") under /proc/net as seen from namespace
+   NS.  Returns a file descriptor, or -1 after printing a message. */
+int
+open_netns_file (ns, name)
+     NetNs ns;
+     const char *name;
+{
+  char path[PATH_MAX];
+  int fd, self, nsfd, saved_errno;
+
+  if (ns->pid != 0)
+    {
+      snprintf (path, sizeof path, "/proc/%d/net/%s", (int) ns->pid, name);
+      if ((fd = open (path, O_RDONLY)) != -1)
+	{
+	  /* The process might have exited, and its PID been reused
+	     by one in another namespace, since the scan. */
+	  if (same_netns_p (ns, ns->pid))
+	    return fd;
+	  close (fd);
+	  errno = ESRCH;
+	}
+      if (ns->nspath == 0)
+	{
+	  fprintf (stderr, "Error opening %s: %s\n", path, strerror (errno));
+	  return -1;
+	}
+    }
+  if ((self = open ("/proc/thread-self/ns/net", O_RDONLY)) == -1)
+    {
+      fprintf (stderr, "Cannot open own network namespace: %s\n",
+	       strerror (errno));
+      return -1;
+    }
+  if ((nsfd = open (ns->nspath, O_RDONLY)) == -1
+      || setns (nsfd, CLONE_NEWNET) == -1)
+    {
+      fprintf (stderr, "Cannot enter network namespace %s: %s\n",
+	       ns->nspath, strerror (errno));
+      if (nsfd != -1)
+	close (nsfd);
+      close (self);
+      return -1;
+    }
+  snprintf (path, sizeof path, "/proc/thread-self/net/%s", name);
+  fd = open (path, O_RDONLY);
+  saved_errno = errno;
+  if (setns (self, CLONE_NEWNET) == -1)
+    {
+      /* Everything we would read from now on would be wrong. */
+      fprintf (stderr, "Cannot return to own network namespace: %s\n",
+	       strerror (errno));
+      exit (1);
+    }
+  close (nsfd);
+  close (self);
+  if (fd == -1)
+    fprintf (stderr, "Error opening %s in %s: %s\n",
+	     name, ns->nspath, strerror (saved_errno));
+  return fd;
+}
+
+/* Find the namespace with the nsfs inode in ST on the list, adding it
+   at the end if it is new, and mark it as seen.  A new namespace is
+   labelled with NAME if that is non-zero.  Named namespaces are
+   looked for first, so a label does not change once it is given. */
+static NetNs
+note_netns (listp, st, name)
+     NetNs *listp;
+     const struct stat *st;
+     const char *name;
+{
+  NetNs ns;
+  char label[32];
+
+  for (; (ns = *listp) != 0; listp = &ns->next)
+    {
+      if (ns->ino == st->st_ino && ns->dev == st->st_dev)
+	{
+	  ns->seen = 1;
+	  return ns;
+	}
+    }
+  snprintf (label, sizeof label, "net:[%lu]", (unsigned long) st->st_ino);
+  if ((ns = malloc (sizeof (NetNsRec))) == 0
+      || (ns->label = strdup (name ? name : label)) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      free (ns);
+      return 0;
+    }
+  ns->next = 0;
+  ns->dev = st->st_dev;
+  ns->ino = st->st_ino;
+  ns->nspath = 0;
+  ns->pid = 0;
+  ns->seen = 1;
+  ns->data = 0;
+  *listp = ns;
+  return ns;
+}
+
+static int
+same_netns_p (ns, pid)
+     NetNs ns;
+     pid_t pid;
+{
+  char path[PATH_MAX];
+  struct stat st;
+
+  snprintf (path, sizeof path, "/proc/%d/ns/net", (int) pid);
+  return stat (path, &st) == 0
+    && st.st_ino == ns->ino && st.st_dev == ns->dev;
+}
@@ -0,0 +1,32 @@
+/*
+ netns.h
+
+ Date Created: Sat Oct 17 15:10:44 2026
+ */
+
+#ifndef __QUI_NETNS_H__
+#define __QUI_NETNS_H__ 1
+
+#include <sys/types.h>
+
+typedef struct NetNsRec *NetNs;
+
+typedef struct NetNsRec
+{
+  NetNs		next;
+  dev_t		dev;		/* identify the namespace */
+  ino_t		ino;
+  char	       *label;		/* name in /run/netns, or net:[INODE] */
+  char	       *nspath;		/* /run/netns/NAME, if it has a name */
+  pid_t		pid;		/* a process in it, or 0 if none found */
+  int		seen;		/* found by the latest scan */
+  void	       *data;		/* for the user of the list */
+}
+NetNsRec;
+
+typedef void (* NetNsCallback) (NetNs, void *);
+
+extern int scan_netns (NetNs *, NetNsCallback, void *);
+extern int open_netns_file (NetNs, const char *);
+
+#endif /* not __QUI_NETNS_H__ */
@@ -0,0 +1,658 @@
+/*
+ output.c
+
+ Date Created: Sat Oct 17 17:19:33 2026
+
+ Formatting and writing records on a thread of their own
+
+ The sampling loop must not wait for whoever reads our standard
+ output, or it would miss the very bursts it is looking for while
+ the reader stalls.  So it only copies each record, in a compact
+ binary form, into a Ring, and a writer thread takes them out,
+ formats them and writes them.  The writer is woken up through an
+ eventfd once per round.  If it falls so far behind that the ring is
+ full, further records are dropped and counted, and the writer
+ reports the count on standard error when it catches up.
+
+ Lines are formatted by hand (see format.c) into one big buffer,
+ which is written out with a single write() per batch unless it
+ fills up before.  The endpoint strings of each socket are cached in
+ a SockTable of the writer's own, so that a socket that shows up in
+ every round is only formatted once.  The cache keeps the sockets
+ seen in the current batch, and the others are thrown out when it
+ is full.
+
+ With --record, the writer appends the records to a trace file
+ instead (see trace.c), and --replay formats the records from such a
+ file in the same way as live ones.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/eventfd.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "history.h"
+#include "sock-table.h"
+#include "owner.h"
+#include "events.h"
+#include "ring.h"
+#include "format.h"
+#include "output.h"
+#include "trace.h"
+#include "timestamp.h"
+#include "instrument.h"
+
+typedef struct EndpointsRec *Endpoints;
+
+/* the formatted endpoints of a socket, "LOCAL REMOTE" */
+typedef struct EndpointsRec
+{
+  unsigned	len;
+  char		text[2 * MAX_ENDPOINT_STRING + 1];
+}
+EndpointsRec;
+
+static void push_record (OutputRecord, ProcFileEntry);
+static void queue_record (OutputRecord);
+static void *writer (void *);
+static void report_dropped (void);
+static void replay_record (OutputRecord, void *);
+static void write_record (OutputRecord);
+static void write_entry (OutputRecord);
+static void write_burst (OutputRecord);
+static char *put_owner (char *, OutputRecord);
+static void write_drops (OutputRecord);
+static char *put_prefix (char *, OutputRecord);
+static char *put_endpoints (char *, const SockKeyRec *);
+static char *put_blips (char *, uint32_t);
+static char *out_room (size_t);
+static void out_used (char *);
+static void flush_out_buffer (void);
+static double timeval_diff (const struct timeval *, const struct timeval *);
+
+/* enough for any line, except for the blips */
+#define LINE_ROOM 512
+
+#define OUT_BUFFER_SIZE (256 * 1024)
+
+static Preferences prefs;
+static Ring ring = 0;
+static int wakeup_fd = -1;
+static pthread_t writer_thread;
+static int finishing = 0;
+
+/* Written by the sampling thread only, read by the writer. */
+static unsigned long dropped = 0;
+
+/* Records queued by the sampling thread, and records written (or
+   traced) by the writer, as seen by wait_for_output(). */
+static unsigned long pushed = 0;
+static unsigned long written = 0;
+
+/* Used by the writer only. */
+static unsigned long reported_dropped = 0;
+static SockTable endpoints = 0;
+static TraceWriter trace = 0;
+static char out_buffer[OUT_BUFFER_SIZE];
+static size_t out_len = 0;
+static int write_failed = 0;
+
+int
+init_output (p)
+     Preferences p;
+{
+  sigset_t all, saved;
+  int err;
+
+  prefs = p;
+  if ((ring = make_ring (p->output_buffer, sizeof (OutputRecordRec))) == 0
+      || (endpoints = make_sock_table (p->max_sockets,
+				       sizeof (EndpointsRec))) == 0)
+    return -1;
+  if (p->record_file
+      && (trace = open_trace_writer (p->record_file, p->max_sockets)) == 0)
+    return -1;
+  if ((wakeup_fd = eventfd (0, EFD_NONBLOCK)) == -1)
+    {
+      fprintf (stderr, "Cannot create eventfd: %s\n", strerror (errno));
+      return -1;
+    }
+  /* Signals should go to the main thread. */
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &saved);
+  err = pthread_create (&writer_thread, 0, writer, 0);
+  pthread_sigmask (SIG_SETMASK, &saved, 0);
+  if (err != 0)
+    {
+      fprintf (stderr, "Cannot create output thread: %s\n", strerror (err));
+      return -1;
+    }
+  return 0;
+}
+
+/* Queue a line for socket PFE as sampled at TV, with the peak and the
+   number of drops on a full queue if HAVE_PEAK is set, and the number
+   of packets it dropped since the last round, LOST, with --drops. */
+void
+output_entry (pfe, tv, have_peak, peak, full, lost)
+     ProcFileEntry pfe;
+     const struct timeval *tv;
+     int have_peak;
+     uint32_t peak;
+     uint32_t full;
+     uint32_t lost;
+{
+  OutputRecordRec rec;
+
+  rec.type = RECORD_ENTRY;
+  rec.which = 0;
+  rec.have_peak = have_peak;
+  rec.u.entry.tv = *tv;
+  rec.u.entry.peak = peak;
+  rec.u.entry.full = full;
+  rec.u.entry.lost = lost;
+  rec.u.entry.ts_error = pfe->ts_error;
+  push_record (&rec, pfe);
+}
+
+/* Queue a line for a burst that has ended on queue WHICH of socket
+   PFE. */
+void
+output_burst (pfe, which, ev, byte_seconds)
+     ProcFileEntry pfe;
+     int which;
+     BufferEvent ev;
+     double byte_seconds;
+{
+  OutputRecordRec rec;
+
+  rec.type = RECORD_BURST;
+  rec.which = which;
+  rec.have_peak = 0;
+  rec.u.burst.ev = *ev;
+  rec.u.burst.byte_seconds = byte_seconds;
+  push_record (&rec, pfe);
+}
+
+/* Queue a line for a round, ending at TV, in which UDP sockets
+   dropped packets. */
+void
+output_drops (tv, in_errors, rcvbuf_errors, lost, n_sockets, total_iq, max_iq)
+     const struct timeval *tv;
+     uint32_t in_errors;
+     uint32_t rcvbuf_errors;
+     uint32_t lost;
+     uint32_t n_sockets;
+     uint64_t total_iq;
+     uint32_t max_iq;
+{
+  OutputRecordRec rec;
+
+  rec.type = RECORD_DROPS;
+  rec.which = 0;
+  rec.have_peak = 0;
+  memset (&rec.key, 0, sizeof (SockKeyRec));
+  rec.iq = rec.oq = 0;
+  rec.netns[0] = 0;
+  rec.u.drops.tv = *tv;
+  rec.u.drops.in_errors = in_errors;
+  rec.u.drops.rcvbuf_errors = rcvbuf_errors;
+  rec.u.drops.lost = lost;
+  rec.u.drops.n_sockets = n_sockets;
+  rec.u.drops.total_iq = total_iq;
+  rec.u.drops.max_iq = max_iq;
+  queue_record (&rec);
+}
+
+/* Wake the writer up for what was queued in this round.  The eventfd
+   is non-blocking; it only refuses the increment when the count has
+   piled up, and then the writer is awake anyway. */
+void
+end_output_round ()
+{
+  uint64_t one = 1;
+
+  if (write (wakeup_fd, &one, sizeof one) == -1 && errno != EAGAIN)
+    fprintf (stderr, "Cannot wake output thread: %s\n", strerror (errno));
+}
+
+/* Wait until the writer has caught up with everything queued so far.
+   This is for measuring the output path, and for printing something
+   else on standard output between rounds; rounds never wait. */
+void
+wait_for_output ()
+{
+  struct timespec ts = { 0, 100000 };
+
+  end_output_round ();
+  while (__atomic_load_n (&written, __ATOMIC_ACQUIRE) != pushed)
+    nanosleep (&ts, 0);
+}
+
+/* Let the writer drain the ring, and wait for it. */
+void
+finish_output ()
+{
+  __atomic_store_n (&finishing, 1, __ATOMIC_RELEASE);
+  end_output_round ();
+  pthread_join (writer_thread, 0);
+  if (dropped > 0)
+    fprintf (stderr, "%lu records dropped in all\n", dropped);
+  if (trace)
+    close_trace_writer (trace);
+  close (wakeup_fd);
+  destroy_ring (ring);
+  destroy_sock_table (endpoints);
+}
+
+/* Print the records in the trace file given with --replay, in the
+   selected time range. */
+int
+replay_output (p)
+     Preferences p;
+{
+  int result;
+
+  prefs = p;
+  if ((endpoints = make_sock_table (p->max_sockets,
+				    sizeof (EndpointsRec))) == 0)
+    return -1;
+  result = replay_trace (p->replay_file, p->replay_from, p->replay_until,
+			 replay_record, 0);
+  flush_out_buffer ();
+  destroy_sock_table (endpoints);
+  return result;
+}
+
+static void
+push_record (rec, pfe)
+     OutputRecord rec;
+     ProcFileEntry pfe;
+{
+  const OwnerRec *owner;
+
+  sock_key_from_entry (&rec->key, pfe);
+  rec->iq = pfe->iq;
+  rec->oq = pfe->oq;
+  if (pfe->netns)
+    {
+      strncpy (rec->netns, pfe->netns, MAX_NETNS_LABEL - 1);
+      rec->netns[MAX_NETNS_LABEL - 1] = 0;
+    }
+  else
+    rec->netns[0] = 0;
+  if (prefs->want_owners && (owner = lookup_owner (pfe->inode)) != 0)
+    rec->owner = *owner;
+  else
+    rec->owner.pid = 0;
+  queue_record (rec);
+}
+
+static void
+queue_record (rec)
+     OutputRecord rec;
+{
+  if (ring_push (ring, rec) != 0)
+    __atomic_store_n (&dropped, dropped + 1, __ATOMIC_RELAXED);
+  else
+    ++pushed;
+}
+
+static void *
+writer (arg)
+     void *arg;
+{
+  OutputRecordRec rec;
+  unsigned long n_written = 0, batch_start;
+  uint64_t n, start_ns;
+  int last;
+
+  for (;;)
+    {
+      /* Everything queued before finish_output() was called is in
+	 the ring once we see the flag. */
+      last = __atomic_load_n (&finishing, __ATOMIC_ACQUIRE);
+      advance_sock_table (endpoints);
+      start_ns = monotonic_ns ();
+      batch_start = n_written;
+      while (ring_pop (ring, &rec) == 0)
+	{
+	  if (trace)
+	    trace_record (trace, &rec);
+	  else
+	    write_record (&rec);
+	  ++n_written;
+	}
+      if (trace)
+	end_trace_batch (trace);
+      else
+	flush_out_buffer ();
+      if (n_written > batch_start)
+	note_format (monotonic_ns () - start_ns, n_written - batch_start);
+      __atomic_store_n (&written, n_written, __ATOMIC_RELEASE);
+      report_dropped ();
+      if (last)
+	break;
+      while (read (wakeup_fd, &n, sizeof n) == -1
+	     && (errno == EINTR || errno == EAGAIN))
+	{
+	  fd_set fds;
+
+	  FD_ZERO (&fds);
+	  FD_SET (wakeup_fd, &fds);
+	  select (wakeup_fd + 1, &fds, 0, 0, 0);
+	}
+    }
+  return 0;
+}
+
+static void
+report_dropped ()
+{
+  unsigned long n = __atomic_load_n (&dropped, __ATOMIC_RELAXED);
+
+  if (n != reported_dropped)
+    {
+      fprintf (stderr, "Output falling behind, dropped %lu records\n",
+	       n - reported_dropped);
+      reported_dropped = n;
+    }
+}
+
+static void
+replay_record (rec, closure)
+     OutputRecord rec;
+     void *closure;
+{
+  write_record (rec);
+}
+
+static void
+write_record (rec)
+     OutputRecord rec;
+{
+  if (rec->type == RECORD_BURST)
+    write_burst (rec);
+  else if (rec->type == RECORD_DROPS)
+    write_drops (rec);
+  else
+    write_entry (rec);
+}
+
+static void
+write_entry (rec)
+     OutputRecord rec;
+{
+  char *cp = out_room (LINE_ROOM);
+
+  cp = format_time (cp, &(rec->u.entry.tv), prefs->print_usecs);
+  *cp++ = ' ';
+  cp = put_prefix (cp, rec);
+  memcpy (cp, " Q:", 3);
+  cp += 3;
+  if (prefs->want_input)
+    {
+      *cp++ = ' ';
+      cp = format_unsigned (cp, rec->iq);
+      cp = put_blips (cp, rec->iq);
+    }
+  if (prefs->want_output)
+    {
+      *cp++ = ' ';
+      cp = format_unsigned (cp, rec->oq);
+      cp = put_blips (cp, rec->oq);
+    }
+  if (rec->have_peak)
+    {
+      memcpy (cp, " P: ", 4);
+      cp = format_unsigned (cp + 4, rec->u.entry.peak);
+      if (rec->u.entry.full > 0)
+	{
+	  memcpy (cp, " F: ", 4);
+	  cp = format_unsigned (cp + 4, rec->u.entry.full);
+	}
+    }
+  if (rec->u.entry.lost > 0)
+    {
+      memcpy (cp, " L: ", 4);
+      cp = format_unsigned (cp + 4, rec->u.entry.lost);
+    }
+  cp = put_owner (cp, rec);
+  *cp++ = '\n';
+  out_used (cp);
+}
+
+/* One line per burst, stamped with the time it ended:
+
+     END LOCAL REMOTE E: in|out S: START P: PEAK PEAK-TIME
+       D: SECONDS A: BYTE-SECONDS [O: PID COMM CGROUP]
+
+   all on one line.  Bursts are rare enough for the two floating-point
+   fields to go through snprintf(). */
+static void
+write_burst (rec)
+     OutputRecord rec;
+{
+  BufferEvent ev = &(rec->u.burst.ev);
+  char *cp = out_room (LINE_ROOM);
+
+  cp = format_time (cp, &(ev->e_ts), prefs->print_usecs);
+  *cp++ = ' ';
+  cp = put_prefix (cp, rec);
+  memcpy (cp, rec->which == BURST_INPUT ? " E: in S: " : " E: out S: ",
+	  rec->which == BURST_INPUT ? 10 : 11);
+  cp += rec->which == BURST_INPUT ? 10 : 11;
+  cp = format_time (cp, &(ev->s_ts), prefs->print_usecs);
+  memcpy (cp, " P: ", 4);
+  cp = format_unsigned (cp + 4, ev->m_occ);
+  *cp++ = ' ';
+  cp = format_time (cp, &(ev->m_ts), prefs->print_usecs);
+  cp += snprintf (cp, LINE_ROOM / 4, " D: %.3f A: %.0f",
+		  timeval_diff (&(ev->e_ts), &(ev->s_ts)),
+		  rec->u.burst.byte_seconds);
+  cp = put_owner (cp, rec);
+  *cp++ = '\n';
+  out_used (cp);
+}
+
+/* One line per round in which UDP sockets dropped packets:
+
+     TIME udp InErrors: N RcvbufErrors: N L: N S: SOCKETS Q: TOTAL MAX
+
+   with the increases of the host-wide counters, the packets dropped
+   by the sockets seen, and the number, total and largest receive
+   queue of the UDP sockets seen in the round. */
+static void
+write_drops (rec)
+     OutputRecord rec;
+{
+  char *cp = out_room (LINE_ROOM);
+
+  cp = format_time (cp, &(rec->u.drops.tv), prefs->print_usecs);
+  memcpy (cp, " udp InErrors: ", 15);
+  cp = format_unsigned (cp + 15, rec->u.drops.in_errors);
+  memcpy (cp, " RcvbufErrors: ", 15);
+  cp = format_unsigned (cp + 15, rec->u.drops.rcvbuf_errors);
+  memcpy (cp, " L: ", 4);
+  cp = format_unsigned (cp + 4, rec->u.drops.lost);
+  memcpy (cp, " S: ", 4);
+  cp = format_unsigned (cp + 4, rec->u.drops.n_sockets);
+  memcpy (cp, " Q: ", 4);
+  cp = format_unsigned (cp + 4, rec->u.drops.total_iq);
+  *cp++ = ' ';
+  cp = format_unsigned (cp, rec->u.drops.max_iq);
+  *cp++ = '\n';
+  out_used (cp);
+}
+
+/* " O: PID COMM CGROUP" if the owner of the socket is known, with
+   "-" for a process outside of any cgroup. */
+static char *
+put_owner (cp, rec)
+     char *cp;
+     OutputRecord rec;
+{
+  size_t len;
+
+  if (rec->owner.pid == 0)
+    return cp;
+  memcpy (cp, " O: ", 4);
+  cp = format_unsigned (cp + 4, rec->owner.pid);
+  *cp++ = ' ';
+  len = strnlen (rec->owner.comm, MAX_COMM);
+  memcpy (cp, rec->owner.comm, len);
+  cp += len;
+  *cp++ = ' ';
+  if ((len = strnlen (rec->owner.cgroup, MAX_CGROUP)) == 0)
+    *cp++ = '-';
+  memcpy (cp, rec->owner.cgroup, len);
+  return cp + len;
+}
+
+/* The namespace, if any, and the two endpoints, separated by
+   spaces. */
+static char *
+put_prefix (cp, rec)
+     char *cp;
+     OutputRecord rec;
+{
+  size_t len;
+
+  if (rec->netns[0])
+    {
+      len = strlen (rec->netns);
+      memcpy (cp, rec->netns, len);
+      cp += len;
+      *cp++ = ' ';
+    }
+  return put_endpoints (cp, &(rec->key));
+}
+
+/* Look the endpoint strings of socket KEY up in the cache, formatting
+   them on a miss.  When the cache is full, the sockets not seen in
+   the current batch are thrown out; if that does not help either, the
+   strings are formatted without being cached, and a new batch is
+   started so that the next sweep can make room. */
+static char *
+put_endpoints (cp, key)
+     char *cp;
+     const SockKeyRec *key;
+{
+  Endpoints e;
+  long i;
+  int is_new;
+
+  if ((i = intern_sock (endpoints, key, &is_new)) == -1)
+    {
+      sweep_sock_table (endpoints, 0, 0);
+      if ((i = intern_sock (endpoints, key, &is_new)) == -1)
+	{
+	  advance_sock_table (endpoints);
+	  cp = format_endpoint (cp, key->af, key->laddr, key->lport);
+	  *cp++ = ' ';
+	  return format_endpoint (cp, key->af, key->raddr, key->rport);
+	}
+    }
+  e = (Endpoints) sock_value (endpoints, i);
+  if (is_new)
+    {
+      char *ep = e->text;
+
+      ep = format_endpoint (ep, key->af, key->laddr, key->lport);
+      *ep++ = ' ';
+      ep = format_endpoint (ep, key->af, key->raddr, key->rport);
+      e->len = ep - e->text;
+    }
+  memcpy (cp, e->text, e->len);
+  return cp + e->len;
+}
+
+/* Half a blip is shown as `+', a full one as `#'.  Long runs of blips
+   are written straight into the output buffer, in as many pieces as
+   it takes. */
+static char *
+put_blips (cp, val)
+     char *cp;
+     uint32_t val;
+{
+  unsigned nblips, fullblips, n;
+
+  nblips = val / prefs->blipsize;
+  if (nblips == 0)
+    return cp;
+  fullblips = nblips / 2;
+  *cp++ = ' ';
+  while (fullblips > 0)
+    {
+      n = fullblips < LINE_ROOM / 2 ? fullblips : LINE_ROOM / 2;
+      memset (cp, '#', n);
+      fullblips -= n;
+      out_used (cp + n);
+      cp = out_room (LINE_ROOM);
+    }
+  if (nblips % 2)
+    *cp++ = '+';
+  return cp;
+}
+
+/* Return a pointer to the end of the output buffer, after making
+   sure there are at least N bytes free. */
+static char *
+out_room (n)
+     size_t n;
+{
+  if (out_len + n > OUT_BUFFER_SIZE)
+    flush_out_buffer ();
+  return out_buffer + out_len;
+}
+
+/* Mark the output buffer as filled up to END, which must be within
+   the room asked for. */
+static void
+out_used (end)
+     char *end;
+{
+  out_len = end - out_buffer;
+}
+
+static void
+flush_out_buffer ()
+{
+  size_t done = 0;
+  ssize_t n;
+
+  while (done < out_len)
+    {
+      if ((n = write (STDOUT_FILENO, out_buffer + done, out_len - done)) == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if (!write_failed)
+	    fprintf (stderr, "Cannot write output: %s\n", strerror (errno));
+	  write_failed = 1;
+	  break;
+	}
+      done += n;
+    }
+  out_len = 0;
+}
+
+static double
+timeval_diff (a, b)
+     const struct timeval *a;
+     const struct timeval *b;
+{
+  return (a->tv_sec - b->tv_sec) + (a->tv_usec - b->tv_usec) / 1e6;
+}
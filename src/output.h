@@ -0,0 +1,85 @@
+/*
+ output.h
+
+ Date Created: Sat Oct 17 17:20:51 2026
+ */
+
+#ifndef __QUI_OUTPUT_H__
+#define __QUI_OUTPUT_H__ 1
+
+#include <sys/time.h>
+#include <stdint.h>
+
+#include "history.h"
+#include "sock-table.h"
+#include "owner.h"
+
+#define RECORD_ENTRY	0
+#define RECORD_BURST	1
+#define RECORD_DROPS	2
+
+#define MAX_NETNS_LABEL 48
+
+typedef struct OutputRecordRec *OutputRecord;
+
+/* What the sampling thread hands over to the writer for each line of
+   output, and what is kept in a trace file. */
+typedef struct OutputRecordRec
+{
+  uint8_t	type;		/* RECORD_ENTRY, RECORD_BURST or RECORD_DROPS */
+  uint8_t	which;		/* bursts: BURST_INPUT or BURST_OUTPUT */
+  uint8_t	have_peak;	/* entries: whether peak and full are set */
+  SockKeyRec	key;		/* all zero for RECORD_DROPS */
+  uint32_t	iq;
+  uint32_t	oq;
+  union
+  {
+    struct
+    {
+      struct timeval tv;
+      uint32_t	peak;
+      uint32_t	full;
+      uint32_t	lost;		/* with --drops: since the last round */
+      uint32_t	ts_error;	/* nanoseconds tv may be off, 0 if not
+				   known */
+    }
+    entry;
+    struct
+    {
+      BufferEventRec ev;
+      double	byte_seconds;
+    }
+    burst;
+    /* a round in which UDP drops went up: the increases of the
+       host-wide counters and the sum of those of the sockets, and
+       the receive queues of the UDP sockets seen */
+    struct
+    {
+      struct timeval tv;
+      uint32_t	in_errors;
+      uint32_t	rcvbuf_errors;
+      uint32_t	lost;
+      uint32_t	n_sockets;
+      uint32_t	max_iq;
+      uint64_t	total_iq;
+    }
+    drops;
+  }
+  u;
+  char		netns[MAX_NETNS_LABEL];	/* empty for our own namespace */
+  OwnerRec	owner;		/* with --owners, if it is known */
+}
+OutputRecordRec;
+
+extern int init_output (Preferences);
+extern void output_entry (ProcFileEntry, const struct timeval *,
+			  int, uint32_t, uint32_t, uint32_t);
+extern void output_burst (ProcFileEntry, int, BufferEvent, double);
+extern void output_drops (const struct timeval *, uint32_t, uint32_t,
+			  uint32_t, uint32_t, uint64_t, uint32_t);
+extern void end_output_round (void);
+extern void wait_for_output (void);
+extern void finish_output (void);
+extern int replay_output (Preferences);
+
+#endif /* not __QUI_OUTPUT_H__ */
@@ -0,0 +1,546 @@
+/*
+ owner.c
+
+ Date Created: Sat Oct 17 23:52:30 2026
+
+ Finding the process that owns a socket
+
+ The only way to tell which process has a socket open is to look
+ through the descriptors of all processes under /proc/PID/fd for a
+ link to socket:[INODE], which takes a readlink() per descriptor on
+ the system: far too much to do in every round.  So the sampling
+ thread keeps a cache from inode numbers to owners, and only asks
+ about inodes it has not seen before.  The questions go through a
+ Ring to a resolver thread, which walks /proc and sends the owners it
+ finds back through another Ring; the sampling thread picks them up
+ at the start of a round.  Neither thread ever waits for the other.
+ When the question ring is full, the inode is simply asked about
+ again the next time it is looked up, and when the resolver has too
+ many questions open to take in another, it answers that it should be
+ asked again.
+
+ The resolver only walks while it has questions, one process at a
+ time, and goes on from where it stopped, so the processes are looked
+ at in turn, including those that have come since.  An inode that has
+ not been found after a whole walk that started after the question
+ came has no owner that we can see: it may belong to a process whose
+ descriptors we may not read, or have been closed.  It is asked about
+ again after OWNER_RETRY_S seconds, since the socket may have been
+ passed on to a process that we can see.  Walking costs the
+ resolver's own CPU, not the sampling thread's time, and it is limited
+ to --owner-budget milliseconds per second, in slices of a tenth of
+ that every 100 ms, so that a host with many processes does not see
+ one core busy with qui.
+
+ The cache holds up to --max-sockets inodes.  When it is full, the
+ inodes not looked up in the last round are thrown out, and asked
+ about again if they come back.  Inode numbers are not reused soon,
+ so an owner is not checked again once it is known.  For a socket
+ shared by several processes, the first one found is its owner.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "history.h"
+#include "sock-table.h"
+#include "ring.h"
+#include "timestamp.h"
+#include "owner.h"
+
+/* how many questions, and answers, can be on their way */
+#define OWNER_QUEUE 4096
+
+/* the resolver's budget is spent in slices, one per period */
+#define BUDGET_PERIOD_MS 100
+
+/* after how long an inode without an owner is asked about again */
+#define OWNER_RETRY_S	10
+
+/* states of an inode in the cache; a new one is zero */
+#define OWNER_WANTED	0	/* not asked about yet */
+#define OWNER_ASKED	1
+#define OWNER_FOUND	2
+#define OWNER_NONE	3	/* no owner found */
+
+typedef struct OwnerSlotRec *OwnerSlot;
+typedef struct OwnerAnswerRec *OwnerAnswer;
+typedef struct PendingRec *Pending;
+
+/* what the sampling thread keeps per inode */
+typedef struct OwnerSlotRec
+{
+  int		state;
+  uint64_t	none_since_ns;	/* when it got OWNER_NONE */
+  OwnerRec	owner;
+}
+OwnerSlotRec;
+
+/* from the resolver to the sampling thread */
+typedef struct OwnerAnswerRec
+{
+  uint32_t	inode;
+  int		state;		/* OWNER_FOUND, OWNER_NONE or OWNER_WANTED */
+  OwnerRec	owner;		/* if found */
+}
+OwnerAnswerRec;
+
+/* what the resolver keeps per question */
+typedef struct PendingRec
+{
+  unsigned long	walk;		/* in which the question came */
+  int		answered;
+}
+PendingRec;
+
+static void inode_key (SockKey, uint32_t);
+static void *resolver (void *);
+static void take_questions (void);
+static int scan_next_process (void);
+static void end_walk (void);
+static void keep_unanswered (SockTable, long, void *);
+static void give_up (SockTable, long, void *);
+static void answer (uint32_t, int, const OwnerRec *);
+static void read_owner (const char *, OwnerRec *);
+static int read_small_file (const char *, char *, size_t);
+static int wait_for_wakeup (int);
+
+static Preferences prefs;
+static Ring questions = 0;
+static Ring answers = 0;
+static int wakeup_fd = -1;
+static int stopping = 0;
+static pthread_t resolver_thread;
+static const char *proc_path = "/proc";
+
+/* Used by the sampling thread only. */
+static SockTable cache = 0;
+static unsigned long n_asked = 0;	/* in the current round */
+static uint64_t round_ns = 0;		/* when the current round began */
+
+/* Used by the resolver only. */
+static SockTable pending = 0;
+static unsigned long n_unanswered = 0;
+static unsigned long walk = 1;
+static DIR *proc_dir = 0;
+
+int
+init_owners (p)
+     Preferences p;
+{
+  sigset_t all, saved;
+  int err;
+
+  prefs = p;
+  if (p->proc_root)
+    proc_path = p->proc_root;
+  if ((cache = make_sock_table (p->max_sockets, sizeof (OwnerSlotRec))) == 0
+      || (pending = make_sock_table (4 * OWNER_QUEUE, sizeof (PendingRec))) == 0
+      || (questions = make_ring (OWNER_QUEUE, sizeof (uint32_t))) == 0
+      || (answers = make_ring (OWNER_QUEUE, sizeof (OwnerAnswerRec))) == 0)
+    return -1;
+  if ((proc_dir = opendir (proc_path)) == 0)
+    {
+      fprintf (stderr, "Cannot read %s: %s\n", proc_path, strerror (errno));
+      return -1;
+    }
+  if ((wakeup_fd = eventfd (0, EFD_NONBLOCK)) == -1)
+    {
+      fprintf (stderr, "Cannot create eventfd: %s\n", strerror (errno));
+      return -1;
+    }
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &saved);
+  err = pthread_create (&resolver_thread, 0, resolver, 0);
+  pthread_sigmask (SIG_SETMASK, &saved, 0);
+  if (err != 0)
+    {
+      fprintf (stderr, "Cannot create resolver thread: %s\n", strerror (err));
+      return -1;
+    }
+  return 0;
+}
+
+/* Take in the answers that have come, and make room in the cache if
+   it is full.  An answer of OWNER_WANTED means that the resolver could
+   not take the question, which is then asked again. */
+void
+begin_owners_round ()
+{
+  OwnerAnswerRec a;
+  SockKeyRec key;
+  OwnerSlot s;
+  long i;
+
+  round_ns = monotonic_ns ();
+  while (ring_pop (answers, &a) == 0)
+    {
+      inode_key (&key, a.inode);
+      if ((i = find_sock (cache, &key)) == -1)
+	continue;
+      s = (OwnerSlot) sock_value (cache, i);
+      s->state = a.state;
+      if (a.state == OWNER_FOUND)
+	s->owner = a.owner;
+      else if (a.state == OWNER_NONE)
+	s->none_since_ns = round_ns;
+    }
+  if (sock_table_count (cache) >= prefs->max_sockets)
+    sweep_sock_table (cache, 0, 0);
+  advance_sock_table (cache);
+}
+
+/* Return the owner of the socket with inode number INODE, or 0 if it
+   is not known (yet).  The result stays valid until the next round. */
+const OwnerRec *
+lookup_owner (inode)
+     uint32_t inode;
+{
+  SockKeyRec key;
+  OwnerSlot s;
+  long i;
+  int is_new;
+
+  if (inode == 0)
+    return 0;
+  inode_key (&key, inode);
+  if ((i = intern_sock (cache, &key, &is_new)) == -1)
+    return 0;
+  s = (OwnerSlot) sock_value (cache, i);
+  if (s->state == OWNER_FOUND)
+    return &(s->owner);
+  if (s->state == OWNER_NONE
+      && round_ns - s->none_since_ns >= OWNER_RETRY_S * 1000000000ULL)
+    s->state = OWNER_WANTED;
+  if (s->state == OWNER_WANTED && ring_push (questions, &inode) == 0)
+    {
+      s->state = OWNER_ASKED;
+      ++n_asked;
+    }
+  return 0;
+}
+
+/* Wake the resolver up if there are new questions for it. */
+void
+end_owners_round ()
+{
+  uint64_t one = 1;
+
+  if (n_asked == 0)
+    return;
+  n_asked = 0;
+  if (write (wakeup_fd, &one, sizeof one) == -1 && errno != EAGAIN)
+    fprintf (stderr, "Cannot wake resolver thread: %s\n", strerror (errno));
+}
+
+void
+finish_owners ()
+{
+  uint64_t one = 1;
+
+  __atomic_store_n (&stopping, 1, __ATOMIC_RELEASE);
+  if (write (wakeup_fd, &one, sizeof one) == -1 && errno != EAGAIN)
+    fprintf (stderr, "Cannot stop resolver thread: %s\n", strerror (errno));
+  pthread_join (resolver_thread, 0);
+  close (wakeup_fd);
+  closedir (proc_dir);
+  destroy_ring (questions);
+  destroy_ring (answers);
+  destroy_sock_table (pending);
+  destroy_sock_table (cache);
+}
+
+/* The inode number alone identifies a socket, whatever its namespace,
+   so the tables here use keys with nothing else in them. */
+static void
+inode_key (k, inode)
+     SockKey k;
+     uint32_t inode;
+{
+  memset (k, 0, sizeof (SockKeyRec));
+  k->inode = inode;
+}
+
+static void *
+resolver (arg)
+     void *arg;
+{
+  uint64_t slice_ns = (uint64_t) prefs->owner_budget_ms * 1000000
+    * BUDGET_PERIOD_MS / 1000;
+  uint64_t period_start = monotonic_ns (), used_ns = 0, start_ns, now;
+
+  while (!__atomic_load_n (&stopping, __ATOMIC_ACQUIRE))
+    {
+      take_questions ();
+      if (n_unanswered == 0)
+	{
+	  wait_for_wakeup (-1);
+	  continue;
+	}
+      now = monotonic_ns ();
+      if (now - period_start >= BUDGET_PERIOD_MS * 1000000ULL)
+	{
+	  period_start = now;
+	  used_ns = 0;
+	}
+      else if (used_ns >= slice_ns)
+	{
+	  wait_for_wakeup (BUDGET_PERIOD_MS
+			   - (now - period_start) / 1000000);
+	  continue;
+	}
+      start_ns = now;
+      if (scan_next_process () != 0)
+	end_walk ();
+      used_ns += monotonic_ns () - start_ns;
+    }
+  return 0;
+}
+
+static void
+take_questions ()
+{
+  SockKeyRec key;
+  Pending q;
+  uint32_t inode;
+  long i;
+  int is_new;
+
+  while (ring_pop (questions, &inode) == 0)
+    {
+      inode_key (&key, inode);
+      if ((i = intern_sock (pending, &key, &is_new)) == -1)
+	{
+	  /* Too many at once; have the cache ask again. */
+	  answer (inode, OWNER_WANTED, 0);
+	  continue;
+	}
+      q = (Pending) sock_value (pending, i);
+      if (is_new || q->answered)
+	{
+	  q->walk = walk;
+	  q->answered = 0;
+	  ++n_unanswered;
+	}
+    }
+}
+
+/* Look through the descriptors of the next process in /proc for the
+   sockets asked about.  Returns 1 at the end of the walk. */
+static int
+scan_next_process ()
+{
+  struct dirent *de, *fde;
+  char path[PATH_MAX], link[64];
+  SockKeyRec key;
+  OwnerRec owner;
+  Pending q;
+  DIR *fd_dir;
+  uint32_t inode;
+  ssize_t len;
+  long i;
+  int dfd;
+
+  do
+    {
+      if ((de = readdir (proc_dir)) == 0)
+	return 1;
+    }
+  while (de->d_name[0] < '1' || de->d_name[0] > '9');
+  snprintf (path, sizeof path, "%s/%s/fd", proc_path, de->d_name);
+  /* Processes come and go, and not all of them may be looked at. */
+  if ((dfd = open (path, O_RDONLY | O_DIRECTORY)) == -1)
+    return 0;
+  if ((fd_dir = fdopendir (dfd)) == 0)
+    {
+      close (dfd);
+      return 0;
+    }
+  owner.pid = 0;
+  while ((fde = readdir (fd_dir)) != 0)
+    {
+      if (fde->d_type != DT_LNK
+	  || (len = readlinkat (dfd, fde->d_name, link, sizeof link - 1)) < 9
+	  || memcmp (link, "socket:[", 8) != 0)
+	continue;
+      link[len] = 0;
+      inode = strtoul (link + 8, 0, 10);
+      inode_key (&key, inode);
+      if ((i = find_sock (pending, &key)) == -1)
+	continue;
+      q = (Pending) sock_value (pending, i);
+      if (q->answered)
+	continue;
+      if (owner.pid == 0)
+	read_owner (de->d_name, &owner);
+      answer (inode, OWNER_FOUND, &owner);
+      q->answered = 1;
+      --n_unanswered;
+    }
+  closedir (fd_dir);
+  return 0;
+}
+
+/* Start walking /proc again.  The questions that came before this
+   walk started have been through all of it, and those that are still
+   open get no owner. */
+static void
+end_walk ()
+{
+  advance_sock_table (pending);
+  walk_sock_table (pending, keep_unanswered, 0);
+  sweep_sock_table (pending, give_up, 0);
+  ++walk;
+  rewinddir (proc_dir);
+}
+
+/* Keep the questions of the walk that has just ended; interning one
+   that is there already only marks it as seen. */
+static void
+keep_unanswered (t, i, closure)
+     SockTable t;
+     long i;
+     void *closure;
+{
+  Pending q = (Pending) sock_value (t, i);
+  int is_new;
+
+  if (!q->answered && q->walk == walk)
+    intern_sock (t, sock_key (t, i), &is_new);
+}
+
+static void
+give_up (t, i, closure)
+     SockTable t;
+     long i;
+     void *closure;
+{
+  Pending q = (Pending) sock_value (t, i);
+
+  if (q->answered)
+    return;
+  answer (sock_key (t, i)->inode, OWNER_NONE, 0);
+  --n_unanswered;
+}
+
+/* Send an answer, waiting for room if the sampling thread has not
+   taken the earlier ones yet.  OWNER is only needed if STATE is
+   OWNER_FOUND. */
+static void
+answer (inode, state, owner)
+     uint32_t inode;
+     int state;
+     const OwnerRec *owner;
+{
+  OwnerAnswerRec a;
+
+  a.inode = inode;
+  a.state = state;
+  if (owner)
+    a.owner = *owner;
+  else
+    memset (&a.owner, 0, sizeof a.owner);
+  while (ring_push (answers, &a) != 0)
+    {
+      if (__atomic_load_n (&stopping, __ATOMIC_ACQUIRE))
+	return;
+      wait_for_wakeup (BUDGET_PERIOD_MS / 10);
+    }
+}
+
+/* The name and the cgroup of process PID.  Spaces in them are
+   replaced, so that they are single words in the output, and of the
+   cgroup path only the end is kept. */
+static void
+read_owner (pid, owner)
+     const char *pid;
+     OwnerRec *owner;
+{
+  char path[PATH_MAX], buf[1024], *line, *cp;
+  size_t len;
+
+  memset (owner, 0, sizeof (OwnerRec));
+  owner->pid = strtoul (pid, 0, 10);
+  snprintf (path, sizeof path, "%s/%s/comm", proc_path, pid);
+  if (read_small_file (path, owner->comm, MAX_COMM) != 0)
+    strcpy (owner->comm, "?");
+  snprintf (path, sizeof path, "%s/%s/cgroup", proc_path, pid);
+  if (read_small_file (path, buf, sizeof buf) != 0)
+    return;
+  /* The unified hierarchy has the line "0::PATH"; otherwise the
+     first line will do. */
+  line = (cp = strstr (buf, "0::")) != 0 && (cp == buf || cp[-1] == '\n')
+    ? cp : buf;
+  if ((cp = strchr (line, ':')) == 0 || (cp = strchr (cp + 1, ':')) == 0)
+    return;
+  line = cp + 1;
+  len = strcspn (line, "\n");
+  if (len >= MAX_CGROUP)
+    {
+      line += len - (MAX_CGROUP - 1);
+      len = MAX_CGROUP - 1;
+    }
+  memcpy (owner->cgroup, line, len);
+  for (cp = owner->cgroup; *cp; ++cp)
+    if (*cp == ' ')
+      *cp = '_';
+}
+
+/* Read the file PATH into BUF as a string without its final newline,
+   cut off at SIZE - 1 bytes. */
+static int
+read_small_file (path, buf, size)
+     const char *path;
+     char *buf;
+     size_t size;
+{
+  ssize_t len;
+  char *cp;
+  int fd;
+
+  if ((fd = open (path, O_RDONLY)) == -1)
+    return -1;
+  len = read (fd, buf, size - 1);
+  close (fd);
+  if (len <= 0)
+    return -1;
+  if (buf[len - 1] == '\n')
+    --len;
+  buf[len] = 0;
+  for (cp = buf; cp < buf + len; ++cp)
+    if (*cp == ' ')
+      *cp = '_';
+  return 0;
+}
+
+/* Wait for new questions or for the end, at most TIMEOUT
+   milliseconds, or forever if it is negative. */
+static int
+wait_for_wakeup (timeout)
+     int timeout;
+{
+  struct pollfd pfd;
+  uint64_t n;
+
+  pfd.fd = wakeup_fd;
+  pfd.events = POLLIN;
+  if (poll (&pfd, 1, timeout) <= 0)
+    return 0;
+  if (read (wakeup_fd, &n, sizeof n) == -1 && errno != EAGAIN)
+    return -1;
+  return 1;
+}
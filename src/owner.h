@@ -0,0 +1,34 @@
+/*
+ owner.h
+
+ Date Created: Sat Oct 17 23:52:30 2026
+ */
+
+#ifndef __QUI_OWNER_H__
+#define __QUI_OWNER_H__ 1
+
+#include <stdint.h>
+
+/* as in /proc/PID/comm, with its newline */
+#define MAX_COMM	16
+/* the end of the cgroup path, which tells containers apart */
+#define MAX_CGROUP	64
+
+typedef struct OwnerRec *Owner;
+
+/* the process that has a socket open; pid is 0 if it is not known */
+typedef struct OwnerRec
+{
+  uint32_t	pid;
+  char		comm[MAX_COMM];
+  char		cgroup[MAX_CGROUP];
+}
+OwnerRec;
+
+extern int init_owners (Preferences);
+extern void begin_owners_round (void);
+extern const OwnerRec *lookup_owner (uint32_t);
+extern void end_owners_round (void);
+extern void finish_owners (void);
+
+#endif /* not __QUI_OWNER_H__ */
@@ -41,15 +41,41 @@ parse_args (argc, argv, p)
     { "microseconds", no_argument, 0, 'm',},
     { "blip-size", required_argument, 0, 'b',},
     { "close", no_argument, 0, 'c',},
+    { "netlink", no_argument, 0, 'n',},
+    { "bpf", no_argument, 0, 'B',},
+    { "peaks", no_argument, 0, 'k',},
+    { "threads", required_argument, 0, 'P',},
+    { "all-netns", no_argument, 0, 'N',},
+    { "proc-root", required_argument, 0, 'R',},
+    { "poisson", no_argument, 0, 'E',},
+    { "jitter", required_argument, 0, 'j',},
+    { "stats", no_argument, 0, 'A',},
+    { "top", required_argument, 0, 'K',},
+    { "refresh", required_argument, 0, 'F',},
+    { "peak-hold", required_argument, 0, 'H',},
+    { "listen", required_argument, 0, 'L',},
+    { "publish", required_argument, 0, 'W',},
+    { "drops", no_argument, 0, 'D',},
+    { "owners", no_argument, 0, 'C',},
+    { "owner-budget", required_argument, 0, 'G',},
+    { "events", no_argument, 0, 'e',},
+    { "low-threshold", required_argument, 0, 'l',},
+    { "max-sockets", required_argument, 0, 'S',},
+    { "output-buffer", required_argument, 0, 'O',},
+    { "record", required_argument, 0, 'w',},
+    { "replay", required_argument, 0, 'r',},
+    { "from", required_argument, 0, 'f',},
+    { "until", required_argument, 0, 'u',},
     { "debug", no_argument, 0, 'd',},
     { "help", no_argument, 0, 'h',},
     { 0, 0, 0, 0, },
   };
   int opt;
   char *end;
+  int have_low_threshold = 0;
 
   init_prefs (p);
-  while ((opt = getopt_long (argc, argv, "t:s:b:TU46p:iomcdh", opts, 0)) != -1)
+  while ((opt = getopt_long (argc, argv, "t:s:b:TU46p:iomcnBkP:NR:Ej:AK:F:H:L:W:DCG:el:S:O:w:r:f:u:dh", opts, 0)) != -1)
     {
       switch (opt) {
       case 'T': p->want_tcp = 1; break;
@@ -60,11 +86,81 @@ parse_args (argc, argv, p)
       case 'o': p->want_output = 1; break;
       case 'm': p->print_usecs = 1; break;
       case 'c': p->close_proc_after_reading = 1; break;
+      case 'n': p->collect_method = COLLECT_NETLINK; break;
+      case 'B': p->collect_method = COLLECT_BPF; break;
+      case 'k': p->want_peaks = 1; break;
+      case 'N': p->all_netns = 1; break;
+      case 'e': p->want_events = 1; break;
+      case 'E': p->schedule = SCHEDULE_POISSON; break;
+      case 'A': p->want_stats = 1; break;
+      case 'D': p->want_drops = 1; break;
+      case 'C': p->want_owners = 1; break;
       case 'd': p->debug = 1; break;
+      case 'R': p->proc_root = optarg; break;
+      case 'L': p->listen_address = optarg; break;
+      case 'W': p->publish_name = optarg; break;
+      case 'w': p->record_file = optarg; break;
+      case 'r': p->replay_file = optarg; break;
+      case 'f': p->replay_from = optarg; break;
+      case 'u': p->replay_until = optarg; break;
       case 't':
 	if (convert_unsigned (optarg, &p->threshold, "threshold") != 0)
 	  exit (1);
 	break;
+      case 'l':
+	if (convert_unsigned (optarg, &p->low_threshold, "low threshold") != 0)
+	  exit (1);
+	have_low_threshold = 1;
+	break;
+      case 'S':
+	if (convert_unsigned (optarg, &p->max_sockets, "socket count") != 0)
+	  exit (1);
+	if (p->max_sockets < 1)
+	  {
+	    fprintf (stderr, "Socket count must be >0\n");
+	    exit (1);
+	  }
+	break;
+      case 'K':
+	if (convert_unsigned (optarg, &p->top_count, "socket count") != 0)
+	  exit (1);
+	if (p->top_count < 1)
+	  {
+	    fprintf (stderr, "Socket count must be >0\n");
+	    exit (1);
+	  }
+	break;
+      case 'F':
+	if (convert_unsigned (optarg, &p->refresh_ms, "refresh time") != 0)
+	  exit (1);
+	if (p->refresh_ms < 1)
+	  {
+	    fprintf (stderr, "Refresh time must be >0\n");
+	    exit (1);
+	  }
+	break;
+      case 'H':
+	if (convert_unsigned (optarg, &p->peak_hold_ms, "peak hold time") != 0)
+	  exit (1);
+	break;
+      case 'G':
+	if (convert_unsigned (optarg, &p->owner_budget_ms, "owner budget") != 0)
+	  exit (1);
+	if (p->owner_budget_ms < 1 || p->owner_budget_ms > 1000)
+	  {
+	    fprintf (stderr, "Owner budget must be >0 and <=1000\n");
+	    exit (1);
+	  }
+	break;
+      case 'O':
+	if (convert_unsigned (optarg, &p->output_buffer, "record count") != 0)
+	  exit (1);
+	if (p->output_buffer < 1)
+	  {
+	    fprintf (stderr, "Record count must be >0\n");
+	    exit (1);
+	  }
+	break;
       case 's':
 	if ((double_arg = strtod (optarg, &end)) < 0
 	    || end == optarg || *end != 0)
@@ -77,6 +173,16 @@ parse_args (argc, argv, p)
 	    init_timespec (&p->sleeptime, double_arg);
 	  }
 	break;
+      case 'j':
+	if ((double_arg = strtod (optarg, &end)) <= 0 || double_arg > 1
+	    || end == optarg || *end != 0)
+	  {
+	    fprintf (stderr, "Jitter must be a fraction >0 and <=1\n");
+	    exit (1);
+	  }
+	p->schedule = SCHEDULE_JITTER;
+	p->jitter = double_arg;
+	break;
       case 'b':
 	if (convert_unsigned (optarg, &p->blipsize, "blip size") != 0)
 	  exit (1);
@@ -86,6 +192,10 @@ parse_args (argc, argv, p)
 	    exit (1);
 	  }
 	break;
+      case 'P':
+	if (convert_unsigned (optarg, &p->n_threads, "thread count") != 0)
+	  exit (1);
+	break;
       case 'p':
 	if (convert_u16 (optarg, &p->portno, "port number") != 0)
 	  exit (1);
@@ -96,6 +206,106 @@ parse_args (argc, argv, p)
 	exit (0);
       }
     }
+  if (!have_low_threshold)
+    p->low_threshold = p->threshold / 2;
+  if (p->low_threshold > p->threshold)
+    {
+      fprintf (stderr, "Low threshold must not be above threshold\n");
+      exit (1);
+    }
+  if (p->want_events && p->want_peaks)
+    {
+      fprintf (stderr, "--events cannot be combined with --peaks\n");
+      exit (1);
+    }
+  if (p->want_events && p->want_stats)
+    {
+      fprintf (stderr, "--events cannot be combined with --stats\n");
+      exit (1);
+    }
+  if (p->top_count > 0
+      && (p->want_events || p->want_stats || p->want_peaks
+	  || p->record_file || p->replay_file))
+    {
+      fprintf (stderr, "--top cannot be combined with --events, --stats, "
+	       "--peaks, --record or --replay\n");
+      exit (1);
+    }
+  if (p->listen_address
+      && (p->want_events || p->want_stats || p->top_count > 0
+	  || p->want_peaks || p->record_file || p->replay_file))
+    {
+      fprintf (stderr, "--listen cannot be combined with --events, --stats, "
+	       "--top, --peaks, --record or --replay\n");
+      exit (1);
+    }
+  if (p->publish_name
+      && (p->want_events || p->want_stats || p->top_count > 0
+	  || p->listen_address || p->want_peaks
+	  || p->record_file || p->replay_file))
+    {
+      fprintf (stderr, "--publish cannot be combined with --events, --stats, "
+	       "--top, --listen, --peaks, --record or --replay\n");
+      exit (1);
+    }
+  if (p->want_drops
+      && (p->want_events || p->top_count > 0 || p->listen_address
+	  || p->publish_name || p->collect_method == COLLECT_BPF))
+    {
+      fprintf (stderr, "--drops cannot be combined with --events, --top, "
+	       "--listen, --publish or --bpf\n");
+      exit (1);
+    }
+  if (p->want_drops && p->want_tcp && !p->want_udp)
+    {
+      fprintf (stderr, "--drops only works with UDP sockets\n");
+      exit (1);
+    }
+  if (p->want_owners
+      && (p->listen_address || p->publish_name || p->replay_file
+	  || p->collect_method == COLLECT_BPF))
+    {
+      fprintf (stderr, "--owners cannot be combined with --listen, --publish, "
+	       "--replay or --bpf\n");
+      exit (1);
+    }
+  /* The estimates, the aggregated metrics and the consumers of
+     snapshots need every sample, not only those above the threshold.
+     The view shows the fullest queues even when they are below the
+     threshold, but never empty ones.  A socket whose peak between
+     rounds crossed the threshold must be sampled even if it has
+     drained since, so that it is reported with its queues, inode and
+     namespace. */
+  p->filter_threshold = p->want_stats || p->listen_address
+    || p->publish_name || p->want_peaks ? 0
+    : p->top_count > 0 ? 1
+    : p->want_events ? p->low_threshold : p->threshold;
+  if (p->record_file && p->replay_file)
+    {
+      fprintf (stderr, "--record cannot be combined with --replay\n");
+      exit (1);
+    }
+  if ((p->replay_from || p->replay_until) && !p->replay_file)
+    {
+      fprintf (stderr, "--from and --until only work with --replay\n");
+      exit (1);
+    }
+  if (p->proc_root && (p->collect_method != COLLECT_PROC || p->all_netns))
+    {
+      fprintf (stderr, "--proc-root only works with /proc/net, "
+	       "and not with --all-netns\n");
+      exit (1);
+    }
+  if (p->all_netns && p->collect_method != COLLECT_PROC)
+    {
+      fprintf (stderr, "--all-netns only works with /proc/net\n");
+      exit (1);
+    }
+  if (p->all_netns && p->close_proc_after_reading)
+    {
+      fprintf (stderr, "--all-netns cannot be combined with --close\n");
+      exit (1);
+    }
   if (!p->want_udp && !p->want_tcp)
     {
       p->want_udp = p->want_tcp = 1;
@@ -158,6 +368,11 @@ convert_u16 (arg, valp, name)
 static const unsigned default_threshold = 2000;
 static const unsigned default_blipsize = 50000;
 static const unsigned default_sleep = 10;
+static const unsigned default_max_sockets = 65536;
+static const unsigned default_output_buffer = 16384;
+static const unsigned default_refresh = 500;
+static const unsigned default_peak_hold = 5000;
+static const unsigned default_owner_budget = 20;
 
 static void
 init_prefs (p)
@@ -174,7 +389,30 @@ init_prefs (p)
   p->threshold = default_threshold;
   p->blipsize = default_blipsize;
   init_timespec (&p->sleeptime, (double) default_sleep);
+  p->schedule = SCHEDULE_FIXED;
+  p->jitter = 0;
+  p->want_stats = 0;
+  p->want_drops = 0;
+  p->want_owners = 0;
+  p->owner_budget_ms = default_owner_budget;
+  p->top_count = 0;
+  p->listen_address = 0;
+  p->publish_name = 0;
+  p->refresh_ms = default_refresh;
+  p->peak_hold_ms = default_peak_hold;
   p->close_proc_after_reading = 0;
+  p->collect_method = COLLECT_PROC;
+  p->want_peaks = 0;
+  p->n_threads = 0;
+  p->all_netns = 0;
+  p->proc_root = 0;
+  p->want_events = 0;
+  p->max_sockets = default_max_sockets;
+  p->output_buffer = default_output_buffer;
+  p->record_file = 0;
+  p->replay_file = 0;
+  p->replay_from = 0;
+  p->replay_until = 0;
   p->debug = 0;
 }
 
@@ -195,6 +433,17 @@ usage (progname)
 	   "\t  [--tcp|-T] [--udp|-U] [--ipv4|-4] [--ipv6|-6]\n"
 	   "\t  [--input|-i] [--output|-o]\n"
 	   "\t  [--port PORT|-p PORT] [--microseconds|-m]\n"
+	   "\t  [--netlink|-n] [--bpf|-B] [--peaks|-k]\n"
+	   "\t  [--threads N|-P N] [--all-netns|-N] [--proc-root DIR|-R DIR]\n"
+	   "\t  [--poisson|-E] [--jitter FRACTION|-j FRACTION] [--stats|-A]\n"
+	   "\t  [--drops|-D] [--owners|-C [--owner-budget MILLISECONDS|-G MILLISECONDS]]\n"
+	   "\t  [--top N|-K N [--refresh MILLISECONDS|-F MILLISECONDS]\n"
+	   "\t   [--peak-hold MILLISECONDS|-H MILLISECONDS]]\n"
+	   "\t  [--listen [HOST:]PORT|-L [HOST:]PORT] [--publish NAME|-W NAME]\n"
+	   "\t  [--events|-e] [--low-threshold BYTES|-l BYTES]\n"
+	   "\t  [--max-sockets N|-S N] [--output-buffer N|-O N]\n"
+	   "\t  [--record FILE|-w FILE]\n"
+	   "\t  [--replay FILE|-r FILE [--from TIME|-f TIME] [--until TIME|-u TIME]]\n"
 	   "\t  [--debug|-d] [--help|-h]\n",
 	   progname);
 }
@@ -12,6 +12,24 @@
 
 typedef struct PreferencesRec *Preferences;
 
+/* ways of collecting socket queue information from the kernel */
+typedef enum
+{
+  COLLECT_PROC,			/* text tables under /proc/net */
+  COLLECT_NETLINK,		/* binary NETLINK_SOCK_DIAG dumps */
+  COLLECT_BPF			/* BPF socket iterators, filtering in the kernel */
+}
+CollectMethod;
+
+/* how the gaps between rounds are chosen */
+typedef enum
+{
+  SCHEDULE_FIXED,		/* all equal to sleeptime */
+  SCHEDULE_POISSON,		/* exponentially distributed, mean sleeptime */
+  SCHEDULE_JITTER		/* uniform within sleeptime +/- jitter */
+}
+ScheduleKind;
+
 typedef struct PreferencesRec
 {
   /* whether we are interested in TCP sockets */
@@ -47,6 +65,35 @@ typedef struct PreferencesRec
      to be accounted for. */
   unsigned	threshold;
 
+  /* whether one record per burst should be printed rather than one
+     line per sample.  A burst starts when a queue reaches threshold,
+     and ends when it falls below low_threshold. */
+  int		want_events;
+  unsigned	low_threshold;
+
+  /* how many sockets can be tracked across rounds */
+  unsigned	max_sockets;
+
+  /* sockets with all selected queues below this size are skipped by
+     the collection methods: threshold, low_threshold in event mode,
+     0 with --stats, --listen, --publish or --peaks, and 1 with
+     --top. */
+  unsigned	filter_threshold;
+
+  /* how many records can wait for the output thread; when it falls
+     further behind, records are dropped. */
+  unsigned	output_buffer;
+
+  /* the trace file to which records are written instead of standard
+     output, if any */
+  const char   *record_file;
+
+  /* the trace file to print, instead of sampling, if any, and the
+     time range of interest, as given on the command line */
+  const char   *replay_file;
+  const char   *replay_from;
+  const char   *replay_until;
+
   /* visualization unit for queue occupancy. */
   unsigned	blipsize;
 
@@ -58,11 +105,67 @@ typedef struct PreferencesRec
      the option will probably be removed. */
   int		close_proc_after_reading;
 
+  /* where socket information comes from. */
+  CollectMethod	collect_method;
+
+  /* number of worker threads that read the /proc/net files in
+     parallel, or 0 to read them one after the other. */
+  unsigned	n_threads;
+
+  /* the directory in which net/{udp,tcp}{,6} are read instead of
+     /proc, if any */
+  const char   *proc_root;
+
+  /* whether the /proc/net files of all network namespaces should be
+     read, rather than just those of our own. */
+  int		all_netns;
+
+  /* whether receive queue peaks between rounds should be captured by
+     BPF probes on the enqueue paths, and reported next to the sampled
+     values. */
+  int		want_peaks;
+
   /* debugging mode with more verbose output */
   int		debug;
 
   /* how long the tool should wait between rounds */
   struct timespec sleeptime;
+
+  /* whether the time between rounds should vary, and if so by what
+     fraction of sleeptime, for SCHEDULE_JITTER */
+  ScheduleKind	schedule;
+  double	jitter;
+
+  /* with a full-screen view of the sockets with the fullest queues:
+     how many to show, how often to redraw the screen, and how long
+     a peak keeps a socket in the view. */
+  unsigned	top_count;
+  unsigned	refresh_ms;
+  unsigned	peak_hold_ms;
+
+  /* the [HOST:]PORT on which metrics are served over HTTP instead of
+     printing lines, if any */
+  const char   *listen_address;
+
+  /* the name of the shared-memory segment into which each round is
+     written instead of printing lines, if any */
+  const char   *publish_name;
+
+  /* whether the packets dropped by UDP sockets should be counted, per
+     socket and host-wide, and reported for each round in which they
+     went up. */
+  int		want_drops;
+
+  /* whether the process owning each socket should be found and
+     reported, and how many milliseconds per second of CPU time may be
+     spent looking for owners under /proc. */
+  int		want_owners;
+  unsigned	owner_budget_ms;
+
+  /* whether the time-averaged occupancy and the fraction of time at
+     or above threshold should be estimated for each socket, and
+     printed on exit. */
+  int		want_stats;
 }
 PreferencesRec;
 
@@ -14,7 +14,6 @@
  */
 
 #include <sys/types.h>
-#include <sys/stat.h>
 #include <fcntl.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -25,36 +24,60 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "preferences.h"
 #include "proc-net.h"
+#include "hex.h"
+#include "line-reader.h"
+#include "thread-pool.h"
+#include "netns.h"
+#include "timestamp.h"
+#include "instrument.h"
 
 typedef struct ProcFileRec *ProcFile;
+typedef struct ProcLineContextRec *ProcLineContext;
+typedef struct ProcChunkRec *ProcChunk;
+typedef struct ProcRoundRec *ProcRound;
 
+static int use_proc_root (const char *);
 static int relevant_procfile_p (ProcFile, Preferences);
+static int find_relevant_procfiles (Preferences);
+static int note_relevant_procfile (ProcFile);
+static int update_netns (Preferences);
+static int attach_netns (NetNs, Preferences);
+static void forget_netns (NetNs, void *);
+static int parse_proc_files_threaded (Preferences, SockEntryCallback, void *);
+static void read_proc_file (unsigned, void *);
+static int split_proc_file (ProcFile, Preferences, unsigned);
+static void parse_proc_chunk (unsigned, void *);
+static void collect_entry (ProcFileEntry, const struct timeval *, void *);
 static int parse_proc_file (ProcFile, Preferences, SockEntryCallback, void *);
-static int parse_proc_line (const char *, const char *,
-			    const struct timeval *, Preferences,
-			    SockEntryCallback, void *);
-static int parse_sockaddr (const char **, const char *,
+static int open_proc_file (ProcFile);
+static int finish_proc_file (ProcFile, Preferences);
+static void parse_header_line (const char *, const char *, Preferences);
+static int parse_proc_line (const char *, const char *, void *);
+static int parse_sockaddr (const char **, const char *, int,
 			   struct sockaddr_storage *);
-static int convert_sockaddr_in (const char *, const char *, uint16_t,
-				struct sockaddr_in *);
-static int convert_sockaddr_in6 (const char *, const char *, uint16_t,
-				 struct sockaddr_in6 *);
-static int parse_addr_port (const char **, const char *,
-			    const char **, const char **,
-			    uint16_t *);
-static int parse_dec (const char **, const char *,
-		      const char **, const char **);
-static int parse_hex (const char **, const char *,
-		      const char **, const char **);
 static int parse_hex_u32 (const char **, const char *, uint32_t *);
-static int parse_hex_u16 (const char **, const char *, uint16_t *);
-static int skip_colon (const char **, const char *);
+static int parse_inode (const char *, const char *, uint32_t *);
+static int parse_drops (const char *, const char *, uint32_t *);
 static int skip_spaces (const char **, const char *);
 
-#define BUFSIZE 65536
+/* Initial size of the per-file read buffer, and so the amount
+   requested by each read(). */
+#define READ_CHUNK (256 * 1024)
+
+/* With worker threads, each file is cut into pieces of at least
+   MIN_PARSE_CHUNK bytes, and into no more than PARSE_CHUNKS_PER_THREAD
+   pieces per thread.  Having more pieces than threads lets threads
+   that finish early take over the remaining work. */
+#define MIN_PARSE_CHUNK (64 * 1024)
+#define PARSE_CHUNKS_PER_THREAD 4
+
+/* With --all-netns, how often to look for new namespaces, in
+   seconds. */
+#define NETNS_SCAN_INTERVAL 10
 
 typedef struct ProcFileRec
 {
@@ -62,9 +85,76 @@ typedef struct ProcFileRec
   int		fd;
   int		af;
   int		proto;
+  LineReader	reader;
+  NetNs		netns;		/* with --all-netns: whose file this is */
+
+  /* with worker threads: the whole file as read in this round */
+  size_t	length;
+  int		status;		/* result of read_proc_file() */
 }
 ProcFileRec;
 
+/* What parse_proc_line() needs to know about the file being read */
+typedef struct ProcLineContextRec
+{
+  ProcFile	procfile;
+  Preferences	p;
+  SockEntryCallback callback;
+  void	       *closure;
+  int		whole_file;	/* read with read_whole_file() */
+  unsigned long	lineno;
+}
+ProcLineContextRec;
+
+/* A piece of a file, consisting of whole lines, that is parsed by
+   one worker thread.  The entries found in it are collected here, to
+   be delivered by the main thread afterwards. */
+typedef struct ProcChunkRec
+{
+  ProcFile	procfile;
+  const char   *start;
+  const char   *end;
+  ProcFileEntry	entries;
+  unsigned	n_entries;
+  unsigned	max_entries;
+  int		status;
+  int		out_of_memory;
+}
+ProcChunkRec;
+
+/* What the workers need to know in a threaded round */
+typedef struct ProcRoundRec
+{
+  Preferences	p;
+  ProcFile     *files;		/* the relevant files, one per task */
+}
+ProcRoundRec;
+
+/* Worker threads for reading the files in parallel, created on first
+   use. */
+static ThreadPool pool = 0;
+
+/* The files to read in this round, in the order in which their
+   entries are delivered. */
+static ProcFile *relevant = 0;
+static unsigned n_relevant = 0;
+static unsigned max_relevant = 0;
+
+/* With --all-netns: the namespaces found, each with its own copy of
+   procfiles[] as data, and when they were last looked for. */
+static NetNs namespaces = 0;
+static time_t netns_scan_time = 0;
+
+/* whether the pathnames in procfiles[] have been moved under
+   --proc-root */
+static int proc_root_applied = 0;
+
+/* The pieces of all files of the current round, in file order.  The
+   entry vectors are kept across rounds. */
+static ProcChunk chunks = 0;
+static unsigned n_chunks = 0;
+static unsigned max_chunks = 0;
+
 ProcFileRec
 procfiles[] = {
   { .pathname = "/proc/net/udp",
@@ -101,21 +191,416 @@ parse_proc_files (p, callback, closure)
      void *closure;
 {
   ProcFile procfile;
+  unsigned k;
+  int result = 0;
+
+  if (p->proc_root && !proc_root_applied)
+    {
+      if (use_proc_root (p->proc_root) != 0)
+	return -1;
+      proc_root_applied = 1;
+    }
+  if (find_relevant_procfiles (p) != 0)
+    return -1;
+  if (p->n_threads > 0)
+    return parse_proc_files_threaded (p, callback, closure);
+  for (k = 0; k < n_relevant; ++k)
+    {
+      procfile = relevant[k];
+      if (parse_proc_file (procfile, p, callback, closure) != 0)
+	{
+	  fprintf (stderr, "error parsing %s\n", procfile->pathname);
+	  result = -1;
+	}
+    }
+  return result;
+}
 
-  for (procfile = &procfiles[0]; procfile->pathname != 0; ++procfile)
+/* A threaded round has two steps.  First, each relevant file is read
+   as a whole by a worker thread, so that the files are all read at
+   about the same time.  Then the files are split at line boundaries,
+   and the workers parse the pieces, each taking the next unparsed one
+   when it is done with the last.  This spreads the parsing of a
+   single big table, typically tcp6 on a busy server, over all
+   threads.  Entries are collected per piece and handed to CALLBACK
+   from this thread only, in the same order as when reading
+   sequentially. */
+static int
+parse_proc_files_threaded (p, callback, closure)
+     Preferences p;
+     SockEntryCallback callback;
+     void *closure;
+{
+  ProcRoundRec round;
+  ProcChunk chunk;
+  struct timeval tv;
+  unsigned k, i;
+  int result = 0;
+
+  if (pool == 0 && (pool = make_thread_pool (p->n_threads)) == 0)
+    {
+      fprintf (stderr, "Reading /proc/net files sequentially\n");
+      p->n_threads = 0;
+      return parse_proc_files (p, callback, closure);
+    }
+  round.p = p;
+  round.files = relevant;
+  run_thread_pool (pool, n_relevant, read_proc_file, &round);
+  n_chunks = 0;
+  for (k = 0; k < n_relevant; ++k)
     {
-      if (relevant_procfile_p (procfile, p))
+      if (relevant[k]->status != 0
+	  || split_proc_file (relevant[k], p, thread_pool_size (pool)) != 0)
 	{
-	  if (parse_proc_file (procfile, p, callback, closure) != 0)
+	  fprintf (stderr, "error parsing %s\n", relevant[k]->pathname);
+	  result = -1;
+	}
+    }
+  run_thread_pool (pool, n_chunks, parse_proc_chunk, &round);
+  for (k = 0; k < n_chunks; ++k)
+    {
+      chunk = &chunks[k];
+      if (chunk->status != 0)
+	{
+	  fprintf (stderr, "error parsing %s\n", chunk->procfile->pathname);
+	  result = -1;
+	  continue;
+	}
+      for (i = 0; i < chunk->n_entries; ++i)
+	{
+	  timestamp_to_timeval (chunk->entries[i].ts, &tv);
+	  (* callback) (&chunk->entries[i], &tv, closure);
+	}
+    }
+  return result;
+}
+
+/* Runs in a worker thread. */
+static void
+read_proc_file (k, closure)
+     unsigned k;
+     void *closure;
+{
+  ProcRound round = (ProcRound) closure;
+  ProcFile procfile = round->files[k];
+  int fd;
+
+  procfile->status = -1;
+  if (procfile->reader == 0
+      && (procfile->reader = make_line_reader (READ_CHUNK)) == 0)
+    return;
+  if ((fd = open_proc_file (procfile)) == -1)
+    return;
+  if (read_whole_file (procfile->reader, fd, &procfile->length) == -1)
+    {
+      fprintf (stderr, "Error reading from %s: %s\n",
+	       procfile->pathname, strerror (errno));
+      return;
+    }
+  procfile->status = finish_proc_file (procfile, round->p);
+}
+
+/* Add pieces of PROCFILE, which has just been read, to the chunks
+   array.  The header line is dealt with here. */
+static int
+split_proc_file (procfile, p, n_threads)
+     ProcFile procfile;
+     Preferences p;
+     unsigned n_threads;
+{
+  const char *start = procfile->reader->buf;
+  const char *end = start + procfile->length;
+  const char *cp, *nl;
+  size_t piece;
+  unsigned n_pieces;
+
+  if ((nl = memchr (start, '\n', end - start)) == 0)
+    {
+      fprintf (stderr, "No header line in %s\n", procfile->pathname);
+      return -1;
+    }
+  parse_header_line (start, nl, p);
+  cp = nl + 1;
+  if (cp == end)
+    return 0;
+  n_pieces = (end - cp) / MIN_PARSE_CHUNK;
+  if (n_pieces > n_threads * PARSE_CHUNKS_PER_THREAD)
+    n_pieces = n_threads * PARSE_CHUNKS_PER_THREAD;
+  if (n_pieces < 1)
+    n_pieces = 1;
+  piece = (end - cp) / n_pieces;
+  while (cp < end)
+    {
+      if (n_chunks == max_chunks)
+	{
+	  unsigned max = max_chunks ? max_chunks * 2 : 16;
+	  ProcChunk new_chunks;
+
+	  if ((new_chunks = realloc (chunks, max * sizeof (ProcChunkRec))) == 0)
 	    {
-	      fprintf (stderr, "error parsing %s\n", procfile->pathname);
+	      fprintf (stderr, "Out of memory\n");
 	      return -1;
 	    }
+	  memset (new_chunks + max_chunks, 0,
+		  (max - max_chunks) * sizeof (ProcChunkRec));
+	  chunks = new_chunks;
+	  max_chunks = max;
+	}
+      chunks[n_chunks].procfile = procfile;
+      chunks[n_chunks].start = cp;
+      if ((size_t) (end - cp) <= piece
+	  || (nl = memchr (cp + piece, '\n', end - cp - piece)) == 0)
+	cp = end;
+      else
+	cp = nl + 1;
+      chunks[n_chunks].end = cp;
+      ++n_chunks;
+    }
+  return 0;
+}
+
+/* Runs in a worker thread. */
+static void
+parse_proc_chunk (k, closure)
+     unsigned k;
+     void *closure;
+{
+  ProcRound round = (ProcRound) closure;
+  ProcChunk chunk = &chunks[k];
+  ProcLineContextRec ctx;
+  const char *cp, *nl;
+
+  ctx.procfile = chunk->procfile;
+  ctx.p = round->p;
+  ctx.callback = collect_entry;
+  ctx.closure = chunk;
+  ctx.whole_file = 1;
+  ctx.lineno = 1;		/* the header has been seen */
+  chunk->n_entries = 0;
+  chunk->out_of_memory = 0;
+  chunk->status = 0;
+  for (cp = chunk->start; cp < chunk->end; cp = nl + 1)
+    {
+      if ((nl = memchr (cp, '\n', chunk->end - cp)) == 0)
+	nl = chunk->end;
+      if (parse_proc_line (cp, nl, &ctx) == -1)
+	{
+	  chunk->status = -1;
+	  return;
+	}
+    }
+  note_lines (ctx.lineno - 1);
+  if (chunk->out_of_memory)
+    chunk->status = -1;
+}
+
+static void
+collect_entry (pfe, tv, closure)
+     ProcFileEntry pfe;
+     const struct timeval *tv;
+     void *closure;
+{
+  ProcChunk chunk = (ProcChunk) closure;
+
+  if (chunk->n_entries == chunk->max_entries)
+    {
+      unsigned max = chunk->max_entries ? chunk->max_entries * 2 : 64;
+      ProcFileEntry entries;
+
+      if ((entries = realloc (chunk->entries,
+			      max * sizeof (ProcFileEntryRec))) == 0)
+	{
+	  if (!chunk->out_of_memory)
+	    fprintf (stderr, "Out of memory\n");
+	  chunk->out_of_memory = 1;
+	  return;
+	}
+      chunk->entries = entries;
+      chunk->max_entries = max;
+    }
+  chunk->entries[chunk->n_entries++] = *pfe;
+}
+
+/* Replace the leading /proc of the pathnames in procfiles[] with ROOT,
+   so that the files can be read from a copy elsewhere.  Either all of
+   them are replaced or none. */
+static int
+use_proc_root (root)
+     const char *root;
+{
+  char *pathnames[sizeof procfiles / sizeof procfiles[0]];
+  size_t len;
+  unsigned k;
+
+  for (k = 0; procfiles[k].pathname != 0; ++k)
+    {
+      len = strlen (root) + strlen (procfiles[k].pathname) + 1;
+      if ((pathnames[k] = malloc (len)) == 0)
+	{
+	  fprintf (stderr, "Out of memory\n");
+	  while (k-- > 0)
+	    free (pathnames[k]);
+	  return -1;
+	}
+      snprintf (pathnames[k], len, "%s%s", root,
+		procfiles[k].pathname + strlen ("/proc"));
+    }
+  for (k = 0; procfiles[k].pathname != 0; ++k)
+    procfiles[k].pathname = pathnames[k];
+  return 0;
+}
+
+/* Fill the relevant array with the files to read in this round:
+   those of procfiles[], or with --all-netns, those of each namespace
+   in turn. */
+static int
+find_relevant_procfiles (p)
+     Preferences p;
+{
+  ProcFile procfile;
+  NetNs ns;
+
+  n_relevant = 0;
+  if (!p->all_netns)
+    {
+      for (procfile = &procfiles[0]; procfile->pathname != 0; ++procfile)
+	{
+	  if (relevant_procfile_p (procfile, p)
+	      && note_relevant_procfile (procfile) != 0)
+	    return -1;
+	}
+      return 0;
+    }
+  if (update_netns (p) != 0)
+    return -1;
+  for (ns = namespaces; ns != 0; ns = ns->next)
+    {
+      if (ns->data == 0)
+	continue;
+      for (procfile = (ProcFile) ns->data; procfile->pathname != 0; ++procfile)
+	{
+	  if (procfile->fd != -1 && note_relevant_procfile (procfile) != 0)
+	    return -1;
 	}
     }
   return 0;
 }
 
+static int
+note_relevant_procfile (procfile)
+     ProcFile procfile;
+{
+  if (n_relevant == max_relevant)
+    {
+      unsigned max = max_relevant ? max_relevant * 2 : 8;
+      ProcFile *new_relevant;
+
+      if ((new_relevant = realloc (relevant, max * sizeof (ProcFile))) == 0)
+	{
+	  fprintf (stderr, "Out of memory\n");
+	  return -1;
+	}
+      relevant = new_relevant;
+      max_relevant = max;
+    }
+  relevant[n_relevant++] = procfile;
+  return 0;
+}
+
+/* Look for namespaces that have come or gone, if that has not been
+   done for a while, and open the files of new ones.  Files are opened
+   once per namespace and then only rewound, like those of procfiles[]
+   normally are. */
+static int
+update_netns (p)
+     Preferences p;
+{
+  time_t now = time (0);
+  NetNs ns;
+
+  if (namespaces != 0 && now - netns_scan_time < NETNS_SCAN_INTERVAL)
+    return 0;
+  netns_scan_time = now;
+  if (scan_netns (&namespaces, forget_netns, 0) != 0)
+    return -1;
+  for (ns = namespaces; ns != 0; ns = ns->next)
+    {
+      if (ns->data == 0 && attach_netns (ns, p) == 0 && p->debug)
+	fprintf (stderr, "Watching network namespace %s\n", ns->label);
+    }
+  return 0;
+}
+
+/* Give NS its own copy of procfiles[], with the relevant files open.
+   If some file cannot be opened, NS is left alone, to be tried again
+   after the next scan. */
+static int
+attach_netns (ns, p)
+     NetNs ns;
+     Preferences p;
+{
+  ProcFile files, procfile;
+  const char *name;
+  char *pathname;
+  size_t len;
+
+  if ((files = malloc (sizeof procfiles)) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      return -1;
+    }
+  memcpy (files, procfiles, sizeof procfiles);
+  ns->data = files;
+  for (procfile = files; procfile->pathname != 0; ++procfile)
+    {
+      procfile->fd = -1;
+      procfile->reader = 0;
+      procfile->netns = ns;
+      name = strrchr (procfile->pathname, '/') + 1;
+      len = strlen (ns->label) + strlen (procfile->pathname) + 2;
+      if ((pathname = malloc (len)) == 0)
+	{
+	  fprintf (stderr, "Out of memory\n");
+	  procfile->pathname = 0;
+	  forget_netns (ns, 0);
+	  return -1;
+	}
+      snprintf (pathname, len, "%s:%s", ns->label, procfile->pathname);
+      procfile->pathname = pathname;
+      if (relevant_procfile_p (procfile, p)
+	  && (procfile->fd = open_netns_file (ns, name)) == -1)
+	{
+	  /* Cut the table after this file, so that forget_netns()
+	     only frees what has been set up. */
+	  procfile[1].pathname = 0;
+	  forget_netns (ns, 0);
+	  return -1;
+	}
+    }
+  return 0;
+}
+
+static void
+forget_netns (ns, closure)
+     NetNs ns;
+     void *closure;
+{
+  ProcFile procfile;
+
+  if (ns->data == 0)
+    return;
+  for (procfile = (ProcFile) ns->data; procfile->pathname != 0; ++procfile)
+    {
+      if (procfile->fd != -1)
+	close (procfile->fd);
+      if (procfile->reader != 0)
+	destroy_line_reader (procfile->reader);
+      free ((char *) procfile->pathname);
+    }
+  free (ns->data);
+  ns->data = 0;
+}
+
 static int
 relevant_procfile_p (procfile, p)
      ProcFile procfile;
@@ -154,16 +639,45 @@ parse_proc_file (procfile, p, callback, closure)
      void *closure;
 {
   int fd;
-  struct stat st;
-  char buf[BUFSIZE];
-  ssize_t len;
-  struct timeval tv;
+  ProcLineContextRec ctx;
 
-  if (gettimeofday (&tv, 0) == -1)
+  if (procfile->reader == 0
+      && (procfile->reader = make_line_reader (READ_CHUNK)) == 0)
+    return -1;
+  if ((fd = open_proc_file (procfile)) == -1)
+    return -1;
+  ctx.procfile = procfile;
+  ctx.p = p;
+  ctx.callback = callback;
+  ctx.closure = closure;
+  ctx.whole_file = 0;
+  ctx.lineno = 0;
+  errno = 0;
+  if (read_lines (procfile->reader, fd, parse_proc_line, &ctx) == -1)
     {
-      fprintf (stderr, "Failed to get time of day\n");
+      if (errno != 0)
+	fprintf (stderr, "Error reading from %s: %s\n",
+		 procfile->pathname, strerror (errno));
       return -1;
     }
+  if (ctx.lineno == 0)
+    {
+      fprintf (stderr, "No header line in %s\n", procfile->pathname);
+      return -1;
+    }
+  /* Only socket lines count, as in parse_proc_chunk(). */
+  note_lines (ctx.lineno - 1);
+  return finish_proc_file (procfile, p);
+}
+
+/* Return a descriptor for PROCFILE positioned at the start, opening
+   the file if it is not open yet. */
+static int
+open_proc_file (procfile)
+     ProcFile procfile;
+{
+  int fd;
+
   if ((fd = procfile->fd) == -1)
     {
       fd = open (procfile->pathname, 0);
@@ -187,106 +701,17 @@ parse_proc_file (procfile, p, callback, closure)
 	  return -1;
 	}
     }
-  if (stat (procfile->pathname, &st) == -1)
-    {
-      fprintf (stderr, "stat() error for %s: %s\n",
-	       procfile->pathname, strerror (errno));
-      return -1;
-    }
-  {
-    const char *cp = buf;
-    char *read_pointer = buf;
-    const char *lim, *tokstart, *linestart;
-    size_t total_len = 0;
-
-    while ((BUFSIZE > total_len)
-	   && ((len = read (fd, read_pointer, BUFSIZE - total_len)) > 0)) {
-      total_len += len;
-      read_pointer += len;
-    }
+  return fd;
+}
 
-    if (len < 0 || total_len == 0)
-      {
-	fprintf (stderr, "Error reading from %s: %s\n",
-		 procfile->pathname, strerror (errno));
-	return -1;
-      }
-
-    len = total_len;
-
-    lim = buf + len;
-
-    /* Parse header line */
-    linestart = cp;
-    skip_spaces (&cp, lim);
-    while (cp < lim && *cp != '\n')
-      {
-	tokstart = cp;
-	while (cp < lim && *cp != '\n' && *cp != ' ')
-	  ++cp;
-	if (p->debug)
-	  {
-	    fprintf (stderr, "%2d: %*.*s\n",
-		     (int) (tokstart-linestart),
-		     (int) (cp-tokstart), (int) (cp-tokstart), tokstart);
-	  }
-	skip_spaces (&cp, lim);
-      }
-    if (cp >= lim)
-      {
-	fprintf (stderr, "Header line too long\n");
-	return -1;
-      }
-    else
-      {
-	++cp;			/* skip newline */
-      }
-
-    /* Parse more lines... */
-    for (;;)
-      {
-	linestart = cp;
-	while (cp < lim && *cp != '\n') ++cp;
-	if (cp >= lim)
-	  {
-	    if (linestart == buf)
-	      {
-		fprintf (stderr, "Cannot buffer\n");
-		return -1;
-	      }
-	    else
-	      {
-		memcpy (buf, linestart, lim-linestart);
-		cp -= (linestart - buf);
-		linestart = buf;
-		len = read (fd, (char *) cp, BUFSIZE - (cp - buf));
-		if (len <= 0)
-		  {
-		    fprintf (stderr, "Error reading from %s: %s\n",
-			     procfile->pathname, strerror (errno));
-		    return -1;
-		  }
-		lim = cp + len;
-	      }
-	  }
-	while (cp < lim && *cp != '\n') ++cp;
-	if (cp >= lim)
-	  {
-	    fprintf (stderr, "Failed to read newline\n");
-	    return -1;
-	  }
-	if (parse_proc_line (linestart, cp, &tv, p, callback, closure) == -1)
-	  {
-	    return -1;
-	  }
-	++cp;
-	if (cp == lim)
-	  break;
-      }
-  }
+static int
+finish_proc_file (procfile, p)
+     ProcFile procfile;
+     Preferences p;
+{
   if (p->close_proc_after_reading)
     {
-      if (close (fd) == -1)
+      if (close (procfile->fd) == -1)
 	{
 	  fprintf (stderr, "Error closing %s: %s\n",
 		   procfile->pathname, strerror (errno));
@@ -297,256 +722,264 @@ parse_proc_file (procfile, p, callback, closure)
   return 0;
 }
 
-static int
-parse_proc_line (start, end, tv, p, callback, closure)
+static void
+parse_header_line (start, end, p)
      const char *start, *end;
-     const struct timeval *tv;
      Preferences p;
-     SockEntryCallback callback;
+{
+  const char *cp = start, *tokstart;
+
+  if (!p->debug)
+    return;
+  skip_spaces (&cp, end);
+  while (cp < end)
+    {
+      tokstart = cp;
+      while (cp < end && *cp != ' ')
+	++cp;
+      fprintf (stderr, "%2d: %*.*s\n",
+	       (int) (tokstart-start),
+	       (int) (cp-tokstart), (int) (cp-tokstart), tokstart);
+      skip_spaces (&cp, end);
+    }
+}
+
+/* After the "sl" column, all fields up to the queue sizes have fixed
+   width:
+
+     sl: LOCAL:PORT REMOTE:PORT ST TX_QUEUE:RX_QUEUE ...
+
+   where the addresses have 8 (IPv4) or 32 (IPv6) hex digits.  The
+   queue sizes are therefore read first, and lines that cannot reach
+   the threshold are dropped before anything else is decoded.  Most
+   sockets on a busy host are idle, so for most lines this is all the
+   work that is done.  With --drops, the drop count that ends the
+   lines of UDP sockets is read too, from the end of the line, and
+   sockets that have dropped packets are kept whatever their queue
+   sizes. */
+static int
+parse_proc_line (start, end, closure)
+     const char *start, *end;
      void *closure;
 {
-  const char *cp = start;
-  const char *sl_s, *sl_e;		/* internal hash */
+  ProcLineContext ctx = (ProcLineContext) closure;
+  ProcFile procfile = ctx->procfile;
+  Preferences p = ctx->p;
+  const char *cp;
+  const char *la, *ra, *qs;
+  const int width = (procfile->af == AF_INET6) ? 32 : 8;
   ProcFileEntryRec pfe;
-  const char *st_s, *st_e;		/* internal status */
+  LineReader lr = procfile->reader;
+  uint64_t start_ns, end_ns;
+  struct timeval tv;
 
-  skip_spaces (&cp, end);
-  if (parse_dec (&cp, end, &sl_s, &sl_e) == -1)
-    return -1;
-  sl_s = cp;
-  while (cp < end && isdigit (*cp))
-    ++cp;
-  sl_e = cp;
-  if (skip_colon (&cp, end) == -1)
-    return -1;
-  ++cp;
-  skip_spaces (&cp, end);
-  if (parse_sockaddr (&cp, end, &(pfe.la)) == -1)
+  if (ctx->lineno++ == 0)
+    {
+      parse_header_line (start, end, p);
+      return 0;
+    }
+  if ((cp = memchr (start, ':', end - start)) == 0)
+    {
+      fprintf (stderr, "`:' expected\n");
+      return -1;
+    }
+  la = cp + 2;
+  ra = la + width + 6;
+  qs = ra + width + 6 + 3;
+  if (end - qs < 17
+      || la[-1] != ' ' || ra[-1] != ' ' || qs[-4] != ' ' || qs[-1] != ' '
+      || qs[8] != ':')
+    {
+      fprintf (stderr, "Malformed line in %s\n", procfile->pathname);
+      return -1;
+    }
+  if (parse_hex_u32 (&qs, end, &(pfe.oq)) == -1)
     return -1;
-  skip_spaces (&cp, end);
-  if (parse_sockaddr (&cp, end, &(pfe.ra)) == -1)
+  ++qs;
+  if (parse_hex_u32 (&qs, end, &(pfe.iq)) == -1)
     return -1;
-  skip_spaces (&cp, end);
+  pfe.drops = 0;
+  /* With --drops, every UDP socket counts towards the summary of the
+     round, whatever its queues hold. */
+  if (p->want_drops && procfile->proto == IPPROTO_UDP)
+    {
+      if (parse_drops (qs, end, &(pfe.drops)) == -1)
+	return -1;
+    }
+  else if (!((p->want_input && (pfe.iq >= p->filter_threshold))
+	     || (p->want_output && (pfe.oq >= p->filter_threshold))))
+    return 0;
+
   if (p->specific_port)
     {
-      if (((struct sockaddr *) &(pfe.la))->sa_family == AF_INET)
-	{
-	  if (ntohs (((struct sockaddr_in *) &(pfe.la))->sin_port) != p->portno
-	      && ntohs (((struct sockaddr_in *) &(pfe.ra))->sin_port) != p->portno)
-	    {
-	      return 0;
-	    }
-	}
-      else if (((struct sockaddr *) &(pfe.la))->sa_family == AF_INET6)
+      uint16_t lport, rport;
+
+      if (hex_decode_4 (la + width + 1, &lport) == -1
+	  || hex_decode_4 (ra + width + 1, &rport) == -1)
 	{
-	  if (ntohs (((struct sockaddr_in6 *) &(pfe.la))->sin6_port) != p->portno
-	      && ntohs (((struct sockaddr_in6 *) &(pfe.ra))->sin6_port) != p->portno)
-	    {
-	      return 0;
-	    }
+	  fprintf (stderr, "Malformed port number\n");
+	  return -1;
 	}
+      if (lport != p->portno && rport != p->portno)
+	return 0;
     }
-  if (parse_hex (&cp, end, &st_s, &st_e) == -1)
-    return -1;
-  skip_spaces (&cp, end);
-  if (parse_hex_u32 (&cp, end, &(pfe.oq)) == -1)
+
+  if (parse_inode (qs, end, &(pfe.inode)) == -1)
     return -1;
-  if (skip_colon (&cp, end) == -1)
+  cp = la;
+  if (parse_sockaddr (&cp, end, procfile->af, &(pfe.la)) == -1)
     return -1;
-  if (parse_hex_u32 (&cp, end, &(pfe.iq)) == -1)
+  cp = ra;
+  if (parse_sockaddr (&cp, end, procfile->af, &(pfe.ra)) == -1)
     return -1;
-  (* callback) (&pfe, tv, closure);
+  pfe.proto = procfile->proto;
+  pfe.netns = procfile->netns ? procfile->netns->label : 0;
+  if (ctx->whole_file)
+    line_read_time (lr, start - lr->buf, end - lr->buf, &start_ns, &end_ns);
+  else
+    {
+      start_ns = lr->line_start_ns;
+      end_ns = lr->line_end_ns;
+    }
+  stamp_entry (&pfe, start_ns, end_ns);
+  timestamp_to_timeval (pfe.ts, &tv);
+  (* ctx->callback) (&pfe, &tv, ctx->closure);
 
   return 0;
 }
 
+/* Addresses are printed as %08X (IPv4) or four times %08X (IPv6),
+   followed by a colon and the port as %04X. */
 static int
-parse_sockaddr (cpp, end, ap)
+parse_sockaddr (cpp, end, af, ap)
      const char **cpp;
      const char *end;
+     int af;
      struct sockaddr_storage *ap;
 {
-  const char *as, *ae;
+  const char *cp = *cpp;
+  const int width = (af == AF_INET6) ? 32 : 8;
   uint16_t port;
-  if (parse_addr_port (cpp, end, &as, &ae, &port) == -1)
-    return -1;
-  if (ae-as == 8)
-    {
-      return convert_sockaddr_in (as, ae, port, (struct sockaddr_in *) ap);
-    }
-  else if (ae-as == 32)
+
+  if (end - cp < width + 5 || cp[width] != ':')
     {
-      return convert_sockaddr_in6 (as, ae, port, (struct sockaddr_in6 *) ap);
+      fprintf (stderr, "Malformed address, expected %d hex digits and `:'\n",
+	       width);
+      return -1;
     }
-  else
+  if (hex_decode_4 (cp + width + 1, &port) == -1)
     {
-      fprintf (stderr, "Unknown address length %d\n",
-	       (int) (ae-as));
+      fprintf (stderr, "Malformed port number\n");
       return -1;
     }
-}
+  if (af == AF_INET6)
+    {
+      struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) ap;
 
-static int
-convert_sockaddr_in (as, ae, port, ap)
-     const char *as;
-     const char *ae;
-     uint16_t port;
-     struct sockaddr_in *ap;
-{
-  const char *endp = ae;
-
-  memset (ap, 0, sizeof (struct sockaddr_in));
-  ap->sin_family = AF_INET;
-  ap->sin_port = htons (port);
-  ap->sin_addr.s_addr = strtoul (as, (char **) &endp, 16);
-  if (endp != ae)
-    {
-      fprintf (stderr, "Unexpected: %08lx %08lx %08lx\n",
-	       (unsigned long) as,
-	       (unsigned long) ae,
-	       (unsigned long) endp);
-      return -1;
+      memset (sin6, 0, sizeof (struct sockaddr_in6));
+      sin6->sin6_family = AF_INET6;
+      sin6->sin6_port = htons (port);
+      if ((* hex_decode_32) (cp, sin6->sin6_addr.s6_addr32) == -1)
+	{
+	  fprintf (stderr, "Malformed IPv6 address\n");
+	  return -1;
+	}
     }
-  return 0;
-}
-
-static int
-convert_sockaddr_in6 (as, ae, port, ap)
-     const char *as;
-     const char *ae;
-     uint16_t port;
-     struct sockaddr_in6 *ap;
-{
-  unsigned k;
-  char buf[33];
-
-  if (as + 32 != ae)
+  else
     {
-      fprintf (stderr, "Unexpected length of IPv6 address encoding: %d\n",
-	       (int) (ae-as));
-      return -1;
-    }
-  memset (ap, 0, sizeof (struct sockaddr_in6));
-  ap->sin6_family = AF_INET6;
-  ap->sin6_port = htons (port);
+      struct sockaddr_in *sin = (struct sockaddr_in *) ap;
 
-#define BYTES_PER_CHUNK 4
-#define CHUNKS_PER_ADDR 4
-  for (k = 0; k < CHUNKS_PER_ADDR; ++k)
-    {
-      memset (buf, 0, BYTES_PER_CHUNK * 2 + 1);
-      memcpy (buf, as + (k * BYTES_PER_CHUNK * 2), BYTES_PER_CHUNK * 2);
-      ap->sin6_addr.s6_addr32[k] = strtoul (buf, 0, 16);
+      memset (sin, 0, sizeof (struct sockaddr_in));
+      sin->sin_family = AF_INET;
+      sin->sin_port = htons (port);
+      if (hex_decode_8 (cp, &(sin->sin_addr.s_addr)) == -1)
+	{
+	  fprintf (stderr, "Malformed IPv4 address\n");
+	  return -1;
+	}
     }
+  *cpp = cp + width + 5;
   return 0;
 }
 
+/* Queue sizes are printed as %08X. */
 static int
-parse_addr_port (cpp, end, as, ae, pp)
+parse_hex_u32 (cpp, end, ulp)
      const char **cpp;
      const char *end;
-     const char **as, **ae;
-     uint16_t *pp;
+     uint32_t *ulp;
 {
   const char *cp = *cpp;
-  if (parse_hex (&cp, end, as, ae) == -1)
-    return -1;
-  if (cp >= end || *cp != ':')
+
+  if (end - cp < 8 || hex_decode_8 (cp, ulp) == -1)
     {
-      fprintf (stderr, "`:' expected\n");
+      fprintf (stderr, "Expected 8 hex digits\n");
       return -1;
     }
-  ++cp;
-  if (parse_hex_u16 (&cp, end, pp) == -1)
-    return -1;
-  *cpp = cp;
+  *cpp = cp + 8;
   return 0;
 }
 
+/* After the queue sizes come tr:tm->when, retrnsmt, uid, timeout and
+   inode, where the uid and timeout columns vary in width. */
 static int
-parse_hex_u32 (cpp, end, ulp)
-     const char **cpp;
+parse_inode (cp, end, inodep)
+     const char *cp;
      const char *end;
-     uint32_t *ulp;
+     uint32_t *inodep;
 {
-  const char *s, *e;
-  char *e2;
-  if (parse_hex (cpp, end, &s, &e) == -1)
-    return -1;
-  *ulp = strtoul (s, &e2, 16);
-  if (e2 != e)
+  uint32_t val = 0;
+  int k;
+
+  for (k = 0; k < 4; ++k)
     {
-      fprintf (stderr, "OUCH\n");
+      skip_spaces (&cp, end);
+      while (cp < end && *cp != ' ')
+	++cp;
+    }
+  skip_spaces (&cp, end);
+  if (cp == end || !isdigit (*cp))
+    {
+      fprintf (stderr, "Malformed inode number\n");
       return -1;
     }
+  while (cp < end && isdigit (*cp))
+    val = val * 10 + (*cp++ - '0');
+  *inodep = val;
   return 0;
 }
 
+/* UDP lines end with ref, pointer and drops, padded with spaces.
+   Only the last one is wanted, so it is read backwards from the end,
+   down to START, after the queue sizes. */
 static int
-parse_hex_u16 (cpp, end, usp)
-     const char **cpp;
+parse_drops (start, end, dropsp)
+     const char *start;
      const char *end;
-     uint16_t *usp;
+     uint32_t *dropsp;
 {
-  uint32_t ul;
-  if (parse_hex_u32 (cpp, end, &ul) == -1)
-    return -1;
-  *usp = (uint16_t) ul;
-  return 0;
-}
+  const char *cp = end;
+  uint32_t val = 0, scale = 1;
 
-static int
-parse_dec (cpp, end, s, e)
-     const char **cpp;
-     const char *end;
-     const char **s, **e;
-{
-  const char *cp = *cpp;
-  *s = cp;
-  while (cp < end && isdigit (*cp))
-    ++cp;
-  *e = cp;
-  if (s == e)
+  while (cp > start && cp[-1] == ' ')
+    --cp;
+  /* the usual case */
+  if (cp - start >= 2 && cp[-1] == '0' && cp[-2] == ' ')
     {
-      fprintf (stderr, "No digits found\n");
-      return -1;
+      *dropsp = 0;
+      return 0;
     }
-  *cpp = cp;
-  return 0;
-}
-
-static int
-parse_hex (cpp, end, s, e)
-     const char **cpp;
-     const char *end;
-     const char **s, **e;
-{
-  const char *cp = *cpp;
-  *s = cp;
-  while (cp < end && isxdigit (*cp))
-    ++cp;
-  *e = cp;
-  if (s == e)
+  if (cp == start || cp[-1] < '0' || cp[-1] > '9')
     {
-      fprintf (stderr, "No hex digits found\n");
+      fprintf (stderr, "Malformed drop count\n");
       return -1;
     }
-  *cpp = cp;
-  return 0;
-}
-
-static int
-skip_colon (cpp, end)
-     const char **cpp;
-     const char *end;
-{
-  const char *cp = *cpp;
-  if (cp >= end || *cp != ':')
+  while (cp > start && cp[-1] >= '0' && cp[-1] <= '9')
     {
-      fprintf (stderr, "`:' expected\n");
-      return -1;
+      val += (*--cp - '0') * scale;
+      scale *= 10;
     }
-  *cpp = cp + 1;
+  *dropsp = val;
   return 0;
 }
 
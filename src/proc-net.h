@@ -8,6 +8,7 @@
 #ifndef __QUI_PROC_NET_H__
 #define __QUI_PROC_NET_H__ 1
 
+#include <stdint.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
@@ -19,6 +20,13 @@ typedef struct ProcFileEntry
   struct sockaddr_storage	ra;
   uint32_t			iq;
   uint32_t			oq;
+  int				proto;
+  uint32_t			inode;	/* of the socket, 0 if unknown */
+  const char		       *netns;	/* label, with --all-netns */
+  uint64_t			ts;	/* CLOCK_MONOTONIC, nanoseconds */
+  uint32_t			ts_error; /* max. nanoseconds ts is off */
+  uint32_t			drops;	/* UDP, with --drops: packets the
+					   socket has dropped so far */
 }
 ProcFileEntryRec;
 
@@ -0,0 +1,151 @@
+/*
+ publish.c
+
+ Date Created: Sat Oct 17 23:59:51 2026
+
+ Publishing each round in a shared-memory segment
+
+ With --publish NAME, qui creates the POSIX shared-memory object
+ /NAME, laid out as described in snapshot.h, and writes every socket
+ it sees in a round into the half of it that readers are not looking
+ at.  At the end of the round, the generation counter is advanced,
+ which makes that half current.  Readers on the same host can map the
+ segment and read the latest round without any system calls; see
+ snapshot-reader.c for how they know that what they read was
+ consistent.  So several programs that want the queue sizes of all
+ sockets can share the cost of one reading of /proc/net, with
+ --threshold 0.
+
+ The segment has room for --max-sockets sockets in each half; sockets
+ beyond that are counted as dropped.  It is removed when qui exits.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "history.h"
+#include "sock-table.h"
+#include "timestamp.h"
+#include "snapshot.h"
+#include "publish.h"
+
+static char shm_name[256];
+static SnapshotHeaderRec *header = 0;
+static SnapshotEntryRec *arrays = 0;
+static size_t segment_size = 0;
+
+/* Used by the sampling thread only: the half being written. */
+static SnapshotHalfRec *half;
+static SnapshotEntryRec *entries;
+static unsigned n_entries = 0;
+static unsigned n_dropped = 0;
+
+int
+init_publisher (p)
+     Preferences p;
+{
+  size_t header_size = (sizeof (SnapshotHeaderRec) + 63) & ~(size_t) 63;
+  void *base;
+  int fd;
+
+  snprintf (shm_name, sizeof shm_name, "%s%s",
+	    p->publish_name[0] == '/' ? "" : "/", p->publish_name);
+  segment_size = header_size + 2 * (size_t) p->max_sockets
+    * sizeof (SnapshotEntryRec);
+  /* An old segment may still be mapped by readers; they keep it
+     until they open the new one. */
+  shm_unlink (shm_name);
+  if ((fd = shm_open (shm_name, O_RDWR | O_CREAT | O_EXCL, 0644)) == -1)
+    {
+      fprintf (stderr, "Cannot create shared memory %s: %s\n",
+	       shm_name, strerror (errno));
+      return -1;
+    }
+  if (ftruncate (fd, segment_size) == -1
+      || (base = mmap (0, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       fd, 0)) == MAP_FAILED)
+    {
+      fprintf (stderr, "Cannot map shared memory %s: %s\n",
+	       shm_name, strerror (errno));
+      close (fd);
+      shm_unlink (shm_name);
+      return -1;
+    }
+  close (fd);
+  header = (SnapshotHeaderRec *) base;
+  arrays = (SnapshotEntryRec *) ((char *) base + header_size);
+  header->version = SNAPSHOT_VERSION;
+  header->header_size = header_size;
+  header->entry_size = sizeof (SnapshotEntryRec);
+  header->capacity = p->max_sockets;
+  header->writer_pid = getpid ();
+  header->generation = 0;
+  __atomic_store_n (&header->magic, SNAPSHOT_MAGIC, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Start filling the half that is not current. */
+void
+begin_publisher_round ()
+{
+  unsigned k = (header->generation + 1) & 1;
+
+  /* Readers that still look at this half must see the new generation
+     if they see any of what is written to it now. */
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  half = &header->halves[k];
+  entries = arrays + (size_t) k * header->capacity;
+  half->round = header->generation + 1;
+  half->start_ns = monotonic_ns ();
+  n_entries = n_dropped = 0;
+}
+
+void
+update_publisher (pfe)
+     ProcFileEntry pfe;
+{
+  SnapshotEntryRec *e;
+
+  if (n_entries == header->capacity)
+    {
+      ++n_dropped;
+      return;
+    }
+  e = &entries[n_entries++];
+  /* The entry starts with the same fields as a SockKeyRec. */
+  sock_key_from_entry ((SockKey) e, pfe);
+  e->iq = pfe->iq;
+  e->oq = pfe->oq;
+  e->ts = pfe->ts;
+  e->ts_error = pfe->ts_error;
+}
+
+/* Make the half current. */
+void
+end_publisher_round ()
+{
+  half->n_entries = n_entries;
+  half->n_dropped = n_dropped;
+  __atomic_store_n (&header->generation, header->generation + 1,
+		    __ATOMIC_RELEASE);
+}
+
+/* Tell readers that there will be no more rounds, and remove the
+   segment. */
+void
+finish_publisher ()
+{
+  __atomic_store_n (&header->magic, 0, __ATOMIC_RELEASE);
+  munmap (header, segment_size);
+  shm_unlink (shm_name);
+}
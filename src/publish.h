@@ -0,0 +1,16 @@
+/*
+ publish.h
+
+ Date Created: Sat Oct 17 23:59:51 2026
+ */
+
+#ifndef __QUI_PUBLISH_H__
+#define __QUI_PUBLISH_H__ 1
+
+extern int init_publisher (Preferences);
+extern void begin_publisher_round (void);
+extern void update_publisher (ProcFileEntry);
+extern void end_publisher_round (void);
+extern void finish_publisher (void);
+
+#endif /* not __QUI_PUBLISH_H__ */
@@ -0,0 +1,296 @@
+/*
+ qui-bench.c
+
+ Date Created: Sat Oct 17 20:02:44 2026
+
+ Benchmark the /proc/net parser, the threshold filter and the output
+ path
+
+ Usage: qui-bench [QUI-OPTIONS] [ROUNDS]
+
+ reads the /proc/net tables ROUNDS times (default 10) for each of
+ three phases, normally from a --proc-root generated by qui-gen, and
+ reports lines per second, nanoseconds per line and allocations per
+ round:
+
+ parse:  with a threshold of 0, so that every line is decoded and
+	 handed to a callback that just counts it;
+ filter: with the threshold from the options, as qui does it;
+ output: with a threshold of 0, every socket is formatted and
+	 written to /dev/null by the output thread.  The output thread
+	 is waited for at the end of each round, and whenever the ring
+	 is full, so that nothing is dropped and its work is included
+	 in the time.
+
+ Each phase starts with a round that is not measured.  The options are
+ those of qui, so -P N measures the parser with N threads, and -m,
+ -b etc. change the output format.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "preferences.h"
+#include "parse-args.h"
+#include "proc-net.h"
+#include "hex.h"
+#include "output.h"
+#include "timestamp.h"
+
+/* records in the output ring, at most */
+#define MAX_OUTPUT_BUFFER (1024 * 1024)
+
+typedef struct PhaseResultRec *PhaseResult;
+
+typedef struct PhaseResultRec
+{
+  unsigned long	lines;		/* selected per round */
+  double	seconds;
+  unsigned long	allocations;
+}
+PhaseResultRec;
+
+static int run_phase (const char *, Preferences, unsigned, int,
+		      unsigned long);
+static int run_rounds (Preferences, unsigned, int, PhaseResult);
+static void count_entry (ProcFileEntry, const struct timeval *, void *);
+static void output_each_entry (ProcFileEntry, const struct timeval *, void *);
+static double now (void);
+
+extern void *__libc_malloc (size_t);
+extern void *__libc_calloc (size_t, size_t);
+extern void *__libc_realloc (void *, size_t);
+extern void *__libc_memalign (size_t, size_t);
+
+/* Allocations by any thread since the program started.  malloc(),
+   calloc(), realloc() and posix_memalign(), which the line reader and
+   the rings use, are replaced by versions that count calls, and hand
+   them on to the C library's allocator. */
+static unsigned long allocations = 0;
+
+/* records that fit into the output ring */
+static unsigned long output_batch = 0;
+
+int
+main (argc, argv)
+     int argc;
+     char **argv;
+{
+  PreferencesRec p;
+  PhaseResultRec warmup;
+  unsigned long table_lines;
+  unsigned rounds = 10;
+  unsigned threshold;
+  char *end;
+
+  parse_args (argc, argv, &p);
+  if (optind < argc)
+    {
+      rounds = strtoul (argv[optind], &end, 10);
+      if (end == argv[optind] || *end != 0 || rounds < 1
+	  || optind + 1 < argc)
+	{
+	  fprintf (stderr, "Usage: %s [QUI-OPTIONS] [ROUNDS]\n", argv[0]);
+	  return 1;
+	}
+    }
+  if (p.collect_method != COLLECT_PROC || p.want_events || p.want_peaks
+      || p.replay_file || p.record_file)
+    {
+      fprintf (stderr, "Only the /proc/net parser can be measured, "
+	       "without --events, --peaks, --record and --replay\n");
+      return 1;
+    }
+  init_timestamps ();
+  init_hex_decoder ();
+  threshold = p.filter_threshold;
+  p.filter_threshold = 0;
+  if (run_rounds (&p, 1, 0, &warmup) != 0)
+    return 1;
+  table_lines = warmup.lines;
+  printf ("%lu lines per round, %u rounds, %s hex decoder, %u threads\n",
+	  table_lines, rounds, hex_decoder_name (), p.n_threads);
+  printf ("%-8s %12s %12s %10s %14s\n",
+	  "phase", "selected", "lines/s", "ns/line", "allocs/round");
+  fflush (stdout);
+  if (run_phase ("parse", &p, rounds, 0, table_lines) != 0)
+    return 1;
+  p.filter_threshold = threshold;
+  if (run_phase ("filter", &p, rounds, 0, table_lines) != 0)
+    return 1;
+  p.filter_threshold = p.threshold = 0;
+  if (run_phase ("output", &p, rounds, 1, table_lines) != 0)
+    return 1;
+  return 0;
+}
+
+/* Measure ROUNDS rounds after a warm-up round, and print one line of
+   results, where rates are relative to all TABLE_LINES lines read. */
+static int
+run_phase (name, p, rounds, output, table_lines)
+     const char *name;
+     Preferences p;
+     unsigned rounds;
+     int output;
+     unsigned long table_lines;
+{
+  PhaseResultRec result;
+  double per_line;
+  int saved_stdout = -1, devnull;
+
+  if (output)
+    {
+      fflush (stdout);
+      if ((saved_stdout = dup (STDOUT_FILENO)) == -1
+	  || (devnull = open ("/dev/null", O_WRONLY)) == -1
+	  || dup2 (devnull, STDOUT_FILENO) == -1)
+	{
+	  fprintf (stderr, "Cannot redirect output to /dev/null: %s\n",
+		   strerror (errno));
+	  return -1;
+	}
+      close (devnull);
+      /* Room for a whole round, up to a point; with larger tables,
+	 output_each_entry() lets the writer catch up when the ring is
+	 full. */
+      if (p->output_buffer < table_lines)
+	p->output_buffer = table_lines < MAX_OUTPUT_BUFFER
+	  ? table_lines : MAX_OUTPUT_BUFFER;
+      output_batch = p->output_buffer;
+      if (init_output (p) != 0)
+	return -1;
+    }
+  if (run_rounds (p, 1, output, &result) != 0
+      || run_rounds (p, rounds, output, &result) != 0)
+    return -1;
+  if (output)
+    {
+      finish_output ();
+      if (dup2 (saved_stdout, STDOUT_FILENO) == -1)
+	{
+	  fprintf (stderr, "Cannot restore output: %s\n", strerror (errno));
+	  return -1;
+	}
+      close (saved_stdout);
+    }
+  per_line = result.seconds / ((double) rounds * table_lines);
+  printf ("%-8s %12lu %12.0f %10.1f %14.1f\n",
+	  name, result.lines, 1 / per_line, per_line * 1e9,
+	  (double) result.allocations / rounds);
+  fflush (stdout);
+  return 0;
+}
+
+/* With OUTPUT, entries are passed to the output thread. */
+static int
+run_rounds (p, rounds, output, result)
+     Preferences p;
+     unsigned rounds;
+     int output;
+     PhaseResult result;
+{
+  unsigned long n_lines = 0, start_allocations;
+  double start;
+  unsigned k;
+
+  start_allocations = __atomic_load_n (&allocations, __ATOMIC_RELAXED);
+  start = now ();
+  for (k = 0; k < rounds; ++k)
+    {
+      n_lines = 0;
+      if (parse_proc_files (p, output ? output_each_entry : count_entry,
+			    &n_lines) != 0)
+	return -1;
+      if (output)
+	wait_for_output ();
+    }
+  result->seconds = now () - start;
+  result->allocations
+    = __atomic_load_n (&allocations, __ATOMIC_RELAXED) - start_allocations;
+  result->lines = n_lines;
+  return 0;
+}
+
+static void
+count_entry (pfe, tv, closure)
+     ProcFileEntry pfe;
+     const struct timeval *tv;
+     void *closure;
+{
+  ++*(unsigned long *) closure;
+}
+
+static void
+output_each_entry (pfe, tv, closure)
+     ProcFileEntry pfe;
+     const struct timeval *tv;
+     void *closure;
+{
+  unsigned long *n_lines = (unsigned long *) closure;
+
+  output_entry (pfe, tv, 0, 0, 0, 0);
+  if (++*n_lines % output_batch == 0)
+    wait_for_output ();
+}
+
+static double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void *
+malloc (size)
+     size_t size;
+{
+  __atomic_add_fetch (&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_malloc (size);
+}
+
+void *
+calloc (nmemb, size)
+     size_t nmemb;
+     size_t size;
+{
+  __atomic_add_fetch (&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (ptr, size)
+     void *ptr;
+     size_t size;
+{
+  __atomic_add_fetch (&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_realloc (ptr, size);
+}
+
+int
+posix_memalign (memptr, alignment, size)
+     void **memptr;
+     size_t alignment;
+     size_t size;
+{
+  void *ptr;
+
+  if (alignment < sizeof (void *) || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+  __atomic_add_fetch (&allocations, 1, __ATOMIC_RELAXED);
+  if ((ptr = __libc_memalign (alignment, size)) == 0)
+    return ENOMEM;
+  *memptr = ptr;
+  return 0;
+}
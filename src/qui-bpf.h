@@ -0,0 +1,57 @@
+/*
+ qui-bpf.h
+
+ Date Created: Sat Oct 17 10:02:18 2026
+
+ Records shared between the BPF programs and the user-space code.
+ This file is included from both sides, so it may only use the
+ kernel's __u8/__u16/__u32 types.
+ */
+
+#ifndef __QUI_QUI_BPF_H__
+#define __QUI_QUI_BPF_H__ 1
+
+/* Filter settings, stored in the single element of the `qui_config'
+   array map. */
+struct QuiBpfConfig
+{
+  __u32		threshold;
+  __u8		want_input;
+  __u8		want_output;
+  __u8		want_ipv4;
+  __u8		want_ipv6;
+  __u8		specific_port;
+  __u8		pad;
+  __u16		portno;		/* host byte order */
+};
+
+/* Identifies a socket.  Ports and addresses are in network byte
+   order, IPv4 addresses only use the first word. */
+struct QuiBpfKey
+{
+  __u16		family;
+  __u16		proto;
+  __u16		sport;
+  __u16		dport;
+  __u32		saddr[4];
+  __u32		daddr[4];
+};
+
+/* What the socket iterators write for each socket that passes the
+   filter. */
+struct QuiBpfEntry
+{
+  struct QuiBpfKey key;
+  __u32		iq;
+  __u32		oq;
+};
+
+/* Per-socket receive queue high-water mark, kept by the enqueue
+   probes in the `qui_peaks' map until user space collects it. */
+struct QuiBpfPeak
+{
+  __u32		peak;
+  __u32		full;		/* enqueues refused for lack of space */
+};
+
+#endif /* not __QUI_QUI_BPF_H__ */
@@ -0,0 +1,366 @@
+/*
+ qui-gen.c
+
+ Date Created: Sat Oct 17 19:36:05 2026
+
+ Generate synthetic /proc/net/{udp,tcp}{,6} tables for benchmarking
+
+ Usage: qui-gen [-n ENTRIES] [-q FRACTION] [-d DISTRIBUTION] [-m BYTES]
+		[-s SEED] [-T] [-U] [-4] [-6] DIR
+
+ writes DIR/net/tcp etc. with ENTRIES sockets each, in the same
+ format as the kernel, so that qui can read them with --proc-root
+ DIR.  A FRACTION of the sockets (default 0.01) have data queued,
+ with sizes drawn from DISTRIBUTION (uniform, exponential or pareto)
+ with a mean of BYTES (default 4096); the others have empty queues.
+ TCP tables have a few listening sockets and a mix of established
+ and TIME_WAIT connections; UDP sockets are mostly unconnected.  The
+ output only depends on the arguments, including SEED.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <netinet/in.h>
+
+typedef enum
+{
+  DIST_UNIFORM,
+  DIST_EXPONENTIAL,
+  DIST_PARETO
+}
+Distribution;
+
+typedef struct GenParamsRec *GenParams;
+
+typedef struct GenParamsRec
+{
+  unsigned long	n_entries;
+  double	busy_fraction;
+  Distribution	dist;
+  double	mean;
+  uint64_t	state;		/* of the random number generator */
+}
+GenParamsRec;
+
+/* TCP socket states, as in include/net/tcp_states.h */
+#define TCP_ESTABLISHED	0x01
+#define TCP_TIME_WAIT	0x06
+#define TCP_CLOSE	0x07
+#define TCP_LISTEN	0x0A
+
+/* Queue sizes are capped at this. */
+#define MAX_QUEUE	(64 * 1024 * 1024)
+
+static int generate_table (const char *, const char *, int, int, GenParams);
+static void put_address (FILE *, int, uint32_t, int);
+static uint32_t queue_size (GenParams);
+static uint64_t next_random (GenParams);
+static double uniform_random (GenParams);
+static void usage (const char *);
+
+int
+main (argc, argv)
+     int argc;
+     char **argv;
+{
+  GenParamsRec gp;
+  int want_tcp = 0, want_udp = 0, want_ipv4 = 0, want_ipv6 = 0;
+  char *end, *dir;
+  int opt;
+
+  gp.n_entries = 1000;
+  gp.busy_fraction = 0.01;
+  gp.dist = DIST_PARETO;
+  gp.mean = 4096;
+  gp.state = 1;
+  while ((opt = getopt (argc, argv, "n:q:d:m:s:TU46h")) != -1)
+    {
+      switch (opt) {
+      case 'T': want_tcp = 1; break;
+      case 'U': want_udp = 1; break;
+      case '4': want_ipv4 = 1; break;
+      case '6': want_ipv6 = 1; break;
+      case 'n':
+	gp.n_entries = strtoul (optarg, &end, 10);
+	if (end == optarg || *end != 0)
+	  {
+	    fprintf (stderr, "Malformed entry count %s\n", optarg);
+	    return 1;
+	  }
+	break;
+      case 'q':
+	gp.busy_fraction = strtod (optarg, &end);
+	if (end == optarg || *end != 0
+	    || gp.busy_fraction < 0 || gp.busy_fraction > 1)
+	  {
+	    fprintf (stderr, "Malformed fraction %s\n", optarg);
+	    return 1;
+	  }
+	break;
+      case 'd':
+	if (strcmp (optarg, "uniform") == 0)
+	  gp.dist = DIST_UNIFORM;
+	else if (strcmp (optarg, "exponential") == 0)
+	  gp.dist = DIST_EXPONENTIAL;
+	else if (strcmp (optarg, "pareto") == 0)
+	  gp.dist = DIST_PARETO;
+	else
+	  {
+	    fprintf (stderr, "Unknown distribution %s\n", optarg);
+	    return 1;
+	  }
+	break;
+      case 'm':
+	gp.mean = strtod (optarg, &end);
+	if (end == optarg || *end != 0 || gp.mean < 1)
+	  {
+	    fprintf (stderr, "Malformed mean queue size %s\n", optarg);
+	    return 1;
+	  }
+	break;
+      case 's':
+	gp.state = strtoull (optarg, &end, 10);
+	if (end == optarg || *end != 0)
+	  {
+	    fprintf (stderr, "Malformed seed %s\n", optarg);
+	    return 1;
+	  }
+	break;
+      default:
+	usage (argv[0]);
+	return opt == 'h' ? 0 : 1;
+      }
+    }
+  if (optind != argc - 1)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+  if (!want_tcp && !want_udp)
+    want_tcp = want_udp = 1;
+  if (!want_ipv4 && !want_ipv6)
+    want_ipv4 = want_ipv6 = 1;
+  /* xorshift gets stuck at zero */
+  gp.state = gp.state * 0x9e3779b97f4a7c15ULL + 1;
+  dir = argv[optind];
+  if ((mkdir (dir, 0755) == -1 && errno != EEXIST)
+      || (chdir (dir) == -1)
+      || (mkdir ("net", 0755) == -1 && errno != EEXIST))
+    {
+      fprintf (stderr, "Cannot create %s/net: %s\n", dir, strerror (errno));
+      return 1;
+    }
+  if ((want_udp && want_ipv4
+       && generate_table (dir, "net/udp", AF_INET, IPPROTO_UDP, &gp) != 0)
+      || (want_udp && want_ipv6
+	  && generate_table (dir, "net/udp6", AF_INET6, IPPROTO_UDP, &gp) != 0)
+      || (want_tcp && want_ipv4
+	  && generate_table (dir, "net/tcp", AF_INET, IPPROTO_TCP, &gp) != 0)
+      || (want_tcp && want_ipv6
+	  && generate_table (dir, "net/tcp6", AF_INET6, IPPROTO_TCP, &gp) != 0))
+    return 1;
+  return 0;
+}
+
+/* The header lines and line formats are those of tcp4_seq_show(),
+   tcp6_seq_show(), udp4_seq_show() and udp6_seq_show() in the kernel.
+   The IPv4 tables pad every line with spaces to a fixed width, the
+   IPv6 tables do not. */
+static int
+generate_table (dir, name, af, proto, gp)
+     const char *dir;
+     const char *name;
+     int af;
+     int proto;
+     GenParams gp;
+{
+  static char buf[1 << 20];
+  FILE *f;
+  unsigned long k;
+  int tcp = proto == IPPROTO_TCP;
+  int pad = af == AF_INET ? (tcp ? 149 : 127) : 0;
+  int len, state;
+  uint32_t tx, rx, host;
+  unsigned lport, rport;
+
+  if ((f = fopen (name, "w")) == 0)
+    {
+      fprintf (stderr, "Cannot create %s/%s: %s\n", dir, name, strerror (errno));
+      return -1;
+    }
+  setvbuf (f, buf, _IOFBF, sizeof buf);
+  if (af == AF_INET)
+    fprintf (f, "%-*s\n", pad,
+	     tcp ? "  sl  local_address rem_address   st tx_queue rx_queue tr "
+	     "tm->when retrnsmt   uid  timeout inode"
+	     : "   sl  local_address rem_address   st tx_queue rx_queue tr "
+	     "tm->when retrnsmt   uid  timeout inode ref pointer drops");
+  else
+    fprintf (f, "  sl  local_address                         remote_address"
+	     "                        st tx_queue rx_queue tr tm->when "
+	     "retrnsmt   uid  timeout inode%s\n",
+	     tcp ? "" : " ref pointer drops");
+  for (k = 0; k < gp->n_entries; ++k)
+    {
+      /* One socket in a thousand listens, or is a connected UDP
+	 socket; the rest are connections to many different hosts, or
+	 unconnected UDP sockets. */
+      if (k % 1000 == 0)
+	state = tcp ? TCP_LISTEN : TCP_ESTABLISHED;
+      else if (tcp)
+	state = (next_random (gp) % 8 == 0) ? TCP_TIME_WAIT : TCP_ESTABLISHED;
+      else
+	state = TCP_CLOSE;
+      tx = rx = 0;
+      if (state != TCP_TIME_WAIT && uniform_random (gp) < gp->busy_fraction)
+	{
+	  if (next_random (gp) % 2)
+	    rx = queue_size (gp);
+	  else
+	    tx = queue_size (gp);
+	}
+      host = next_random (gp);
+      lport = (state == TCP_LISTEN || !tcp) ? 1024 + k % 4096 : 443;
+      rport = 32768 + next_random (gp) % 28232;
+      len = fprintf (f, tcp ? "%4lu: " : "%5lu: ", k);
+      put_address (f, af, 0x0a000001, k % 7);
+      len += fprintf (f, ":%04X ", lport);
+      if (state == TCP_LISTEN || state == TCP_CLOSE)
+	put_address (f, af, 0, 0);
+      else
+	put_address (f, af, host, 0);
+      len += af == AF_INET ? 2 * 8 : 2 * 32;
+      len += fprintf (f, ":%04X %02X %08X:%08X ",
+		      (state == TCP_LISTEN || state == TCP_CLOSE) ? 0 : rport,
+		      state, tx, rx);
+      if (state == TCP_TIME_WAIT)
+	len += fprintf (f, "03:%08X 00000000     0        0 0 3 "
+			"0000000000000000",
+			(unsigned) (next_random (gp) % 6000));
+      else if (tcp)
+	len += fprintf (f, "%02X:%08X 00000000 %5u        0 %lu %d "
+			"0000000000000000 %u %u %u %u %d",
+			tx ? 1 : 0, tx ? 20 : 0, 1000, 100000 + k, 2,
+			state == TCP_LISTEN ? 100 : 20,
+			state == TCP_LISTEN ? 0 : 4, 31, 10,
+			state == TCP_LISTEN ? 4096 : -1);
+      else
+	len += fprintf (f, "00:00000000 00000000 %5u        0 %lu 2 "
+			"0000000000000000 %u",
+			1000, 100000 + k, 0);
+      if (len < pad)
+	fprintf (f, "%*s", pad - len, "");
+      putc ('\n', f);
+    }
+  if (fclose (f) == EOF)
+    {
+      fprintf (stderr, "Cannot write %s/%s: %s\n", dir, name, strerror (errno));
+      return -1;
+    }
+  return 0;
+}
+
+/* Addresses are printed like the kernel does: each 32-bit word of the
+   address in network byte order, taken as a host-order integer, with
+   %08X.  IPv4 addresses are in 10/8, IPv6 addresses in 2001:db8::/32,
+   with HOST in the lowest bits; an all-zero address is the
+   wildcard.  SUBNET varies the local address a little. */
+static void
+put_address (f, af, host, subnet)
+     FILE *f;
+     int af;
+     uint32_t host;
+     int subnet;
+{
+  uint32_t words[4];
+  uint8_t bytes[16];
+  int n = af == AF_INET6 ? 4 : 1;
+  int k;
+
+  memset (bytes, 0, sizeof bytes);
+  if (host != 0 || subnet != 0)
+    {
+      if (af == AF_INET6)
+	{
+	  bytes[0] = 0x20;
+	  bytes[1] = 0x01;
+	  bytes[2] = 0x0d;
+	  bytes[3] = 0xb8;
+	  bytes[7] = subnet;
+	  bytes[12] = host >> 24;
+	  bytes[13] = host >> 16;
+	  bytes[14] = host >> 8;
+	  bytes[15] = host;
+	}
+      else
+	{
+	  bytes[0] = 10;
+	  bytes[1] = (host >> 16) + subnet;
+	  bytes[2] = host >> 8;
+	  bytes[3] = host;
+	}
+    }
+  memcpy (words, bytes, n * 4);
+  for (k = 0; k < n; ++k)
+    fprintf (f, "%08X", (unsigned) words[k]);
+}
+
+static uint32_t
+queue_size (gp)
+     GenParams gp;
+{
+  double u = uniform_random (gp), size;
+
+  switch (gp->dist)
+    {
+    case DIST_UNIFORM:
+      size = 1 + u * (2 * gp->mean - 1);
+      break;
+    case DIST_EXPONENTIAL:
+      size = 1 - gp->mean * log (1 - u);
+      break;
+    default:
+      /* shape 1.5, heavy-tailed, with the given mean */
+      size = (gp->mean / 3) / pow (1 - u, 1 / 1.5);
+      break;
+    }
+  if (size < 1)
+    size = 1;
+  return size > MAX_QUEUE ? MAX_QUEUE : (uint32_t) size;
+}
+
+/* xorshift64* */
+static uint64_t
+next_random (gp)
+     GenParams gp;
+{
+  gp->state ^= gp->state >> 12;
+  gp->state ^= gp->state << 25;
+  gp->state ^= gp->state >> 27;
+  return (gp->state * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+/* in [0, 1) */
+static double
+uniform_random (gp)
+     GenParams gp;
+{
+  return next_random (gp) / 4294967296.0;
+}
+
+static void
+usage (progname)
+     const char *progname;
+{
+  fprintf (stderr, "Usage: %s [-n ENTRIES] [-q FRACTION]\n"
+	   "\t  [-d uniform|exponential|pareto] [-m BYTES] [-s SEED]\n"
+	   "\t  [-T] [-U] [-4] [-6] DIR\n",
+	   progname);
+}
@@ -0,0 +1,129 @@
+/*
+ qui-iter.bpf.c
+
+ Date Created: Sat Oct 17 10:05:51 2026
+
+ BPF socket iterators for TCP and UDP
+
+ These walk the kernel's socket tables and apply qui's filters
+ (address family, port, threshold on the selected queues) in the
+ kernel.  Only sockets that pass are written to the iterator's
+ seq_file, as fixed-size struct QuiBpfEntry records, so in steady
+ state a round copies almost nothing to user space.
+
+ The queue sizes are computed the same way as for /proc/net/tcp and
+ /proc/net/udp.
+ */
+
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+
+#include "qui-bpf.h"
+
+#define AF_INET		2
+#define AF_INET6	10
+#define IPPROTO_TCP	6
+#define IPPROTO_UDP	17
+
+char LICENSE[] SEC("license") = "GPL";
+
+struct
+{
+  __uint (type, BPF_MAP_TYPE_ARRAY);
+  __uint (max_entries, 1);
+  __type (key, __u32);
+  __type (value, struct QuiBpfConfig);
+} qui_config SEC(".maps");
+
+static __always_inline int
+emit_entry (struct seq_file *seq, const struct sock_common *skc,
+	    __u16 proto, __u32 iq, __u32 oq)
+{
+  const struct QuiBpfConfig *cfg;
+  struct QuiBpfEntry e = {};
+  __u32 key = 0;
+  __u16 family = skc->skc_family;
+  __u16 sport = skc->skc_num;
+  __u16 dport = bpf_ntohs (skc->skc_dport);
+
+  cfg = bpf_map_lookup_elem (&qui_config, &key);
+  if (!cfg)
+    return 0;
+  if (family == AF_INET && !cfg->want_ipv4)
+    return 0;
+  if (family == AF_INET6 && !cfg->want_ipv6)
+    return 0;
+  if (!((cfg->want_input && iq >= cfg->threshold)
+	|| (cfg->want_output && oq >= cfg->threshold)))
+    return 0;
+  if (cfg->specific_port && sport != cfg->portno && dport != cfg->portno)
+    return 0;
+
+  e.key.family = family;
+  e.key.proto = proto;
+  e.key.sport = bpf_htons (sport);
+  e.key.dport = skc->skc_dport;
+  if (family == AF_INET)
+    {
+      e.key.saddr[0] = skc->skc_rcv_saddr;
+      e.key.daddr[0] = skc->skc_daddr;
+    }
+  else
+    {
+      __builtin_memcpy (e.key.saddr, skc->skc_v6_rcv_saddr.in6_u.u6_addr32,
+			sizeof e.key.saddr);
+      __builtin_memcpy (e.key.daddr, skc->skc_v6_daddr.in6_u.u6_addr32,
+			sizeof e.key.daddr);
+    }
+  e.iq = iq;
+  e.oq = oq;
+  bpf_seq_write (seq, &e, sizeof e);
+  return 0;
+}
+
+SEC("iter/tcp")
+int
+dump_tcp (struct bpf_iter__tcp *ctx)
+{
+  struct sock_common *skc = ctx->sk_common;
+  struct tcp_sock *tp;
+  int rx_queue;
+
+  if (skc == (void *) 0)
+    return 0;
+  /* Time-wait and request sockets have no queues of their own. */
+  tp = bpf_skc_to_tcp_sock (skc);
+  if (!tp)
+    return emit_entry (ctx->meta->seq, skc, IPPROTO_TCP, 0, 0);
+  if (skc->skc_state == TCP_LISTEN)
+    {
+      rx_queue = tp->inet_conn.icsk_inet.sk.sk_ack_backlog;
+    }
+  else
+    {
+      rx_queue = tp->rcv_nxt - tp->copied_seq;
+      if (rx_queue < 0)
+	rx_queue = 0;
+    }
+  return emit_entry (ctx->meta->seq, skc, IPPROTO_TCP,
+		     rx_queue, tp->write_seq - tp->snd_una);
+}
+
+SEC("iter/udp")
+int
+dump_udp (struct bpf_iter__udp *ctx)
+{
+  struct udp_sock *udp_sk = ctx->udp_sk;
+  struct sock *sk;
+  int rx_queue;
+
+  if (udp_sk == (void *) 0)
+    return 0;
+  sk = &udp_sk->inet.sk;
+  rx_queue = sk->sk_rmem_alloc.counter - udp_sk->forward_deficit;
+  if (rx_queue < 0)
+    rx_queue = 0;
+  return emit_entry (ctx->meta->seq, &sk->__sk_common, IPPROTO_UDP,
+		     rx_queue, sk->sk_wmem_alloc.refs.counter - 1);
+}
@@ -0,0 +1,131 @@
+/*
+ qui-peak.bpf.c
+
+ Date Created: Sat Oct 17 11:03:12 2026
+
+ Receive queue high-water marks between polls
+
+ Polling /proc/net misses bursts that fill and drain a receive queue
+ between two rounds.  These programs run on every enqueue to a UDP or
+ TCP receive queue and keep the highest occupancy seen per socket in
+ the `qui_peaks' map, together with a count of datagrams refused
+ because the queue was full.  Only sockets that reach the threshold
+ are entered in the map, so it stays small; user space empties it
+ once per round.
+ */
+
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_endian.h>
+
+#include "qui-bpf.h"
+
+#define AF_INET		2
+#define AF_INET6	10
+#define IPPROTO_TCP	6
+#define IPPROTO_UDP	17
+
+char LICENSE[] SEC("license") = "GPL";
+
+struct
+{
+  __uint (type, BPF_MAP_TYPE_ARRAY);
+  __uint (max_entries, 1);
+  __type (key, __u32);
+  __type (value, struct QuiBpfConfig);
+} qui_config SEC(".maps");
+
+struct
+{
+  __uint (type, BPF_MAP_TYPE_LRU_HASH);
+  __uint (max_entries, 65536);
+  __type (key, struct QuiBpfKey);
+  __type (value, struct QuiBpfPeak);
+} qui_peaks SEC(".maps");
+
+static __always_inline void
+record_peak (const struct sock_common *skc, __u16 proto, int occ, int full)
+{
+  const struct QuiBpfConfig *cfg;
+  struct QuiBpfKey key = {};
+  struct QuiBpfPeak *v;
+  __u32 zero = 0;
+  __u16 family = skc->skc_family;
+  __u16 sport = skc->skc_num;
+  __u16 dport = bpf_ntohs (skc->skc_dport);
+
+  if (occ < 0)
+    occ = 0;
+  cfg = bpf_map_lookup_elem (&qui_config, &zero);
+  if (!cfg)
+    return;
+  if ((__u32) occ < cfg->threshold && !full)
+    return;
+  if (family == AF_INET && !cfg->want_ipv4)
+    return;
+  if (family == AF_INET6 && !cfg->want_ipv6)
+    return;
+  if (cfg->specific_port && sport != cfg->portno && dport != cfg->portno)
+    return;
+
+  key.family = family;
+  key.proto = proto;
+  key.sport = bpf_htons (sport);
+  key.dport = skc->skc_dport;
+  if (family == AF_INET)
+    {
+      key.saddr[0] = skc->skc_rcv_saddr;
+      key.daddr[0] = skc->skc_daddr;
+    }
+  else
+    {
+      __builtin_memcpy (key.saddr, skc->skc_v6_rcv_saddr.in6_u.u6_addr32,
+			sizeof key.saddr);
+      __builtin_memcpy (key.daddr, skc->skc_v6_daddr.in6_u.u6_addr32,
+			sizeof key.daddr);
+    }
+
+  v = bpf_map_lookup_elem (&qui_peaks, &key);
+  if (!v)
+    {
+      struct QuiBpfPeak init = { .peak = occ, .full = full ? 1 : 0 };
+
+      bpf_map_update_elem (&qui_peaks, &key, &init, BPF_NOEXIST);
+      return;
+    }
+  /* Concurrent updates from several CPUs may lose a maximum that is
+     only marginally higher; that is acceptable for a high-water
+     mark. */
+  if ((__u32) occ > v->peak)
+    v->peak = occ;
+  if (full)
+    __sync_fetch_and_add (&v->full, 1);
+}
+
+/* UDP: called for every datagram queued to a socket.  A negative
+   return value means it was dropped, normally because the receive
+   buffer was full. */
+SEC("fexit/__udp_enqueue_schedule_skb")
+int
+BPF_PROG (udp_enqueue, struct sock *sk, struct sk_buff *skb, int ret)
+{
+  record_peak (&sk->__sk_common, IPPROTO_UDP,
+	       sk->sk_rmem_alloc.counter, ret < 0);
+  return 0;
+}
+
+/* TCP: data on established connections is queued from here, both on
+   the fast and on the slow path. */
+SEC("fexit/tcp_rcv_established")
+int
+BPF_PROG (tcp_established, struct sock *sk, struct sk_buff *skb)
+{
+  struct tcp_sock *tp = bpf_skc_to_tcp_sock (sk);
+
+  if (!tp)
+    return 0;
+  record_peak (&sk->__sk_common, IPPROTO_TCP,
+	       (int) (tp->rcv_nxt - tp->copied_seq), 0);
+  return 0;
+}
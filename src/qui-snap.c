@@ -0,0 +1,226 @@
+/*
+ qui-snap.c
+
+ Date Created: Sat Oct 17 23:59:58 2026
+
+ Read the snapshots that qui publishes with --publish
+
+ Usage: qui-snap [-b READS] NAME
+
+ prints the sockets of the latest round in the shared-memory segment
+ NAME, one per line, with the protocol, the endpoints and the receive
+ and send queue sizes, after a line with the round number, the number
+ of sockets and how many did not fit.
+
+ With -b, reads the latest round READS times instead, as a consumer
+ would, summing the queue sizes of all sockets in each read, and
+ reports the time per read and per socket, and how often a read had
+ to be tried again because qui published a round meanwhile.  The
+ time includes the callback, but no system calls are made.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+
+#include "format.h"
+#include "snapshot.h"
+
+typedef struct SnapshotCopyRec *SnapshotCopy;
+
+/* What print_snapshot() keeps of a round. */
+typedef struct SnapshotCopyRec
+{
+  SnapshotHalfRec half;
+  SnapshotEntryRec *entries;
+  unsigned	n;
+  unsigned	size;
+}
+SnapshotCopyRec;
+
+static int print_snapshot (SnapshotReader);
+static int bench_snapshot (SnapshotReader, unsigned long);
+static void copy_round (const SnapshotHalfRec *, const SnapshotEntryRec *,
+			unsigned, void *);
+static void sum_round (const SnapshotHalfRec *, const SnapshotEntryRec *,
+		       unsigned, void *);
+static double now (void);
+static void usage (const char *);
+
+int
+main (argc, argv)
+     int argc;
+     char **argv;
+{
+  SnapshotReader r;
+  unsigned long reads = 0;
+  char *end;
+  int opt, result;
+
+  while ((opt = getopt (argc, argv, "b:h")) != -1)
+    {
+      switch (opt) {
+      case 'b':
+	reads = strtoul (optarg, &end, 10);
+	if (end == optarg || *end != 0 || reads == 0)
+	  {
+	    fprintf (stderr, "Malformed read count %s\n", optarg);
+	    return 1;
+	  }
+	break;
+      default:
+	usage (argv[0]);
+	return opt == 'h' ? 0 : 1;
+      }
+    }
+  if (optind + 1 != argc)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+  if ((r = open_snapshot (argv[optind])) == 0)
+    return 1;
+  result = reads > 0 ? bench_snapshot (r, reads) : print_snapshot (r);
+  close_snapshot (r);
+  return result == 0 ? 0 : 1;
+}
+
+static int
+print_snapshot (r)
+     SnapshotReader r;
+{
+  SnapshotCopyRec copy;
+  char line[2 * MAX_ENDPOINT_STRING + 2 * MAX_UNSIGNED_STRING + 16];
+  const SnapshotEntryRec *e;
+  char *cp;
+  unsigned k;
+
+  memset (&copy, 0, sizeof copy);
+  if (read_snapshot (r, copy_round, &copy) < 0 || copy.n > copy.size)
+    {
+      fprintf (stderr, "No complete round in snapshot\n");
+      free (copy.entries);
+      return -1;
+    }
+  printf ("round %lu: %u sockets, %u dropped\n",
+	  (unsigned long) copy.half.round, copy.n, copy.half.n_dropped);
+  for (k = 0; k < copy.n; ++k)
+    {
+      e = &copy.entries[k];
+      cp = line;
+      strcpy (cp, e->proto == IPPROTO_TCP ? "tcp " : "udp ");
+      cp += 4;
+      cp = format_endpoint (cp, e->af, e->laddr, e->lport);
+      *cp++ = ' ';
+      cp = format_endpoint (cp, e->af, e->raddr, e->rport);
+      *cp++ = ' ';
+      cp = format_unsigned (cp, e->iq);
+      *cp++ = ' ';
+      cp = format_unsigned (cp, e->oq);
+      *cp++ = '\n';
+      fwrite (line, 1, cp - line, stdout);
+    }
+  free (copy.entries);
+  return 0;
+}
+
+static int
+bench_snapshot (r, reads)
+     SnapshotReader r;
+     unsigned long reads;
+{
+  uint64_t sum = 0, round_sum;
+  unsigned long k, entries = 0;
+  double start, seconds;
+  int n;
+
+  /* Wait for the first round, and touch the pages of the segment. */
+  while (read_snapshot (r, sum_round, &round_sum) < 0)
+    usleep (10000);
+  start = now ();
+  for (k = 0; k < reads; ++k)
+    {
+      if ((n = read_snapshot (r, sum_round, &round_sum)) < 0)
+	{
+	  fprintf (stderr, "Snapshot went away after %lu reads\n", k);
+	  return -1;
+	}
+      entries += n;
+      sum += round_sum;
+    }
+  seconds = now () - start;
+  printf ("%lu reads, %.0f sockets per read: %.0f ns per read, "
+	  "%.2f ns per socket, %lu retries (sum %llu)\n",
+	  reads, (double) entries / reads, seconds * 1e9 / reads,
+	  entries > 0 ? seconds * 1e9 / entries : 0,
+	  snapshot_retries (r), (unsigned long long) sum);
+  return 0;
+}
+
+/* Copy the round, which may be called again if it changed meanwhile. */
+static void
+copy_round (half, entries, n, closure)
+     const SnapshotHalfRec *half;
+     const SnapshotEntryRec *entries;
+     unsigned n;
+     void *closure;
+{
+  SnapshotCopy copy = (SnapshotCopy) closure;
+  SnapshotEntryRec *new_entries;
+
+  if (n > copy->size)
+    {
+      if ((new_entries = realloc (copy->entries,
+				  n * sizeof (SnapshotEntryRec))) == 0)
+	{
+	  fprintf (stderr, "Out of memory\n");
+	  /* Tells print_snapshot() that the copy is incomplete. */
+	  copy->n = copy->size + 1;
+	  return;
+	}
+      copy->entries = new_entries;
+      copy->size = n;
+    }
+  copy->half = *half;
+  memcpy (copy->entries, entries, n * sizeof (SnapshotEntryRec));
+  copy->n = n;
+}
+
+/* What a consumer would do: look at every socket.  The sum of the
+   round replaces that of an earlier call for the same read, which
+   was of a round that changed meanwhile. */
+static void
+sum_round (half, entries, n, closure)
+     const SnapshotHalfRec *half;
+     const SnapshotEntryRec *entries;
+     unsigned n;
+     void *closure;
+{
+  uint64_t sum = 0;
+  unsigned k;
+
+  for (k = 0; k < n; ++k)
+    sum += entries[k].iq + entries[k].oq;
+  *(uint64_t *) closure = sum;
+}
+
+static double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+usage (progname)
+     const char *progname;
+{
+  fprintf (stderr, "Usage: %s [-b READS] NAME\n", progname);
+}
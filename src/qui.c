@@ -10,33 +10,45 @@
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
-#include <signal.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <netdb.h>
 
 #include "preferences.h"
 #include "parse-args.h"
 #include "proc-net.h"
+#include "inet-diag.h"
+#include "bpf-iter.h"
+#include "bpf-peak.h"
+#include "hex.h"
+#include "history.h"
+#include "events.h"
+#include "output.h"
+#include "schedule.h"
+#include "stats.h"
+#include "top.h"
+#include "exporter.h"
+#include "publish.h"
+#include "drops.h"
+#include "owner.h"
+#include "timestamp.h"
+#include "instrument.h"
 
 /* Prototypes */
 static void per_entry (ProcFileEntry,
 		       const struct timeval *, void *);
-static const char *pretty_sockaddr (struct sockaddr *, char *);
-static const char *pretty_sockaddr_ipv4 (struct sockaddr_in *, char *);
-static const char *pretty_sockaddr_ipv6 (struct sockaddr_in6 *, char *);
-static void print_blips (uint32_t, Preferences);
-static char *strtime (const struct timeval *, Preferences);
-static void handle_intr (int);
-static void init_signal_handlers (void);
-
-#define MAX_SERVNAME 20
-
-#define MAX_PRETTY_SOCKADDR (INET6_ADDRSTRLEN + MAX_SERVNAME + 3)
+static void per_peak (ProcFileEntry, uint32_t, uint32_t, void *);
+static void per_event_entry (ProcFileEntry, const struct timeval *, void *);
+static void per_stats_entry (ProcFileEntry, const struct timeval *, void *);
+static void per_top_entry (ProcFileEntry, const struct timeval *, void *);
+static void per_exporter_entry (ProcFileEntry, const struct timeval *, void *);
+static void per_publisher_entry (ProcFileEntry, const struct timeval *, void *);
+static void report_burst (ProcFileEntry, int, BufferEvent, double, void *);
 
 int close_proc_after_reading = 0;
 
-static int stop = 0;
+/* in the current round, for the instruments */
+static unsigned long n_seen = 0;
+static unsigned long n_reported = 0;
 
 int
 main (argc, argv)
@@ -45,19 +57,139 @@ main (argc, argv)
 {
   unsigned iter;
   PreferencesRec p;
+  SockEntryCallback callback;
+  Schedule schedule;
+  struct timeval tv;
+  int status;
 
   parse_args (argc, argv, &p);
-  init_signal_handlers ();
-  for (;;)
+  if (p.replay_file)
+    return replay_output (&p) == 0 ? 0 : 1;
+  /* before any threads are created */
+  init_timestamps ();
+  init_instruments ();
+  if ((schedule = make_schedule (&p)) == 0)
+    return 1;
+  init_hex_decoder ();
+  if (p.debug)
+    fprintf (stderr, "Using %s hex decoder\n", hex_decoder_name ());
+  if (p.collect_method == COLLECT_BPF && init_bpf_iter (&p) != 0)
+    {
+      fprintf (stderr, "Falling back to /proc/net\n");
+      p.collect_method = COLLECT_PROC;
+    }
+  if (p.want_peaks && init_bpf_peak (&p) != 0)
+    {
+      fprintf (stderr, "Not capturing peaks between rounds\n");
+      p.want_peaks = 0;
+    }
+  if (p.want_events && init_events (&p) != 0)
+    return 1;
+  if (p.want_stats && init_stats (&p) != 0)
+    return 1;
+  if (p.top_count > 0 && init_top (&p) != 0)
+    return 1;
+  if (p.listen_address && init_exporter (&p) != 0)
+    return 1;
+  if (p.publish_name && init_publisher (&p) != 0)
+    return 1;
+  if (p.want_drops && init_drops (&p) != 0)
+    return 1;
+  if (p.want_owners && init_owners (&p) != 0)
+    return 1;
+  if (init_output (&p) != 0)
+    return 1;
+  callback = p.want_events ? per_event_entry
+    : p.want_stats ? per_stats_entry
+    : p.top_count > 0 ? per_top_entry
+    : p.listen_address ? per_exporter_entry
+    : p.publish_name ? per_publisher_entry : per_entry;
+  while ((status = wait_for_round (schedule)) > 0)
     {
-      parse_proc_files (&p, per_entry, &p);
-      if (stop)
+      if (status == SCHEDULE_REPORT)
+	{
+	  print_instruments ();
+	  if (p.want_stats)
+	    {
+	      /* The output thread is idle between rounds once it has
+		 caught up, so the two do not mix their lines. */
+	      wait_for_output ();
+	      print_stats ();
+	    }
+	  continue;
+	}
+      begin_instrumented_round ();
+      n_seen = n_reported = 0;
+      if (p.want_peaks)
+	collect_bpf_peaks ();
+      if (p.want_events)
+	begin_events_round ();
+      if (p.want_stats)
+	begin_stats_round ();
+      if (p.want_drops)
+	begin_drops_round ();
+      if (p.want_owners)
+	begin_owners_round ();
+      if (p.top_count > 0)
+	begin_top_round ();
+      if (p.listen_address)
+	begin_exporter_round ();
+      if (p.publish_name)
+	begin_publisher_round ();
+      if (p.collect_method == COLLECT_BPF)
+	parse_bpf_iter (&p, callback, &p);
+      else if (p.collect_method == COLLECT_NETLINK)
+	parse_inet_diag (&p, callback, &p);
+      else
+	parse_proc_files (&p, callback, &p);
+      end_collection ();
+      if (p.want_peaks)
+	map_unmatched_bpf_peaks (per_peak, &p);
+      if (p.want_events)
 	{
-	  break;
+	  current_timeval (&tv);
+	  end_events_round (&tv, report_burst, &p);
 	}
-      nanosleep (&p.sleeptime, 0);
+      if (p.want_stats)
+	end_stats_round ();
+      if (p.top_count > 0)
+	end_top_round ();
+      if (p.listen_address)
+	end_exporter_round ();
+      if (p.publish_name)
+	end_publisher_round ();
+      if (p.want_drops)
+	end_drops_round ();
+      if (p.want_owners)
+	end_owners_round ();
+      end_output_round ();
+      end_instrumented_round (n_seen, n_reported);
+    }
+  if (p.top_count > 0)
+    finish_top ();
+  if (p.listen_address)
+    finish_exporter ();
+  if (p.publish_name)
+    finish_publisher ();
+  if (p.want_drops)
+    finish_drops ();
+  if (p.want_events)
+    {
+      current_timeval (&tv);
+      flush_events (&tv, report_burst, &p);
     }
-  return 0;
+  finish_output ();
+  if (p.want_owners)
+    finish_owners ();
+  if (p.want_stats)
+    {
+      print_stats ();
+      finish_stats ();
+    }
+  finish_schedule (schedule);
+  print_instruments ();
+  destroy_schedule (schedule);
+  return status < 0 ? 1 : 0;
 }
 
 static void
@@ -67,173 +199,104 @@ per_entry (pfe, tv, closure)
      void *closure;
 {
   Preferences p = (Preferences) closure;
+  uint32_t peak = 0, full = 0, lost;
+  int have_peak;
+
+  ++n_seen;
+  have_peak = p->want_peaks && lookup_bpf_peak (pfe, &peak, &full);
+  lost = p->want_drops ? update_drops (pfe) : 0;
   if ((p->want_input && (pfe->iq >= p->threshold))
-      || (p->want_output && (pfe->oq >= p->threshold)))
+      || (p->want_output && (pfe->oq >= p->threshold))
+      || have_peak || lost > 0)
     {
-      char lap[MAX_PRETTY_SOCKADDR];
-      char rap[MAX_PRETTY_SOCKADDR];
-      pretty_sockaddr ((struct sockaddr *) &(pfe->la), lap);
-      pretty_sockaddr ((struct sockaddr *) &(pfe->ra), rap);
-      fprintf (stdout, "%s %s %s Q:",
-	       strtime (tv, p),
-	       lap, rap);
-      if (p->want_input)
-	{
-	  fprintf (stdout, " %lu", (unsigned long) pfe->iq);
-	  print_blips (pfe->iq, p);
-	}
-      if (p->want_output)
-	{
-	  fprintf (stdout, " %lu", (unsigned long) pfe->oq);
-	  print_blips (pfe->oq, p);
-	}
-      fputc ('\n', stdout);
+      output_entry (pfe, tv, have_peak, peak, full, lost);
+      ++n_reported;
     }
 }
 
+/* Called for sockets that had a peak above the threshold since the
+   last round, but were not seen in this round. */
 static void
-print_blips (val, p)
-     uint32_t val;
-     Preferences p;
+per_peak (pfe, peak, full, closure)
+     ProcFileEntry pfe;
+     uint32_t peak;
+     uint32_t full;
+     void *closure;
 {
-  int fullchar = '#';
-  int halfchar = '+';
+  struct timeval tv;
 
-  unsigned nblips, fullblips, halfblips, k;
-
-  nblips = val / p->blipsize;
-
-  if (nblips > 0)
-    {
-      fullblips = nblips / 2;
-      halfblips = nblips % 2;
-
-      fputc (' ', stdout);
-      for (k = 0; k < fullblips; k++)
-	{
-	  fputc (fullchar, stdout);
-	}
-      for (k = 0; k < halfblips; k++)
-	{
-	  fputc (halfchar, stdout);
-	}
-    }
+  current_timeval (&tv);
+  pfe->ts_error = 0;
+  output_entry (pfe, &tv, 1, peak, full, 0);
+  ++n_reported;
 }
 
-static const char *
-pretty_sockaddr (struct sockaddr *sa, char *buf)
+static void
+per_event_entry (pfe, tv, closure)
+     ProcFileEntry pfe;
+     const struct timeval *tv;
+     void *closure;
 {
-  if (sa->sa_family == AF_INET)
-    {
-      return pretty_sockaddr_ipv4 ((struct sockaddr_in *) sa, buf);
-    }
-  else if (sa->sa_family == AF_INET6)
-    {
-      return pretty_sockaddr_ipv6 ((struct sockaddr_in6 *) sa, buf);
-    }
-  else
-    {
-      sprintf (buf, "<UNKNOWN-AF-%d>", sa->sa_family);
-      return 0;
-    }
+  Preferences p = (Preferences) closure;
+
+  ++n_seen;
+  /* Ask about the owner while the burst is on, so that it is known
+     by the time the burst is reported. */
+  if (p->want_owners)
+    lookup_owner (pfe->inode);
+  update_events (pfe, tv, report_burst, closure);
 }
 
-static const char *
-pretty_sockaddr_ipv4 (struct sockaddr_in *sa, char *buf)
+/* Every sample goes into the estimates; only those above the
+   threshold are printed. */
+static void
+per_stats_entry (pfe, tv, closure)
+     ProcFileEntry pfe;
+     const struct timeval *tv;
+     void *closure;
 {
-  char servname[MAX_SERVNAME];
-  int result;
-
-  result = getnameinfo ((struct sockaddr *) sa, sizeof (struct sockaddr_in),
-			buf, MAX_PRETTY_SOCKADDR,
-			servname, MAX_SERVNAME,
-			NI_NUMERICHOST|NI_NUMERICSERV);
-  if (result == 0)
-    {
-      char *cp = buf + strlen (buf);
-      sprintf (cp, ":%s", servname);
-      return buf;
-    }
-  else
-    {
-      fprintf (stderr, "Error pretty-printing IPv6 address: %s\n",
-	       gai_strerror (result));
-      return 0;
-    }
+  update_stats (pfe, tv);
+  per_entry (pfe, tv, closure);
 }
 
-static const char *
-pretty_sockaddr_ipv6 (struct sockaddr_in6 *sa, char *buf)
+static void
+per_top_entry (pfe, tv, closure)
+     ProcFileEntry pfe;
+     const struct timeval *tv;
+     void *closure;
 {
-  char servname[MAX_SERVNAME];
-  int result;
-
-  buf[0] = '[';
-  result = getnameinfo ((struct sockaddr *) sa, sizeof (struct sockaddr_in6),
-			buf+1, MAX_PRETTY_SOCKADDR-1,
-			servname, MAX_SERVNAME,
-			NI_NUMERICHOST|NI_NUMERICSERV);
-  if (result == 0)
-    {
-      char *cp = buf + strlen (buf);
-      sprintf (cp, "]:%s", servname);
-      return buf;
-    }
-  else
-    {
-      fprintf (stderr, "Error pretty-printing IPv6 address: %s\n",
-	       gai_strerror (result));
-      fprintf (stderr, "  AF = %d\n", (int) sa->sin6_family);
-      return 0;
-    }
+  ++n_seen;
+  update_top (pfe);
 }
 
-static char *strtime (tv, p)
+static void
+per_exporter_entry (pfe, tv, closure)
+     ProcFileEntry pfe;
      const struct timeval *tv;
-     Preferences p;
+     void *closure;
 {
-  static struct timeval cached_tv = { .tv_sec = 0, .tv_usec = 0 };
-  time_t time;
-  static struct tm cached_tm;
-  static char timebuf[30];
-  static char *sec_end;
-
-  if (cached_tv.tv_sec != tv->tv_sec)
-    {
-      time = tv->tv_sec;
-      if (localtime_r (&time, &cached_tm) == 0)
-	{
-	  fprintf (stderr, "Cannot convert time\n");
-	  return 0;
-	}
-      strftime (timebuf, 30, "%H:%M:%S", &cached_tm);
-      sec_end = timebuf+strlen (timebuf);
-    }
-
-  if (p->print_usecs)
-    {
-      sprintf (sec_end, ".%06lu", (unsigned long) tv->tv_usec);
-    }
-  else
-    {
-      sprintf (sec_end, ".%03lu", (unsigned long) tv->tv_usec/1000);
-    }
-  return timebuf;
+  ++n_seen;
+  update_exporter (pfe);
 }
 
 static void
-handle_intr (sig)
-     int sig;
+per_publisher_entry (pfe, tv, closure)
+     ProcFileEntry pfe;
+     const struct timeval *tv;
+     void *closure;
 {
-  stop = 1;
+  ++n_seen;
+  update_publisher (pfe);
 }
 
 static void
-init_signal_handlers ()
+report_burst (pfe, which, ev, byte_seconds, closure)
+     ProcFileEntry pfe;
+     int which;
+     BufferEvent ev;
+     double byte_seconds;
+     void *closure;
 {
-  struct sigaction sa;
-  memset (&sa, 0, sizeof sa);
-  sa.sa_handler = handle_intr;
-  sa.sa_flags = SA_RESETHAND|SA_RESTART;
-  sigaction (SIGINT, &sa, 0);
+  output_burst (pfe, which, ev, byte_seconds);
+  ++n_reported;
 }
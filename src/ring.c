@@ -0,0 +1,106 @@
+/*
+ ring.c
+
+ Date Created: Sat Oct 17 17:12:18 2026
+
+ A bounded ring of fixed-size records between two threads
+
+ There is exactly one producer and one consumer.  The producer only
+ writes `head', the consumer only writes `tail', and each reads the
+ other's index with acquire semantics after the other has published
+ it with release semantics, so no locks are needed and neither side
+ ever waits for the other.  A push into a full ring, or a pop from an
+ empty one, simply fails.  The two indexes are on separate cache
+ lines so that the threads do not keep stealing a line from each
+ other.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "ring.h"
+
+#define CACHE_LINE 64
+
+typedef struct RingRec
+{
+  unsigned	mask;		/* number of records - 1 */
+  size_t	record_size;
+  char	       *records;
+  unsigned	head __attribute__ ((aligned (CACHE_LINE)));
+  unsigned	tail __attribute__ ((aligned (CACHE_LINE)));
+}
+RingRec;
+
+/* Make a ring for at least N_RECORDS records of RECORD_SIZE bytes
+   each; the number is rounded up to a power of two. */
+Ring
+make_ring (n_records, record_size)
+     unsigned n_records;
+     size_t record_size;
+{
+  Ring r;
+  unsigned n = 1;
+
+  while (n < n_records)
+    n *= 2;
+  if (posix_memalign ((void **) &r, CACHE_LINE, sizeof (RingRec)) != 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      return 0;
+    }
+  if ((r->records = malloc (n * record_size)) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      free (r);
+      return 0;
+    }
+  r->mask = n - 1;
+  r->record_size = record_size;
+  r->head = 0;
+  r->tail = 0;
+  return r;
+}
+
+void
+destroy_ring (r)
+     Ring r;
+{
+  free (r->records);
+  free (r);
+}
+
+/* Producer side: copy REC into the ring.  Returns -1 if it is full. */
+int
+ring_push (r, rec)
+     Ring r;
+     const void *rec;
+{
+  unsigned head = r->head;
+
+  if (head - __atomic_load_n (&r->tail, __ATOMIC_ACQUIRE) > r->mask)
+    return -1;
+  memcpy (r->records + (head & r->mask) * r->record_size, rec,
+	  r->record_size);
+  __atomic_store_n (&r->head, head + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Consumer side: copy the oldest record to REC and remove it from the
+   ring.  Returns -1 if it is empty. */
+int
+ring_pop (r, rec)
+     Ring r;
+     void *rec;
+{
+  unsigned tail = r->tail;
+
+  if (__atomic_load_n (&r->head, __ATOMIC_ACQUIRE) == tail)
+    return -1;
+  memcpy (rec, r->records + (tail & r->mask) * r->record_size,
+	  r->record_size);
+  __atomic_store_n (&r->tail, tail + 1, __ATOMIC_RELEASE);
+  return 0;
+}
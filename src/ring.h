@@ -0,0 +1,19 @@
+/*
+ ring.h
+
+ Date Created: Sat Oct 17 17:12:40 2026
+ */
+
+#ifndef __QUI_RING_H__
+#define __QUI_RING_H__ 1
+
+#include <stddef.h>
+
+typedef struct RingRec *Ring;
+
+extern Ring make_ring (unsigned, size_t);
+extern void destroy_ring (Ring);
+extern int ring_push (Ring, const void *);
+extern int ring_pop (Ring, void *);
+
+#endif /* not __QUI_RING_H__ */
@@ -0,0 +1,312 @@
+/*
+ schedule.c
+
+ Date Created: Sat Oct 17 20:48:19 2026
+
+ Start rounds at CLOCK_MONOTONIC deadlines
+
+ Each deadline is the previous one plus a gap.  With the fixed
+ schedule, all gaps are equal to the interval, so deadline k is
+ start + k * interval, a fixed grid.  A fixed grid can phase-lock with
+ workloads that do something at regular times, such as flushing a
+ buffer every 10 ms, and then the samples always see the same part of
+ their cycle.  The Poisson schedule draws gaps from an exponential
+ distribution with the interval as its mean, so the sample times form
+ a Poisson process.  Because those arrivals see time averages (PASTA),
+ a plain average over samples estimates time averages without bias,
+ whatever the workload does.  The jitter schedule draws gaps uniformly
+ from interval * (1 +/- jitter), which breaks up phase-locking with
+ gaps that stay close to the interval.
+
+ After each round, the next deadline that has not passed yet is armed
+ on a timerfd as an absolute time, so the period does not include the
+ time the round took, and errors do not add up.  A round that runs
+ past one or more deadlines is an overrun; those deadlines are skipped
+ rather than run late, so that every round starts on the schedule.
+ Overruns are counted and reported on standard error, at most once a
+ second, and in total at the end.
+
+ SIGINT and SIGTERM are blocked and read from a signalfd, which is
+ waited for together with the timerfd in epoll, so a signal ends the
+ wait at once, and is never delivered in the middle of a round.
+ SIGUSR1 is read the same way; it asks for a report between rounds,
+ after which the wait for the same deadline goes on.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "schedule.h"
+#include "timestamp.h"
+#include "instrument.h"
+
+typedef struct ScheduleRec
+{
+  int		timer_fd;	/* -1 with an interval of 0 */
+  int		signal_fd;
+  int		epoll_fd;
+  sigset_t	signals;	/* those read from signal_fd */
+  sigset_t	stop_signals;	/* those that end the program */
+  ScheduleKind	kind;
+  uint64_t	interval;	/* in nanoseconds, the mean gap */
+  double	jitter;
+  uint64_t	random_state;
+  uint64_t	deadline;	/* of the round that is running */
+  uint64_t	next;		/* of the round waited for */
+  int		have_next;	/* set when a wait was interrupted */
+  unsigned long	rounds;
+  unsigned long	overruns;	/* rounds that ran past a deadline */
+  unsigned long	skipped;	/* deadlines without a round */
+  unsigned long	reported_overruns;
+  unsigned long	reported_skipped;
+  uint64_t	last_report;
+}
+ScheduleRec;
+
+static uint64_t next_gap (Schedule);
+static int arm_timer (Schedule, uint64_t);
+static void report_overruns (Schedule, uint64_t);
+
+/* Block SIGINT, SIGTERM and SIGUSR1.  This should be called before any other
+   threads are created, so that they inherit the signal mask. */
+Schedule
+make_schedule (p)
+     Preferences p;
+{
+  Schedule s;
+  struct epoll_event ev;
+
+  if ((s = malloc (sizeof (ScheduleRec))) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      return 0;
+    }
+  memset (s, 0, sizeof (ScheduleRec));
+  s->timer_fd = s->signal_fd = s->epoll_fd = -1;
+  s->kind = p->schedule;
+  s->interval = p->sleeptime.tv_sec * NSECS_PER_SEC + p->sleeptime.tv_nsec;
+  s->jitter = p->jitter;
+  /* xorshift gets stuck at zero */
+  s->random_state = (monotonic_ns () ^ ((uint64_t) getpid () << 32)) | 1;
+  sigemptyset (&s->stop_signals);
+  sigaddset (&s->stop_signals, SIGINT);
+  sigaddset (&s->stop_signals, SIGTERM);
+  s->signals = s->stop_signals;
+  sigaddset (&s->signals, SIGUSR1);
+  if (sigprocmask (SIG_BLOCK, &s->signals, 0) == -1
+      || (s->signal_fd = signalfd (-1, &s->signals,
+				   SFD_NONBLOCK | SFD_CLOEXEC)) == -1
+      || (s->epoll_fd = epoll_create1 (EPOLL_CLOEXEC)) == -1)
+    {
+      fprintf (stderr, "Cannot set up signal handling: %s\n",
+	       strerror (errno));
+      destroy_schedule (s);
+      return 0;
+    }
+  memset (&ev, 0, sizeof ev);
+  ev.events = EPOLLIN;
+  ev.data.fd = s->signal_fd;
+  if (epoll_ctl (s->epoll_fd, EPOLL_CTL_ADD, s->signal_fd, &ev) == -1)
+    {
+      fprintf (stderr, "Cannot watch signals: %s\n", strerror (errno));
+      destroy_schedule (s);
+      return 0;
+    }
+  if (s->interval > 0)
+    {
+      if ((s->timer_fd = timerfd_create (CLOCK_MONOTONIC,
+					 TFD_NONBLOCK | TFD_CLOEXEC)) == -1)
+	{
+	  fprintf (stderr, "Cannot create timer: %s\n", strerror (errno));
+	  destroy_schedule (s);
+	  return 0;
+	}
+      ev.data.fd = s->timer_fd;
+      if (epoll_ctl (s->epoll_fd, EPOLL_CTL_ADD, s->timer_fd, &ev) == -1)
+	{
+	  fprintf (stderr, "Cannot watch timer: %s\n", strerror (errno));
+	  destroy_schedule (s);
+	  return 0;
+	}
+    }
+  return s;
+}
+
+/* Wait for the start of the next round.  Returns SCHEDULE_ROUND when
+   it is time for the round, SCHEDULE_STOP when a signal asks us to
+   stop, SCHEDULE_REPORT on SIGUSR1, and -1 on errors.  After
+   SCHEDULE_REPORT, the next call waits for the same deadline.
+   The first round starts at once, and is the origin of the
+   schedule.
+   Once SCHEDULE_STOP has been returned, SIGINT and SIGTERM are
+   unblocked, so another one terminates the program while it is
+   cleaning up. */
+int
+wait_for_round (s)
+     Schedule s;
+{
+  struct epoll_event ev;
+  struct signalfd_siginfo si;
+  uint64_t now, next, late, expirations;
+  unsigned long skipped;
+  int n;
+
+  now = monotonic_ns ();
+  if (s->have_next)
+    next = s->next;
+  else if (s->rounds == 0 || s->interval == 0)
+    next = now;
+  else
+    {
+      next = s->deadline + next_gap (s);
+      if (now >= next)
+	{
+	  /* Skip to the first deadline after now. */
+	  ++s->overruns;
+	  skipped = s->skipped;
+	  if (s->kind == SCHEDULE_FIXED)
+	    {
+	      late = (now - next) / s->interval + 1;
+	      s->skipped += late;
+	      next += late * s->interval;
+	    }
+	  else
+	    for (; next <= now; next += next_gap (s))
+	      ++s->skipped;
+	  note_overrun (s->skipped - skipped);
+	  /* With random gaps, some are bound to be shorter than a
+	     round, so only the total is worth reporting. */
+	  if (s->kind == SCHEDULE_FIXED)
+	    report_overruns (s, now);
+	}
+    }
+  if (next > now && arm_timer (s, next) != 0)
+    return -1;
+  for (;;)
+    {
+      n = epoll_wait (s->epoll_fd, &ev, 1, next > now ? -1 : 0);
+      if (n == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  fprintf (stderr, "Cannot wait for next round: %s\n",
+		   strerror (errno));
+	  return -1;
+	}
+      if (n == 0)
+	break;
+      if (ev.data.fd == s->signal_fd)
+	{
+	  if (read (s->signal_fd, &si, sizeof si) != sizeof si)
+	    continue;
+	  if (si.ssi_signo == SIGUSR1)
+	    {
+	      s->next = next;
+	      s->have_next = 1;
+	      return SCHEDULE_REPORT;
+	    }
+	  sigprocmask (SIG_UNBLOCK, &s->stop_signals, 0);
+	  return SCHEDULE_STOP;
+	}
+      if (read (s->timer_fd, &expirations, sizeof expirations)
+	  == sizeof expirations)
+	break;
+    }
+  now = monotonic_ns ();
+  if (s->rounds > 0 && s->interval > 0)
+    note_wakeup (now > next ? now - next : 0);
+  s->deadline = next;
+  s->have_next = 0;
+  ++s->rounds;
+  return SCHEDULE_ROUND;
+}
+
+/* Print the overrun totals, if there were any. */
+void
+finish_schedule (s)
+     Schedule s;
+{
+  if (s->overruns > 0)
+    fprintf (stderr, "%lu of %lu rounds overran, %lu deadlines skipped "
+	     "in all\n", s->overruns, s->rounds, s->skipped);
+}
+
+void
+destroy_schedule (s)
+     Schedule s;
+{
+  if (s->timer_fd != -1)
+    close (s->timer_fd);
+  if (s->signal_fd != -1)
+    close (s->signal_fd);
+  if (s->epoll_fd != -1)
+    close (s->epoll_fd);
+  free (s);
+}
+
+/* The time from one deadline to the next, in nanoseconds.  The random
+   numbers come from xorshift64*, which is plenty for this. */
+static uint64_t
+next_gap (s)
+     Schedule s;
+{
+  double u;
+
+  if (s->kind == SCHEDULE_FIXED)
+    return s->interval;
+  s->random_state ^= s->random_state >> 12;
+  s->random_state ^= s->random_state << 25;
+  s->random_state ^= s->random_state >> 27;
+  /* uniform in [0, 1) */
+  u = ((s->random_state * 0x2545f4914f6cdd1dULL) >> 11) / 9007199254740992.0;
+  if (s->kind == SCHEDULE_POISSON)
+    return -log (1 - u) * s->interval;
+  return (1 + s->jitter * (2 * u - 1)) * s->interval;
+}
+
+static int
+arm_timer (s, deadline)
+     Schedule s;
+     uint64_t deadline;
+{
+  struct itimerspec its;
+
+  memset (&its, 0, sizeof its);
+  its.it_value.tv_sec = deadline / NSECS_PER_SEC;
+  its.it_value.tv_nsec = deadline % NSECS_PER_SEC;
+  if (timerfd_settime (s->timer_fd, TFD_TIMER_ABSTIME, &its, 0) == -1)
+    {
+      fprintf (stderr, "Cannot set timer: %s\n", strerror (errno));
+      return -1;
+    }
+  return 0;
+}
+
+static void
+report_overruns (s, now)
+     Schedule s;
+     uint64_t now;
+{
+  if (s->last_report != 0 && now - s->last_report < NSECS_PER_SEC)
+    return;
+  fprintf (stderr, "Sampling falling behind, %lu rounds overran, "
+	   "%lu deadlines skipped\n",
+	   s->overruns - s->reported_overruns,
+	   s->skipped - s->reported_skipped);
+  s->reported_overruns = s->overruns;
+  s->reported_skipped = s->skipped;
+  s->last_report = now;
+}
@@ -0,0 +1,22 @@
+/*
+ schedule.h
+
+ Date Created: Sat Oct 17 20:48:19 2026
+ */
+
+#ifndef __QUI_SCHEDULE_H__
+#define __QUI_SCHEDULE_H__ 1
+
+typedef struct ScheduleRec *Schedule;
+
+/* what wait_for_round() returns, besides -1 on errors */
+#define SCHEDULE_STOP	0
+#define SCHEDULE_ROUND	1
+#define SCHEDULE_REPORT	2
+
+extern Schedule make_schedule (Preferences);
+extern int wait_for_round (Schedule);
+extern void finish_schedule (Schedule);
+extern void destroy_schedule (Schedule);
+
+#endif /* not __QUI_SCHEDULE_H__ */
@@ -0,0 +1,150 @@
+/*
+ snapshot-reader.c
+
+ Date Created: Sat Oct 17 23:59:40 2026
+
+ Reading the snapshots that qui publishes with --publish
+
+ The segment is mapped read-only once, in open_snapshot().  After
+ that, reading a snapshot takes no system calls and copies nothing:
+ read_snapshot() notes the generation, hands the current half to the
+ callback where it lies, and checks the generation again.  The writer
+ only ever writes into the half that is not current, and advances the
+ generation when it makes it current; it writes into a half again only
+ after the generation has moved on from it.  So if the generation is
+ the same before and after, the callback has seen a consistent
+ round, and otherwise the read is tried again, as with a seqlock.  A
+ callback that keeps results must therefore be ready to be called
+ more than once for one read_snapshot().
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+
+/* how often read_snapshot() tries before it gives up */
+#define MAX_TRIES	100
+
+typedef struct SnapshotReaderRec
+{
+  const SnapshotHeaderRec *header;
+  const char   *arrays;
+  size_t	size;
+  unsigned long	retries;
+}
+SnapshotReaderRec;
+
+/* Map the segment NAME, as given to qui --publish. */
+SnapshotReader
+open_snapshot (name)
+     const char *name;
+{
+  SnapshotReader r;
+  struct stat st;
+  void *base;
+  char path[256];
+  const SnapshotHeaderRec *h;
+  int fd;
+
+  snprintf (path, sizeof path, "%s%s", name[0] == '/' ? "" : "/", name);
+  if ((fd = shm_open (path, O_RDONLY, 0)) == -1)
+    {
+      fprintf (stderr, "Cannot open snapshot %s: %s\n", name, strerror (errno));
+      return 0;
+    }
+  if (fstat (fd, &st) == -1
+      || (base = mmap (0, st.st_size, PROT_READ, MAP_SHARED, fd, 0))
+      == MAP_FAILED)
+    {
+      fprintf (stderr, "Cannot map snapshot %s: %s\n", name, strerror (errno));
+      close (fd);
+      return 0;
+    }
+  close (fd);
+  h = (const SnapshotHeaderRec *) base;
+  if ((size_t) st.st_size < sizeof (SnapshotHeaderRec)
+      || __atomic_load_n (&h->magic, __ATOMIC_ACQUIRE) != SNAPSHOT_MAGIC
+      || h->version != SNAPSHOT_VERSION
+      || h->entry_size != sizeof (SnapshotEntryRec)
+      || h->header_size + 2 * (size_t) h->capacity * h->entry_size
+      > (size_t) st.st_size)
+    {
+      fprintf (stderr, "%s is not a qui snapshot of version %d\n",
+	       name, SNAPSHOT_VERSION);
+      munmap (base, st.st_size);
+      return 0;
+    }
+  if ((r = malloc (sizeof (SnapshotReaderRec))) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      munmap (base, st.st_size);
+      return 0;
+    }
+  r->header = h;
+  r->arrays = (const char *) base + h->header_size;
+  r->size = st.st_size;
+  r->retries = 0;
+  return r;
+}
+
+/* Call CALLBACK with the latest round, until it has seen one that did
+   not change meanwhile.  Returns the number of entries of that round,
+   or -1 if there was none yet, the writer has gone away, or the
+   writer kept changing it. */
+int
+read_snapshot (r, callback, closure)
+     SnapshotReader r;
+     SnapshotCallback callback;
+     void *closure;
+{
+  const SnapshotHeaderRec *h = r->header;
+  const SnapshotHalfRec *half;
+  uint64_t gen;
+  unsigned tries, n;
+
+  for (tries = 0; tries < MAX_TRIES; ++tries)
+    {
+      if (__atomic_load_n (&h->magic, __ATOMIC_ACQUIRE) != SNAPSHOT_MAGIC)
+	return -1;
+      gen = __atomic_load_n (&h->generation, __ATOMIC_ACQUIRE);
+      if (gen == 0)
+	return -1;
+      half = &h->halves[gen & 1];
+      n = half->n_entries;
+      if (n > h->capacity)
+	n = h->capacity;
+      (* callback) (half, (const SnapshotEntryRec *)
+		    (r->arrays + (gen & 1) * h->capacity * h->entry_size),
+		    n, closure);
+      __atomic_thread_fence (__ATOMIC_ACQUIRE);
+      if (__atomic_load_n (&h->generation, __ATOMIC_RELAXED) == gen)
+	return n;
+      ++r->retries;
+    }
+  return -1;
+}
+
+/* How often reads had to be tried again. */
+unsigned long
+snapshot_retries (r)
+     SnapshotReader r;
+{
+  return r->retries;
+}
+
+void
+close_snapshot (r)
+     SnapshotReader r;
+{
+  munmap ((void *) r->header, r->size);
+  free (r);
+}
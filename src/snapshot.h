@@ -0,0 +1,82 @@
+/*
+ snapshot.h
+
+ Date Created: Sat Oct 17 23:59:40 2026
+
+ The layout of the shared-memory segment written with --publish, and
+ the functions for reading it.  Other programs can include this file
+ and link with snapshot-reader.c.
+ */
+
+#ifndef __QUI_SNAPSHOT_H__
+#define __QUI_SNAPSHOT_H__ 1
+
+#include <stdint.h>
+
+#define SNAPSHOT_MAGIC		0x70616e73697571ULL	/* "quisnap" */
+#define SNAPSHOT_VERSION	2
+
+typedef struct SnapshotEntryRec *SnapshotEntry;
+typedef struct SnapshotReaderRec *SnapshotReader;
+
+/* A socket as seen in a round; addresses, ports and the inode number
+   as in SockKeyRec.  64 bytes. */
+typedef struct SnapshotEntryRec
+{
+  uint8_t	af;
+  uint8_t	proto;
+  uint16_t	lport;
+  uint16_t	rport;
+  uint16_t	pad;
+  uint32_t	inode;
+  uint8_t	laddr[16];
+  uint8_t	raddr[16];
+  uint32_t	iq;
+  uint32_t	oq;
+  uint32_t	ts_error;	/* max. nanoseconds ts is off */
+  uint64_t	ts;		/* CLOCK_MONOTONIC, nanoseconds */
+}
+SnapshotEntryRec;
+
+/* One of the two halves of the segment: a round's worth of entries. */
+typedef struct SnapshotHalfRec
+{
+  uint64_t	round;
+  uint64_t	start_ns;	/* CLOCK_MONOTONIC, when the round started */
+  uint32_t	n_entries;
+  uint32_t	n_dropped;	/* sockets that did not fit */
+}
+SnapshotHalfRec;
+
+/* The segment starts with this header, followed by two arrays of
+   capacity entries each.  The half with the latest complete round is
+   halves[generation & 1], with its entries in array generation & 1.
+   magic is set last when the segment is created, and cleared when
+   the writer exits. */
+typedef struct SnapshotHeaderRec
+{
+  uint64_t	magic;
+  uint32_t	version;
+  uint32_t	header_size;	/* offset of the first array */
+  uint32_t	entry_size;
+  uint32_t	capacity;
+  uint32_t	writer_pid;
+  uint32_t	pad;
+  uint64_t	generation;	/* rounds published so far */
+  SnapshotHalfRec halves[2];
+}
+SnapshotHeaderRec;
+
+/* Called by read_snapshot() with the N entries of a round, in place
+   in the shared memory.  They may change while the callback looks at
+   them; read_snapshot() finds out afterwards whether they did. */
+typedef void (* SnapshotCallback) (const SnapshotHalfRec *,
+				   const SnapshotEntryRec *, unsigned,
+				   void *);
+
+extern SnapshotReader open_snapshot (const char *);
+extern int read_snapshot (SnapshotReader, SnapshotCallback, void *);
+extern unsigned long snapshot_retries (SnapshotReader);
+extern void close_snapshot (SnapshotReader);
+
+#endif /* not __QUI_SNAPSHOT_H__ */
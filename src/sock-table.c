@@ -0,0 +1,415 @@
+/*
+ sock-table.c
+
+ Date Created: Sat Oct 17 16:30:22 2026
+
+ A table of sockets that persists across rounds
+
+ The table is an open-addressing hash table with linear probing.  Its
+ slots hold a fixed-size SockKeyRec and the generation (round) in
+ which the socket was last seen; per-socket values of a size chosen
+ by the user, and optional BufferHistory pointers, are kept in
+ parallel arrays.  All of it is allocated when the table is made, for
+ a given maximum number of sockets, so that looking up or adding a
+ socket never allocates.  The table is kept at most three quarters
+ full, which keeps probe sequences short: with 48 bytes per slot,
+ a million sockets take 64 MB plus the values.
+
+ advance_sock_table() starts a new generation, and
+ sweep_sock_table() removes the sockets that have not been looked up
+ with intern_sock() since; it only has to walk the table if there are
+ any.  Removal shifts later entries of the same probe sequence back,
+ so there are no tombstones, and lookups never get slower as sockets
+ come and go.
+
+ Slot indexes stay valid until the next sweep.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "history.h"
+#include "sock-table.h"
+
+typedef struct SockSlotRec *SockSlot;
+
+typedef struct SockSlotRec
+{
+  SockKeyRec	key;
+  uint32_t	gen;		/* when last seen, or 0 if the slot is free */
+}
+SockSlotRec;
+
+typedef struct SockTableRec
+{
+  unsigned	capacity;	/* how many sockets fit */
+  unsigned	n_slots;
+  unsigned	n_used;
+  unsigned	n_seen;		/* interned in the current generation */
+  uint32_t	gen;		/* current generation, never 0 */
+  size_t	value_size;
+  SockSlot	slots;
+  char	       *values;		/* value_size bytes per slot */
+  BufferHistory *histories;	/* one per slot, allocated on first use */
+}
+SockTableRec;
+
+static unsigned home_slot (SockTable, const SockKeyRec *);
+static void delete_slot (SockTable, unsigned);
+static void move_slot (SockTable, unsigned, unsigned);
+
+/* Make a table for up to CAPACITY sockets, with VALUE_SIZE bytes of
+   zero-initialized user data per socket. */
+SockTable
+make_sock_table (capacity, value_size)
+     unsigned capacity;
+     size_t value_size;
+{
+  SockTable t;
+
+  if ((t = calloc (1, sizeof (SockTableRec))) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      return 0;
+    }
+  t->capacity = capacity;
+  t->n_slots = capacity + capacity / 3 + 1;
+  t->n_used = 0;
+  t->gen = 1;
+  t->value_size = value_size;
+  if ((t->slots = calloc (t->n_slots, sizeof (SockSlotRec))) == 0
+      || (value_size > 0
+	  && (t->values = calloc (t->n_slots, value_size)) == 0))
+    {
+      fprintf (stderr, "Out of memory for a table of %u sockets\n",
+	       capacity);
+      destroy_sock_table (t);
+      return 0;
+    }
+  return t;
+}
+
+void
+destroy_sock_table (t)
+     SockTable t;
+{
+  unsigned k;
+
+  if (t->histories)
+    {
+      for (k = 0; k < t->n_slots; ++k)
+	{
+	  if (t->histories[k])
+	    destroy_buffer_history (t->histories[k]);
+	}
+      free (t->histories);
+    }
+  free (t->values);
+  free (t->slots);
+  free (t);
+}
+
+void
+sock_key_from_entry (k, pfe)
+     SockKey k;
+     ProcFileEntry pfe;
+{
+  memset (k, 0, sizeof (SockKeyRec));
+  k->af = pfe->la.ss_family;
+  k->proto = pfe->proto;
+  k->inode = pfe->inode;
+  if (k->af == AF_INET6)
+    {
+      const struct sockaddr_in6 *la = (const struct sockaddr_in6 *) &(pfe->la);
+      const struct sockaddr_in6 *ra = (const struct sockaddr_in6 *) &(pfe->ra);
+
+      k->lport = ntohs (la->sin6_port);
+      k->rport = ntohs (ra->sin6_port);
+      memcpy (k->laddr, &(la->sin6_addr), 16);
+      memcpy (k->raddr, &(ra->sin6_addr), 16);
+    }
+  else
+    {
+      const struct sockaddr_in *la = (const struct sockaddr_in *) &(pfe->la);
+      const struct sockaddr_in *ra = (const struct sockaddr_in *) &(pfe->ra);
+
+      k->lport = ntohs (la->sin_port);
+      k->rport = ntohs (ra->sin_port);
+      memcpy (k->laddr, &(la->sin_addr), 4);
+      memcpy (k->raddr, &(ra->sin_addr), 4);
+    }
+}
+
+/* The inverse of sock_key_from_entry(), except that the queue sizes,
+   the namespace and the drop count are not known. */
+void
+sock_key_to_entry (k, pfe)
+     const SockKeyRec *k;
+     ProcFileEntry pfe;
+{
+  if (k->af == AF_INET6)
+    {
+      struct sockaddr_in6 *la = (struct sockaddr_in6 *) &(pfe->la);
+      struct sockaddr_in6 *ra = (struct sockaddr_in6 *) &(pfe->ra);
+
+      memset (la, 0, sizeof (struct sockaddr_in6));
+      memset (ra, 0, sizeof (struct sockaddr_in6));
+      la->sin6_family = ra->sin6_family = AF_INET6;
+      la->sin6_port = htons (k->lport);
+      ra->sin6_port = htons (k->rport);
+      memcpy (&(la->sin6_addr), k->laddr, 16);
+      memcpy (&(ra->sin6_addr), k->raddr, 16);
+    }
+  else
+    {
+      struct sockaddr_in *la = (struct sockaddr_in *) &(pfe->la);
+      struct sockaddr_in *ra = (struct sockaddr_in *) &(pfe->ra);
+
+      memset (la, 0, sizeof (struct sockaddr_in));
+      memset (ra, 0, sizeof (struct sockaddr_in));
+      la->sin_family = ra->sin_family = AF_INET;
+      la->sin_port = htons (k->lport);
+      ra->sin_port = htons (k->rport);
+      memcpy (&(la->sin_addr), k->laddr, 4);
+      memcpy (&(ra->sin_addr), k->raddr, 4);
+    }
+  pfe->iq = 0;
+  pfe->oq = 0;
+  pfe->proto = k->proto;
+  pfe->inode = k->inode;
+  pfe->netns = 0;
+  pfe->drops = 0;
+}
+
+/* Return the slot index of the socket with key K, or -1 if it is not
+   in the table. */
+long
+find_sock (t, k)
+     SockTable t;
+     const SockKeyRec *k;
+{
+  unsigned i = home_slot (t, k);
+
+  while (t->slots[i].gen != 0)
+    {
+      if (memcmp (&(t->slots[i].key), k, sizeof (SockKeyRec)) == 0)
+	return i;
+      i = (i + 1 == t->n_slots) ? 0 : i + 1;
+    }
+  return -1;
+}
+
+/* Return the slot index of the socket with key K, adding it if it is
+   not in the table yet, and mark it as seen in the current
+   generation.  *NEWP is set to whether it was added.  Returns -1 if
+   the table is full. */
+long
+intern_sock (t, k, newp)
+     SockTable t;
+     const SockKeyRec *k;
+     int *newp;
+{
+  unsigned i = home_slot (t, k);
+
+  while (t->slots[i].gen != 0)
+    {
+      if (memcmp (&(t->slots[i].key), k, sizeof (SockKeyRec)) == 0)
+	{
+	  if (t->slots[i].gen != t->gen)
+	    ++t->n_seen;
+	  t->slots[i].gen = t->gen;
+	  *newp = 0;
+	  return i;
+	}
+      i = (i + 1 == t->n_slots) ? 0 : i + 1;
+    }
+  if (t->n_used >= t->capacity)
+    return -1;
+  ++t->n_used;
+  ++t->n_seen;
+  t->slots[i].key = *k;
+  t->slots[i].gen = t->gen;
+  if (t->value_size > 0)
+    memset (t->values + i * t->value_size, 0, t->value_size);
+  *newp = 1;
+  return i;
+}
+
+const SockKeyRec *
+sock_key (t, i)
+     SockTable t;
+     long i;
+{
+  return &(t->slots[i].key);
+}
+
+void *
+sock_value (t, i)
+     SockTable t;
+     long i;
+{
+  return t->values + i * t->value_size;
+}
+
+BufferHistory
+sock_history (t, i)
+     SockTable t;
+     long i;
+{
+  return t->histories ? t->histories[i] : 0;
+}
+
+/* Give the socket in slot I a history, which is destroyed along with
+   the socket.  The array of history pointers is only allocated when
+   the first one is attached; if that fails, the history is destroyed
+   right away. */
+void
+attach_sock_history (t, i, h)
+     SockTable t;
+     long i;
+     BufferHistory h;
+{
+  if (t->histories == 0
+      && (t->histories = calloc (t->n_slots, sizeof (BufferHistory))) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      destroy_buffer_history (h);
+      return;
+    }
+  if (t->histories[i])
+    destroy_buffer_history (t->histories[i]);
+  t->histories[i] = h;
+}
+
+unsigned
+sock_table_count (t)
+     SockTable t;
+{
+  return t->n_used;
+}
+
+void
+advance_sock_table (t)
+     SockTable t;
+{
+  if (++t->gen == 0)
+    t->gen = 1;
+  t->n_seen = 0;
+}
+
+/* Remove all sockets that have not been interned in the current
+   generation, calling CALLBACK for each before it goes. */
+void
+sweep_sock_table (t, callback, closure)
+     SockTable t;
+     SockSweepCallback callback;
+     void *closure;
+{
+  unsigned i;
+
+  if (t->n_seen == t->n_used)
+    return;
+  for (i = 0; i < t->n_slots; ++i)
+    {
+      /* Deleting may move another stale entry into slot I. */
+      while (t->slots[i].gen != 0 && t->slots[i].gen != t->gen)
+	{
+	  if (callback)
+	    (* callback) (t, i, closure);
+	  delete_slot (t, i);
+	}
+    }
+}
+
+/* Call CALLBACK for each socket in the table, in no particular order.
+   The callback must not add or remove sockets. */
+void
+walk_sock_table (t, callback, closure)
+     SockTable t;
+     SockSweepCallback callback;
+     void *closure;
+{
+  unsigned i;
+
+  for (i = 0; i < t->n_slots; ++i)
+    if (t->slots[i].gen != 0)
+      (* callback) (t, i, closure);
+}
+
+/* Fibonacci-style mixing of the key's 64-bit words; the high half of
+   the result is scaled to the number of slots, which need not be a
+   power of two. */
+static unsigned
+home_slot (t, k)
+     SockTable t;
+     const SockKeyRec *k;
+{
+  uint64_t w[(sizeof (SockKeyRec) + 7) / 8] = { 0 };
+  uint64_t h = 0;
+  unsigned j;
+
+  memcpy (w, k, sizeof (SockKeyRec));
+  for (j = 0; j < sizeof w / sizeof w[0]; ++j)
+    {
+      h = (h ^ w[j]) * 0x9e3779b97f4a7c15ULL;
+      h ^= h >> 29;
+    }
+  return ((h >> 32) * t->n_slots) >> 32;
+}
+
+/* Free slot I, and move back later entries of the same probe
+   sequence whose home slot allows it, so that none of them becomes
+   unreachable. */
+static void
+delete_slot (t, i)
+     SockTable t;
+     unsigned i;
+{
+  unsigned j = i, home;
+
+  if (t->histories && t->histories[i])
+    {
+      destroy_buffer_history (t->histories[i]);
+      t->histories[i] = 0;
+    }
+  for (;;)
+    {
+      j = (j + 1 == t->n_slots) ? 0 : j + 1;
+      if (t->slots[j].gen == 0)
+	break;
+      home = home_slot (t, &(t->slots[j].key));
+      /* The entry in J may move to I unless its home is cyclically
+	 in (I, J]. */
+      if (j > i ? (home <= i || home > j) : (home <= i && home > j))
+	{
+	  move_slot (t, j, i);
+	  i = j;
+	}
+    }
+  t->slots[i].gen = 0;
+  --t->n_used;
+}
+
+static void
+move_slot (t, from, to)
+     SockTable t;
+     unsigned from;
+     unsigned to;
+{
+  t->slots[to] = t->slots[from];
+  if (t->value_size > 0)
+    memcpy (t->values + to * t->value_size,
+	    t->values + from * t->value_size, t->value_size);
+  if (t->histories)
+    {
+      t->histories[to] = t->histories[from];
+      t->histories[from] = 0;
+    }
+}
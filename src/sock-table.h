@@ -0,0 +1,55 @@
+/*
+ sock-table.h
+
+ Date Created: Sat Oct 17 16:31:09 2026
+ */
+
+#ifndef __QUI_SOCK_TABLE_H__
+#define __QUI_SOCK_TABLE_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "history.h"
+
+typedef struct SockKeyRec *SockKey;
+typedef struct SockTableRec *SockTable;
+
+/* What identifies a socket: addresses are stored in network byte
+   order (IPv4 addresses in the first four bytes), ports in host byte
+   order.  The inode number tells apart sockets that reuse the same
+   addresses and ports, including in different network namespaces. */
+typedef struct SockKeyRec
+{
+  uint8_t	af;
+  uint8_t	proto;
+  uint16_t	lport;
+  uint16_t	rport;
+  uint16_t	pad;		/* always zero */
+  uint32_t	inode;
+  uint8_t	laddr[16];
+  uint8_t	raddr[16];
+}
+SockKeyRec;
+
+/* Called for each socket removed by sweep_sock_table(), with its slot
+   index, before it is removed, and for each socket visited by
+   walk_sock_table(). */
+typedef void (* SockSweepCallback) (SockTable, long, void *);
+
+extern SockTable make_sock_table (unsigned, size_t);
+extern void destroy_sock_table (SockTable);
+extern void sock_key_from_entry (SockKey, ProcFileEntry);
+extern void sock_key_to_entry (const SockKeyRec *, ProcFileEntry);
+extern long find_sock (SockTable, const SockKeyRec *);
+extern long intern_sock (SockTable, const SockKeyRec *, int *);
+extern const SockKeyRec *sock_key (SockTable, long);
+extern void *sock_value (SockTable, long);
+extern BufferHistory sock_history (SockTable, long);
+extern void attach_sock_history (SockTable, long, BufferHistory);
+extern unsigned sock_table_count (SockTable);
+extern void advance_sock_table (SockTable);
+extern void sweep_sock_table (SockTable, SockSweepCallback, void *);
+extern void walk_sock_table (SockTable, SockSweepCallback, void *);
+
+#endif /* not __QUI_SOCK_TABLE_H__ */
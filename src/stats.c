@@ -0,0 +1,368 @@
+/*
+ stats.c
+
+ Date Created: Sat Oct 17 21:26:53 2026
+
+ Estimate time averages of queue occupancy from samples
+
+ For every socket, over the rounds in which it is seen, the number of
+ samples, the sum of the occupancy of each queue, and the number of
+ samples in which each queue was at or above the threshold are kept.
+ The sample mean of the occupancy estimates its time average, and the
+ share of samples at or above the threshold estimates the fraction of
+ time spent there.  With the Poisson schedule, sample times do not
+ depend on what the sockets do, and these estimates are unbiased
+ (PASTA, "Poisson arrivals see time averages").  With the fixed
+ schedule they can be off by any amount when a workload is periodic
+ with a period related to the sampling interval, and the jitter
+ schedule only makes that less likely.  Each sample counts the same,
+ however long the gap before or after it was; with random gaps,
+ weighting samples by them would only add noise.
+
+ Besides these, the maximum of each queue is kept, and a histogram of
+ its occupancy from which the median, 99th and 99.9th percentile are
+ read.  The histograms have the log-linear buckets of histogram.c with
+ 3 significant bits, so percentiles are within 25% of the truth, and
+ 32-bit counts: 124 buckets of 4 bytes per queue, whatever the number
+ of samples.  That is about 1 KB per socket, so the table for 100000
+ sockets (--max-sockets) takes under 150 MB, most of it only touched
+ when sockets come.  Histograms of the same queue can be merged by
+ adding up their buckets.
+
+ All sockets must be seen in every round for this, so the collection
+ methods are told not to filter any out.  When a socket goes away,
+ its numbers are moved out of the socket table into a list, if it ever
+ was at or above the threshold; those are printed together with the
+ sockets that still exist, when qui exits or gets SIGUSR1.  The list
+ holds up to --max-sockets sockets too, so that memory does not grow
+ with every connection ever seen: when it is full, the socket that
+ went away first is dropped from it, and the number of those dropped
+ is reported on exit.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "history.h"
+#include "sock-table.h"
+#include "owner.h"
+#include "events.h"
+#include "format.h"
+#include "histogram.h"
+#include "stats.h"
+
+#define SKETCH_BITS	3
+/* enough for 32-bit queue sizes */
+#define SKETCH_BUCKETS	((32 - SKETCH_BITS + 2) << (SKETCH_BITS - 1))
+
+typedef struct SockStatsRec *SockStats;
+typedef struct FinishedStatsRec *FinishedStats;
+
+/* what is kept in the socket table for each socket */
+typedef struct SockStatsRec
+{
+  char	       *netns;		/* own copy, the namespace may go away */
+  struct timeval first_ts;
+  struct timeval last_ts;
+  unsigned long	n_samples;
+  double	sum[2];		/* indexed by BURST_INPUT/BURST_OUTPUT */
+  unsigned long	n_above[2];
+  uint32_t	max[2];
+  uint32_t	sketch[2][SKETCH_BUCKETS];
+  OwnerRec	owner;		/* with --owners, once it is known */
+}
+SockStatsRec;
+
+/* a socket that has gone away */
+typedef struct FinishedStatsRec
+{
+  SockKeyRec	key;
+  SockStatsRec	stats;
+}
+FinishedStatsRec;
+
+static Preferences prefs;
+static SockTable sockets = 0;
+static int table_full = 0;
+static FinishedStats finished = 0;	/* oldest at first_finished */
+static unsigned long n_finished = 0;
+static unsigned long max_finished = 0;
+static unsigned long first_finished = 0;
+static unsigned long n_evicted = 0;
+
+static void finish_sock_stats (SockTable, long, void *);
+static void print_live_stats (SockTable, long, void *);
+static void free_live_stats (SockTable, long, void *);
+static void record_sample (SockStats, int, uint32_t);
+static uint32_t sketch_percentile (SockStats, int, double);
+static int interesting_stats_p (SockStats);
+static void print_sock_stats (const SockKeyRec *, SockStats);
+static double timeval_diff (const struct timeval *, const struct timeval *);
+
+int
+init_stats (p)
+     Preferences p;
+{
+  prefs = p;
+  if ((sockets = make_sock_table (p->max_sockets, sizeof (SockStatsRec))) == 0)
+    return -1;
+  return 0;
+}
+
+void
+begin_stats_round ()
+{
+  advance_sock_table (sockets);
+}
+
+/* Account for a sample of socket PFE taken at TV. */
+int
+update_stats (pfe, tv)
+     ProcFileEntry pfe;
+     const struct timeval *tv;
+{
+  SockKeyRec key;
+  const OwnerRec *owner;
+  SockStats s;
+  long i;
+  int is_new;
+
+  sock_key_from_entry (&key, pfe);
+  if ((i = intern_sock (sockets, &key, &is_new)) == -1)
+    {
+      if (!table_full)
+	fprintf (stderr, "More than %u sockets, not estimating the rest\n",
+		 prefs->max_sockets);
+      table_full = 1;
+      return -1;
+    }
+  s = (SockStats) sock_value (sockets, i);
+  if (is_new)
+    {
+      if (pfe->netns && (s->netns = strdup (pfe->netns)) == 0)
+	{
+	  fprintf (stderr, "Out of memory\n");
+	  return -1;
+	}
+      s->first_ts = *tv;
+    }
+  s->last_ts = *tv;
+  ++s->n_samples;
+  record_sample (s, BURST_INPUT, pfe->iq);
+  record_sample (s, BURST_OUTPUT, pfe->oq);
+  /* Only the sockets that will be printed are worth the search. */
+  if (prefs->want_owners && s->owner.pid == 0 && interesting_stats_p (s)
+      && (owner = lookup_owner (pfe->inode)) != 0)
+    s->owner = *owner;
+  return 0;
+}
+
+/* Move the numbers of sockets that were not seen in this round out of
+   the table. */
+void
+end_stats_round ()
+{
+  sweep_sock_table (sockets, finish_sock_stats, 0);
+  table_full = 0;
+}
+
+/* Print the estimates for all sockets, gone or still there, that were
+   at or above the threshold in at least one sample:
+
+   [NETNS] LOCAL REMOTE N: SAMPLES T: SECONDS M: MEAN-IN MEAN-OUT F: FRACTION-IN FRACTION-OUT X: MAX-IN MAX-OUT A: ABOVE-IN ABOVE-OUT P50: IN OUT P99: IN OUT P99.9: IN OUT [O: PID COMM CGROUP]
+
+   where SECONDS is the time from the first sample of the socket to the
+   last, and ABOVE is the estimated time at or above the threshold,
+   the fraction times SECONDS, and the owner is there with --owners
+   if it was found.  This can be called between rounds, as
+   often as wanted. */
+void
+print_stats ()
+{
+  unsigned long k;
+
+  for (k = 0; k < n_finished; ++k)
+    print_sock_stats (&finished[(first_finished + k) % n_finished].key,
+		      &finished[(first_finished + k) % n_finished].stats);
+  walk_sock_table (sockets, print_live_stats, 0);
+  fflush (stdout);
+}
+
+void
+finish_stats ()
+{
+  unsigned long k;
+
+  if (n_evicted > 0)
+    fprintf (stderr, "Dropped the estimates of %lu sockets that went away, "
+	     "only the last %u are kept\n", n_evicted, prefs->max_sockets);
+  for (k = 0; k < n_finished; ++k)
+    free (finished[k].stats.netns);
+  free (finished);
+  finished = 0;
+  n_finished = max_finished = first_finished = n_evicted = 0;
+  walk_sock_table (sockets, free_live_stats, 0);
+  destroy_sock_table (sockets);
+}
+
+static void
+finish_sock_stats (t, i, closure)
+     SockTable t;
+     long i;
+     void *closure;
+{
+  SockStats s = (SockStats) sock_value (t, i);
+  FinishedStats new_finished;
+  unsigned long k;
+
+  if (!interesting_stats_p (s))
+    {
+      free (s->netns);
+      return;
+    }
+  if (n_finished == prefs->max_sockets)
+    {
+      /* Make room by dropping the oldest. */
+      k = first_finished;
+      first_finished = (first_finished + 1) % n_finished;
+      free (finished[k].stats.netns);
+      ++n_evicted;
+    }
+  else
+    {
+      if (n_finished == max_finished)
+	{
+	  max_finished = max_finished ? 2 * max_finished : 256;
+	  if (max_finished > prefs->max_sockets)
+	    max_finished = prefs->max_sockets;
+	  if ((new_finished = realloc (finished, max_finished
+				       * sizeof (FinishedStatsRec))) == 0)
+	    {
+	      fprintf (stderr, "Out of memory\n");
+	      max_finished = n_finished;
+	      free (s->netns);
+	      return;
+	    }
+	  finished = new_finished;
+	}
+      k = n_finished++;
+    }
+  finished[k].key = *sock_key (t, i);
+  finished[k].stats = *s;
+}
+
+static void
+print_live_stats (t, i, closure)
+     SockTable t;
+     long i;
+     void *closure;
+{
+  SockStats s = (SockStats) sock_value (t, i);
+
+  if (interesting_stats_p (s))
+    print_sock_stats (sock_key (t, i), s);
+}
+
+static void
+free_live_stats (t, i, closure)
+     SockTable t;
+     long i;
+     void *closure;
+{
+  free (((SockStats) sock_value (t, i))->netns);
+}
+
+static void
+record_sample (s, which, val)
+     SockStats s;
+     int which;
+     uint32_t val;
+{
+  s->sum[which] += val;
+  if (val >= prefs->threshold)
+    ++s->n_above[which];
+  if (val > s->max[which])
+    s->max[which] = val;
+  ++s->sketch[which][log_bucket_index (val, SKETCH_BITS)];
+}
+
+/* As histogram_percentile(), the upper end of the bucket in which the
+   quantile Q falls, but never more than the maximum. */
+static uint32_t
+sketch_percentile (s, which, q)
+     SockStats s;
+     int which;
+     double q;
+{
+  unsigned long rank, seen = 0;
+  uint64_t high;
+  unsigned k;
+
+  rank = q * s->n_samples;
+  if (rank < q * s->n_samples || rank < 1)
+    ++rank;
+  for (k = 0; k < SKETCH_BUCKETS - 1; ++k)
+    if ((seen += s->sketch[which][k]) >= rank)
+      break;
+  high = log_bucket_high (k, SKETCH_BITS);
+  return high < s->max[which] ? high : s->max[which];
+}
+
+static int
+interesting_stats_p (s)
+     SockStats s;
+{
+  return (prefs->want_input && s->n_above[BURST_INPUT] > 0)
+    || (prefs->want_output && s->n_above[BURST_OUTPUT] > 0);
+}
+
+static void
+print_sock_stats (key, s)
+     const SockKeyRec *key;
+     SockStats s;
+{
+  char endpoints[2 * MAX_ENDPOINT_STRING + 2];
+  char *cp;
+  double seconds, f_in, f_out;
+
+  cp = format_endpoint (endpoints, key->af, key->laddr, key->lport);
+  *cp++ = ' ';
+  cp = format_endpoint (cp, key->af, key->raddr, key->rport);
+  *cp = 0;
+  seconds = timeval_diff (&s->last_ts, &s->first_ts);
+  f_in = (double) s->n_above[BURST_INPUT] / s->n_samples;
+  f_out = (double) s->n_above[BURST_OUTPUT] / s->n_samples;
+  printf ("%s%s%s N: %lu T: %.3f M: %.1f %.1f F: %.4f %.4f X: %lu %lu"
+	  " A: %.3f %.3f P50: %lu %lu P99: %lu %lu P99.9: %lu %lu",
+	  s->netns ? s->netns : "", s->netns ? " " : "", endpoints,
+	  s->n_samples, seconds,
+	  s->sum[BURST_INPUT] / s->n_samples,
+	  s->sum[BURST_OUTPUT] / s->n_samples, f_in, f_out,
+	  (unsigned long) s->max[BURST_INPUT],
+	  (unsigned long) s->max[BURST_OUTPUT],
+	  f_in * seconds, f_out * seconds,
+	  (unsigned long) sketch_percentile (s, BURST_INPUT, 0.5),
+	  (unsigned long) sketch_percentile (s, BURST_OUTPUT, 0.5),
+	  (unsigned long) sketch_percentile (s, BURST_INPUT, 0.99),
+	  (unsigned long) sketch_percentile (s, BURST_OUTPUT, 0.99),
+	  (unsigned long) sketch_percentile (s, BURST_INPUT, 0.999),
+	  (unsigned long) sketch_percentile (s, BURST_OUTPUT, 0.999));
+  if (s->owner.pid != 0)
+    printf (" O: %lu %s %s", (unsigned long) s->owner.pid, s->owner.comm,
+	    s->owner.cgroup[0] ? s->owner.cgroup : "-");
+  putchar ('\n');
+}
+
+static double
+timeval_diff (a, b)
+     const struct timeval *a;
+     const struct timeval *b;
+{
+  return (a->tv_sec - b->tv_sec) + (a->tv_usec - b->tv_usec) / 1e6;
+}
@@ -0,0 +1,19 @@
+/*
+ stats.h
+
+ Date Created: Sat Oct 17 21:26:53 2026
+ */
+
+#ifndef __QUI_STATS_H__
+#define __QUI_STATS_H__ 1
+
+#include <sys/time.h>
+
+extern int init_stats (Preferences);
+extern void begin_stats_round (void);
+extern int update_stats (ProcFileEntry, const struct timeval *);
+extern void end_stats_round (void);
+extern void print_stats (void);
+extern void finish_stats (void);
+
+#endif /* not __QUI_STATS_H__ */
@@ -0,0 +1,184 @@
+/*
+ thread-pool.c
+
+ Date Created: Sat Oct 17 14:20:52 2026
+
+ A fixed set of worker threads that run batches of tasks in lockstep
+
+ The workers are created once and each one is pinned to its own CPU
+ (round-robin over the CPUs the process may run on), so that the
+ per-file buffers they use stay warm in that CPU's cache from one
+ round to the next.  Between rounds they sleep on a barrier.
+ run_thread_pool() releases them through that barrier; each worker
+ then claims task indexes from a shared counter until none are left,
+ and all meet again on a second barrier before run_thread_pool()
+ returns.  Task results are left wherever the task function puts
+ them, for the calling thread to collect.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "thread-pool.h"
+
+typedef struct ThreadPoolRec
+{
+  unsigned	n_threads;
+  pthread_t    *threads;
+  pthread_mutex_t lock;		/* held while the pool is set up */
+  pthread_barrier_t start;	/* workers wait here between rounds */
+  pthread_barrier_t done;	/* and here when no tasks are left */
+  ThreadTask	task;
+  void	       *closure;
+  unsigned	n_tasks;
+  unsigned	next_task;	/* next index to claim, atomically */
+  int		shutdown;
+}
+ThreadPoolRec;
+
+static void *worker (void *);
+static void pin_thread (pthread_t, unsigned, const cpu_set_t *);
+
+ThreadPool
+make_thread_pool (n_threads)
+     unsigned n_threads;
+{
+  ThreadPool pool;
+  cpu_set_t allowed;
+  sigset_t all, saved;
+  unsigned k;
+  int err = 0;
+
+  if ((pool = malloc (sizeof (ThreadPoolRec))) == 0
+      || (pool->threads = malloc (n_threads * sizeof (pthread_t))) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      free (pool);
+      return 0;
+    }
+  pool->shutdown = 0;
+  pool->n_tasks = 0;
+  pool->next_task = 0;
+  if (sched_getaffinity (0, sizeof allowed, &allowed) != 0)
+    CPU_ZERO (&allowed);
+  /* Signals should go to the main thread, so the workers start with
+     all of them blocked. */
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &saved);
+  pthread_mutex_init (&pool->lock, 0);
+  pthread_mutex_lock (&pool->lock);
+  for (k = 0; k < n_threads; ++k)
+    {
+      if ((err = pthread_create (&pool->threads[k], 0, worker, pool)) != 0)
+	break;
+      pin_thread (pool->threads[k], k, &allowed);
+    }
+  pthread_sigmask (SIG_SETMASK, &saved, 0);
+  pool->n_threads = k;
+  pthread_barrier_init (&pool->start, 0, k + 1);
+  pthread_barrier_init (&pool->done, 0, k + 1);
+  pthread_mutex_unlock (&pool->lock);
+  if (err != 0)
+    {
+      fprintf (stderr, "Cannot create worker thread: %s\n", strerror (err));
+      destroy_thread_pool (pool);
+      return 0;
+    }
+  return pool;
+}
+
+unsigned
+thread_pool_size (pool)
+     ThreadPool pool;
+{
+  return pool->n_threads;
+}
+
+/* Run TASK for each index from 0 to N_TASKS-1, spread over the
+   workers, and wait until all of them have finished. */
+void
+run_thread_pool (pool, n_tasks, task, closure)
+     ThreadPool pool;
+     unsigned n_tasks;
+     ThreadTask task;
+     void *closure;
+{
+  pool->task = task;
+  pool->closure = closure;
+  pool->n_tasks = n_tasks;
+  pool->next_task = 0;
+  pthread_barrier_wait (&pool->start);
+  pthread_barrier_wait (&pool->done);
+}
+
+void
+destroy_thread_pool (pool)
+     ThreadPool pool;
+{
+  unsigned k;
+
+  pool->shutdown = 1;
+  pthread_barrier_wait (&pool->start);
+  for (k = 0; k < pool->n_threads; ++k)
+    pthread_join (pool->threads[k], 0);
+  pthread_barrier_destroy (&pool->start);
+  pthread_barrier_destroy (&pool->done);
+  pthread_mutex_destroy (&pool->lock);
+  free (pool->threads);
+  free (pool);
+}
+
+static void *
+worker (arg)
+     void *arg;
+{
+  ThreadPool pool = (ThreadPool) arg;
+  unsigned k;
+
+  /* The barriers are only initialized once all workers exist. */
+  pthread_mutex_lock (&pool->lock);
+  pthread_mutex_unlock (&pool->lock);
+  for (;;)
+    {
+      pthread_barrier_wait (&pool->start);
+      if (pool->shutdown)
+	return 0;
+      while ((k = __atomic_fetch_add (&pool->next_task, 1, __ATOMIC_RELAXED))
+	     < pool->n_tasks)
+	(* pool->task) (k, pool->closure);
+      pthread_barrier_wait (&pool->done);
+    }
+}
+
+/* Pin the Kth worker to the Kth of the CPUs in ALLOWED, wrapping
+   around if there are more workers than CPUs. */
+static void
+pin_thread (thread, k, allowed)
+     pthread_t thread;
+     unsigned k;
+     const cpu_set_t *allowed;
+{
+  cpu_set_t cpus;
+  unsigned n_cpus = CPU_COUNT (allowed);
+  unsigned seen = 0;
+  int cpu;
+
+  if (n_cpus == 0)
+    return;
+  k %= n_cpus;
+  for (cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+      if (CPU_ISSET (cpu, allowed) && seen++ == k)
+	break;
+    }
+  CPU_ZERO (&cpus);
+  CPU_SET (cpu, &cpus);
+  pthread_setaffinity_np (thread, sizeof cpus, &cpus);
+}
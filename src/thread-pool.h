@@ -0,0 +1,21 @@
+/*
+ thread-pool.h
+
+ Date Created: Sat Oct 17 14:21:37 2026
+ */
+
+#ifndef __QUI_THREAD_POOL_H__
+#define __QUI_THREAD_POOL_H__ 1
+
+typedef struct ThreadPoolRec *ThreadPool;
+
+/* Called with the index of the task to run and the closure passed to
+   run_thread_pool(). */
+typedef void (* ThreadTask) (unsigned, void *);
+
+extern ThreadPool make_thread_pool (unsigned);
+extern unsigned thread_pool_size (ThreadPool);
+extern void run_thread_pool (ThreadPool, unsigned, ThreadTask, void *);
+extern void destroy_thread_pool (ThreadPool);
+
+#endif /* not __QUI_THREAD_POOL_H__ */
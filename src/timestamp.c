@@ -0,0 +1,107 @@
+/*
+ timestamp.c
+
+ Date Created: Sat Oct 17 22:05:37 2026
+
+ Time stamps for samples
+
+ Samples are time-stamped with CLOCK_MONOTONIC, which never steps,
+ so that differences between time stamps are real intervals even when
+ the wall clock is set.  For display, a time stamp is converted to
+ wall-clock time using one pair of readings of both clocks, the
+ anchor, taken by init_timestamps().  Clock frequency corrections by
+ NTP apply to both clocks alike, so displayed times keep matching
+ time stamps taken with the wall clock, such as those of packet
+ captures, except after the wall clock is stepped.
+
+ Each entry is stamped with the middle of the read() (or recv())
+ call that returned it, because that is when the kernel looked at
+ the socket, and with half of the duration of that call as the bound
+ on the error.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "timestamp.h"
+
+/* how often to try for a tight anchor */
+#define ANCHOR_TRIES 5
+
+static uint64_t anchor_monotonic = 0;
+static uint64_t anchor_realtime = 0;
+
+/* Read the wall clock between two readings of the monotonic clock,
+   and keep the try where those were closest together.  Must be called
+   before any other threads are created. */
+void
+init_timestamps ()
+{
+  struct timespec before, real, after;
+  uint64_t b, a, best = ~(uint64_t) 0;
+  int k;
+
+  for (k = 0; k < ANCHOR_TRIES; ++k)
+    {
+      clock_gettime (CLOCK_MONOTONIC, &before);
+      clock_gettime (CLOCK_REALTIME, &real);
+      clock_gettime (CLOCK_MONOTONIC, &after);
+      b = before.tv_sec * NSECS_PER_SEC + before.tv_nsec;
+      a = after.tv_sec * NSECS_PER_SEC + after.tv_nsec;
+      if (a - b < best)
+	{
+	  best = a - b;
+	  anchor_monotonic = b + (a - b) / 2;
+	  anchor_realtime = real.tv_sec * NSECS_PER_SEC + real.tv_nsec;
+	}
+    }
+}
+
+uint64_t
+monotonic_ns ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * NSECS_PER_SEC + ts.tv_nsec;
+}
+
+/* Convert time stamp TS to wall-clock time, rounded down to the
+   microsecond. */
+void
+timestamp_to_timeval (ts, tv)
+     uint64_t ts;
+     struct timeval *tv;
+{
+  uint64_t real = anchor_realtime + (ts - anchor_monotonic);
+
+  tv->tv_sec = real / NSECS_PER_SEC;
+  tv->tv_usec = (real % NSECS_PER_SEC) / 1000;
+}
+
+/* the current time, on the same scale as converted time stamps */
+void
+current_timeval (tv)
+     struct timeval *tv;
+{
+  timestamp_to_timeval (monotonic_ns (), tv);
+}
+
+/* Stamp PFE as sampled by a call that started at START and ended at
+   END. */
+void
+stamp_entry (pfe, start, end)
+     ProcFileEntry pfe;
+     uint64_t start;
+     uint64_t end;
+{
+  pfe->ts = start + (end - start) / 2;
+  pfe->ts_error = (end - start + 1) / 2 > UINT32_MAX
+    ? UINT32_MAX : (end - start + 1) / 2;
+}
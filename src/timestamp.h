@@ -0,0 +1,21 @@
+/*
+ timestamp.h
+
+ Date Created: Sat Oct 17 22:05:37 2026
+ */
+
+#ifndef __QUI_TIMESTAMP_H__
+#define __QUI_TIMESTAMP_H__ 1
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#define NSECS_PER_SEC 1000000000ULL
+
+extern void init_timestamps (void);
+extern uint64_t monotonic_ns (void);
+extern void timestamp_to_timeval (uint64_t, struct timeval *);
+extern void current_timeval (struct timeval *);
+extern void stamp_entry (ProcFileEntry, uint64_t, uint64_t);
+
+#endif /* not __QUI_TIMESTAMP_H__ */
@@ -0,0 +1,461 @@
+/*
+ top.c
+
+ Date Created: Sat Oct 17 23:41:07 2026
+
+ A full-screen view of the sockets with the fullest queues
+
+ In every round, the K sockets with the largest selected queue are
+ picked with a min-heap of K entries: a socket only costs a comparison
+ with the root unless it beats it, so a round with a million sockets
+ is not much slower than one with a thousand.  At the end of the
+ round, these are merged into a board of K sockets ranked by their
+ recent peak: a peak stays on the board for --peak-hold milliseconds
+ after it was seen, even if the socket has dropped out of the top K
+ since, so that short bursts stay on the screen long enough to be
+ read.  With a hold time of 0, sockets are ranked by what they hold
+ in the current round.  With --owners, the owners of the sockets on
+ the board are looked up, and only theirs.
+
+ The board is handed to a painter thread, which redraws the terminal
+ every --refresh milliseconds, independently of the sampling rate.
+ The sampling thread only tries to take the lock for the copy; if the
+ painter holds it, the board is handed over in the next round
+ instead, so that a slow terminal never delays the sampling.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "history.h"
+#include "sock-table.h"
+#include "owner.h"
+#include "output.h"
+#include "format.h"
+#include "timestamp.h"
+#include "top.h"
+
+typedef struct TopEntryRec *TopEntry;
+
+typedef struct TopEntryRec
+{
+  SockKeyRec	key;
+  char		netns[MAX_NETNS_LABEL];	/* empty for our own namespace */
+  uint32_t	iq;		/* as of seen_ns */
+  uint32_t	oq;
+  uint32_t	peak;		/* of the larger selected queue */
+  uint64_t	seen_ns;	/* round in which iq and oq were seen */
+  uint64_t	peak_ns;	/* round in which the peak was seen */
+  OwnerRec	owner;		/* with --owners, once it is known */
+}
+TopEntryRec;
+
+static void push_heap (ProcFileEntry, uint32_t);
+static void sift_down (unsigned);
+static int compare_keys (const void *, const void *);
+static int compare_ranks (const void *, const void *);
+static void publish_board (void);
+static void *painter (void *);
+static void paint (TopEntry, unsigned, unsigned long, uint64_t);
+static int write_all (const char *, size_t);
+
+static Preferences prefs;
+static unsigned top_count;
+static uint64_t hold_ns;
+
+/* Used by the sampling thread only: the heap of this round, ordered by
+   current occupancy with the smallest at the root, and the board,
+   with room to merge the heap into it. */
+static TopEntry heap = 0;
+static unsigned n_heap = 0;
+static TopEntry board = 0;
+static unsigned n_board = 0;
+static unsigned long n_sockets = 0;
+static uint64_t round_ns = 0;
+
+/* Shared with the painter, under lock. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static TopEntry shown = 0;
+static unsigned n_shown = 0;
+static unsigned long shown_sockets = 0;
+static uint64_t shown_ns = 0;
+
+static pthread_t painter_thread;
+static int stop_fd = -1;
+static int on_terminal = 0;
+
+int
+init_top (p)
+     Preferences p;
+{
+  sigset_t all, saved;
+  int err;
+
+  prefs = p;
+  top_count = p->top_count;
+  hold_ns = (uint64_t) p->peak_hold_ms * 1000000;
+  if ((heap = malloc (top_count * sizeof (TopEntryRec))) == 0
+      || (board = malloc (2 * top_count * sizeof (TopEntryRec))) == 0
+      || (shown = malloc (top_count * sizeof (TopEntryRec))) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      return -1;
+    }
+  if ((stop_fd = eventfd (0, EFD_NONBLOCK)) == -1)
+    {
+      fprintf (stderr, "Cannot create eventfd: %s\n", strerror (errno));
+      return -1;
+    }
+  /* Switch to the alternate screen, and hide the cursor. */
+  if ((on_terminal = isatty (STDOUT_FILENO)))
+    write_all ("\033[?1049h\033[?25l", 14);
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &saved);
+  err = pthread_create (&painter_thread, 0, painter, 0);
+  pthread_sigmask (SIG_SETMASK, &saved, 0);
+  if (err != 0)
+    {
+      fprintf (stderr, "Cannot create painter thread: %s\n", strerror (err));
+      return -1;
+    }
+  return 0;
+}
+
+void
+begin_top_round ()
+{
+  n_heap = 0;
+  n_sockets = 0;
+  round_ns = monotonic_ns ();
+}
+
+void
+update_top (pfe)
+     ProcFileEntry pfe;
+{
+  uint32_t score = 0;
+
+  ++n_sockets;
+  if (prefs->want_input)
+    score = pfe->iq;
+  if (prefs->want_output && pfe->oq > score)
+    score = pfe->oq;
+  if (n_heap == top_count && score <= heap[0].peak)
+    return;
+  push_heap (pfe, score);
+}
+
+/* Merge the heap into the board, and hand the board to the painter
+   if it is not busy. */
+void
+end_top_round ()
+{
+  const OwnerRec *owner;
+  TopEntry e;
+  unsigned k, n;
+
+  /* What is still held, and what was seen in this round. */
+  for (k = n = 0; k < n_board; ++k)
+    if (round_ns - board[k].peak_ns < hold_ns)
+      board[n++] = board[k];
+  for (k = 0; k < n_heap; ++k)
+    board[n++] = heap[k];
+  /* A socket may be on the board and in the heap; keep one entry
+     with the current values of the latter, and the higher peak. */
+  qsort (board, n, sizeof (TopEntryRec), compare_keys);
+  for (k = n_board = 0; k < n; ++k)
+    {
+      if (n_board > 0
+	  && memcmp (&(e = &board[n_board - 1])->key, &board[k].key,
+		     sizeof (SockKeyRec)) == 0)
+	{
+	  if (board[k].seen_ns > e->seen_ns)
+	    {
+	      e->iq = board[k].iq;
+	      e->oq = board[k].oq;
+	      e->seen_ns = board[k].seen_ns;
+	    }
+	  if (board[k].peak >= e->peak)
+	    {
+	      e->peak = board[k].peak;
+	      e->peak_ns = board[k].peak_ns;
+	    }
+	  if (e->owner.pid == 0)
+	    e->owner = board[k].owner;
+	}
+      else
+	board[n_board++] = board[k];
+    }
+  qsort (board, n_board, sizeof (TopEntryRec), compare_ranks);
+  if (n_board > top_count)
+    n_board = top_count;
+  if (prefs->want_owners)
+    for (k = 0; k < n_board; ++k)
+      if (board[k].owner.pid == 0
+	  && (owner = lookup_owner (board[k].key.inode)) != 0)
+	board[k].owner = *owner;
+  publish_board ();
+}
+
+/* Stop the painter, and restore the terminal. */
+void
+finish_top ()
+{
+  uint64_t one = 1;
+
+  if (write (stop_fd, &one, sizeof one) == -1)
+    fprintf (stderr, "Cannot stop painter thread: %s\n", strerror (errno));
+  pthread_join (painter_thread, 0);
+  if (on_terminal)
+    write_all ("\033[?25h\033[?1049l", 14);
+  close (stop_fd);
+  free (heap);
+  free (board);
+  free (shown);
+}
+
+static void
+push_heap (pfe, score)
+     ProcFileEntry pfe;
+     uint32_t score;
+{
+  TopEntry e;
+  unsigned k;
+  int replace = n_heap == top_count;
+
+  if (!replace)
+    {
+      /* Sift the new entry up from the bottom. */
+      for (k = n_heap++; k > 0 && heap[(k - 1) / 2].peak > score;
+	   k = (k - 1) / 2)
+	heap[k] = heap[(k - 1) / 2];
+    }
+  else
+    k = 0;
+  e = &heap[k];
+  sock_key_from_entry (&e->key, pfe);
+  if (pfe->netns)
+    {
+      strncpy (e->netns, pfe->netns, MAX_NETNS_LABEL - 1);
+      e->netns[MAX_NETNS_LABEL - 1] = 0;
+    }
+  else
+    e->netns[0] = 0;
+  e->iq = pfe->iq;
+  e->oq = pfe->oq;
+  e->peak = score;
+  e->seen_ns = e->peak_ns = round_ns;
+  e->owner.pid = 0;
+  /* The new entry took the place of the root. */
+  if (replace)
+    sift_down (0);
+}
+
+static void
+sift_down (k)
+     unsigned k;
+{
+  TopEntryRec e = heap[k];
+  unsigned child;
+
+  for (; (child = 2 * k + 1) < n_heap; k = child)
+    {
+      if (child + 1 < n_heap && heap[child + 1].peak < heap[child].peak)
+	++child;
+      if (heap[child].peak >= e.peak)
+	break;
+      heap[k] = heap[child];
+    }
+  heap[k] = e;
+}
+
+static int
+compare_keys (a, b)
+     const void *a;
+     const void *b;
+{
+  return memcmp (&((const TopEntryRec *) a)->key,
+		 &((const TopEntryRec *) b)->key, sizeof (SockKeyRec));
+}
+
+/* Highest peak first, then highest current occupancy. */
+static int
+compare_ranks (a, b)
+     const void *a;
+     const void *b;
+{
+  const TopEntryRec *x = (const TopEntryRec *) a;
+  const TopEntryRec *y = (const TopEntryRec *) b;
+  uint32_t xq = x->iq > x->oq ? x->iq : x->oq;
+  uint32_t yq = y->iq > y->oq ? y->iq : y->oq;
+
+  if (x->peak != y->peak)
+    return x->peak > y->peak ? -1 : 1;
+  if (x->seen_ns != y->seen_ns)
+    return x->seen_ns > y->seen_ns ? -1 : 1;
+  return xq > yq ? -1 : xq < yq;
+}
+
+static void
+publish_board ()
+{
+  if (pthread_mutex_trylock (&lock) != 0)
+    return;
+  memcpy (shown, board, n_board * sizeof (TopEntryRec));
+  n_shown = n_board;
+  shown_sockets = n_sockets;
+  shown_ns = round_ns;
+  pthread_mutex_unlock (&lock);
+}
+
+static void *
+painter (arg)
+     void *arg;
+{
+  TopEntry entries;
+  unsigned n;
+  unsigned long sockets;
+  uint64_t ns;
+  struct pollfd pfd;
+
+  if ((entries = malloc (top_count * sizeof (TopEntryRec))) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      return 0;
+    }
+  pfd.fd = stop_fd;
+  pfd.events = POLLIN;
+  for (;;)
+    {
+      pthread_mutex_lock (&lock);
+      memcpy (entries, shown, n_shown * sizeof (TopEntryRec));
+      n = n_shown;
+      sockets = shown_sockets;
+      ns = shown_ns;
+      pthread_mutex_unlock (&lock);
+      if (ns != 0)
+	paint (entries, n, sockets, ns);
+      if (poll (&pfd, 1, prefs->refresh_ms) > 0)
+	break;
+    }
+  free (entries);
+  return 0;
+}
+
+/* Redraw the screen from the top left corner, clearing each line after
+   its text, and whatever is left below.  Lines are cut off at the
+   width of the terminal, so that nothing wraps around. */
+static void
+paint (entries, n, sockets, ns)
+     TopEntry entries;
+     unsigned n;
+     unsigned long sockets;
+     uint64_t ns;
+{
+  struct winsize ws;
+  unsigned rows = 24, cols = 80, k, width;
+  char *frame, *cp, line[64 + 3 * MAX_ENDPOINT_STRING + MAX_NETNS_LABEL
+					  + MAX_COMM];
+  char *lp, when[16];
+  struct timeval tv;
+  struct tm tm;
+  TopEntry e;
+  uint64_t age;
+
+  if (ioctl (STDOUT_FILENO, TIOCGWINSZ, &ws) == 0
+      && ws.ws_row > 0 && ws.ws_col > 0)
+    {
+      rows = ws.ws_row;
+      cols = ws.ws_col;
+    }
+  if ((frame = malloc (rows * (cols + 8) + 16)) == 0)
+    return;
+  cp = frame;
+  memcpy (cp, "\033[H", 3);
+  cp += 3;
+  timestamp_to_timeval (ns, &tv);
+  if (localtime_r (&tv.tv_sec, &tm) == 0
+      || strftime (when, sizeof when, "%H:%M:%S", &tm) == 0)
+    strcpy (when, "??:??:??");
+  for (k = 0; k < rows - 1 && k < n + 2; ++k)
+    {
+      if (k == 0 && hold_ns == 0)
+	snprintf (line, sizeof line, "qui  %s  %lu sockets with data, "
+		  "top %u by current occupancy", when, sockets, top_count);
+      else if (k == 0)
+	snprintf (line, sizeof line, "qui  %s  %lu sockets with data, "
+		  "top %u by peak over %u ms",
+		  when, sockets, top_count, prefs->peak_hold_ms);
+      else if (k == 1)
+	snprintf (line, sizeof line, "%10s %10s %10s %7s  %s",
+		  "Recv-Q", "Send-Q", "Peak", "Age", "Local Remote");
+      else
+	{
+	  e = &entries[k - 2];
+	  age = ns - e->peak_ns;
+	  lp = line;
+	  if (e->seen_ns == ns)
+	    lp += sprintf (lp, "%10lu %10lu ",
+			   (unsigned long) e->iq, (unsigned long) e->oq);
+	  else
+	    lp += sprintf (lp, "%10s %10s ", "-", "-");
+	  lp += sprintf (lp, "%10lu %6.1fs  ", (unsigned long) e->peak,
+			 age / 1e9);
+	  lp = format_endpoint (lp, e->key.af, e->key.laddr, e->key.lport);
+	  *lp++ = ' ';
+	  lp = format_endpoint (lp, e->key.af, e->key.raddr, e->key.rport);
+	  if (e->netns[0])
+	    lp += sprintf (lp, " [%s]", e->netns);
+	  if (e->owner.pid != 0)
+	    lp += sprintf (lp, " %lu/%s", (unsigned long) e->owner.pid,
+			   e->owner.comm);
+	  *lp = 0;
+	}
+      width = strlen (line);
+      if (width > cols)
+	width = cols;
+      memcpy (cp, line, width);
+      cp += width;
+      memcpy (cp, "\033[K\n", 4);
+      cp += 4;
+    }
+  memcpy (cp, "\033[J", 3);
+  cp += 3;
+  write_all (frame, cp - frame);
+  free (frame);
+}
+
+static int
+write_all (buf, len)
+     const char *buf;
+     size_t len;
+{
+  ssize_t n;
+
+  while (len > 0)
+    {
+      if ((n = write (STDOUT_FILENO, buf, len)) == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      buf += n;
+      len -= n;
+    }
+  return 0;
+}
@@ -0,0 +1,16 @@
+/*
+ top.h
+
+ Date Created: Sat Oct 17 23:41:07 2026
+ */
+
+#ifndef __QUI_TOP_H__
+#define __QUI_TOP_H__ 1
+
+extern int init_top (Preferences);
+extern void begin_top_round (void);
+extern void update_top (ProcFileEntry);
+extern void end_top_round (void);
+extern void finish_top (void);
+
+#endif /* not __QUI_TOP_H__ */
@@ -0,0 +1,1121 @@
+/*
+ trace.c
+
+ Date Created: Sat Oct 17 18:40:52 2026
+
+ Recording output records in a compact binary trace file, and
+ playing them back
+
+ A trace file starts with a 16-byte file header, followed by blocks.
+ Each block has a 40-byte header and a payload of up to about 64 KB
+ of records, and can be decoded on its own: each socket is defined
+ in a block the first time it is used there, and referred to by its
+ number within the block afterwards.  A record stores its time stamp
+ as the difference to that of the previous record, and the queue
+ sizes as the differences to those in the previous record of the
+ same socket, all as variable-length integers, so that a typical
+ sample takes five or six bytes, and two or three more for the bound
+ on the error of its time stamp.
+
+ Blocks are appended with one write() each, when they are full, or at
+ the end of a batch when they are more than a second old.  When the
+ writer is closed, an index of all blocks with their time ranges is
+ appended, followed by a trailer that points to it.  Replay reads the
+ index, and then only the blocks that overlap the requested time
+ range.  If there is no index because qui was not stopped cleanly,
+ it is rebuilt by hopping from block header to block header, and a
+ torn block at the end is ignored.  Recording into an existing trace
+ file removes the index and any torn block, and appends to it.
+
+ All integers in headers are little-endian.  Version 2 added the drop
+ counts of --drops, version 3 the owners of --owners, which are part
+ of the definition of a socket; a socket is defined again when its
+ owner becomes known, and version 4 the bound on the error of the time
+ stamp of an entry, in nanoseconds.  Since the time stamps themselves
+ are kept in microseconds, the bound says whether two samples a few
+ microseconds apart can be told apart at all.  Files of older versions
+ can be replayed and appended to, and are marked as the current
+ version when they are.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "preferences.h"
+#include "proc-net.h"
+#include "history.h"
+#include "sock-table.h"
+#include "events.h"
+#include "output.h"
+#include "trace.h"
+#include "timestamp.h"
+
+#define TRACE_VERSION		4
+
+#define FILE_HEADER_SIZE	16
+#define BLOCK_HEADER_SIZE	40
+#define INDEX_HEADER_SIZE	8
+#define INDEX_ENTRY_SIZE	24
+#define TRAILER_SIZE		16
+
+/* A block is written when its payload has reached this size... */
+#define TRACE_BLOCK_SIZE	(64 * 1024)
+/* ...or at the end of a batch when its first record is older than
+   this many microseconds. */
+#define TRACE_BLOCK_AGE		1000000
+
+/* more than any record can take, with the definition of its socket */
+#define MAX_TRACE_RECORD	512
+
+/* Record tags have the kind in the low two bits, and flags above. */
+#define TAG_DEFINE	0
+#define TAG_ENTRY	1
+#define TAG_BURST	2
+#define TAG_DROPS	3	/* a round with UDP drops, without a socket */
+#define TAG_KIND	3
+#define TAG_OWNER	4	/* definitions: the owner follows */
+#define TAG_PEAK	4	/* entries: the peak follows */
+#define TAG_FULL	8	/* entries: the number of drops follows */
+#define TAG_LOST	16	/* entries: the packets lost since the last
+				   round follow */
+#define TAG_ERROR	32	/* entries: the error of the time stamp
+				   follows */
+#define TAG_OUTPUT	4	/* bursts: on the output queue */
+
+typedef struct TraceBlockRec *TraceBlock;
+typedef struct TraceSockRec *TraceSock;
+typedef struct TraceDefRec *TraceDef;
+
+/* an entry of the block index */
+typedef struct TraceBlockRec
+{
+  uint64_t	offset;
+  int64_t	min_ts;		/* in microseconds since the epoch */
+  int64_t	max_ts;
+}
+TraceBlockRec;
+
+/* what the writer keeps for each socket */
+typedef struct TraceSockRec
+{
+  uint32_t	block;		/* the block in which `id' is defined */
+  uint32_t	id;
+  uint32_t	iq;		/* as last recorded in that block */
+  uint32_t	oq;
+  uint32_t	pid;		/* of the owner in that definition */
+}
+TraceSockRec;
+
+/* what replay keeps for each socket defined in the current block */
+typedef struct TraceDefRec
+{
+  SockKeyRec	key;
+  uint32_t	iq;
+  uint32_t	oq;
+  char		netns[MAX_NETNS_LABEL];
+  OwnerRec	owner;
+}
+TraceDefRec;
+
+typedef struct TraceWriterRec
+{
+  int		fd;
+  const char   *pathname;
+  uint64_t	end;		/* where the next block goes */
+  SockTable	sockets;
+  uint32_t	block_no;	/* never 0 */
+  unsigned	n_sockets;	/* defined in the current block */
+  unsigned	n_records;
+  int64_t	base_ts;	/* of the first record in the block */
+  int64_t	min_ts;
+  int64_t	max_ts;
+  int64_t	prev_ts;
+  unsigned char *buf;		/* block header, then payload */
+  size_t	len;		/* of the payload */
+  TraceBlock	index;
+  unsigned	n_blocks;
+  unsigned	index_size;
+  int		failed;
+}
+TraceWriterRec;
+
+static void destroy_trace_writer (TraceWriter);
+static void write_block (TraceWriter);
+static uint64_t note_record_ts (TraceWriter, int64_t);
+static long intern_trace_sock (TraceWriter, const SockKeyRec *, int *);
+static int check_file_header (int, const char *);
+static int load_index (int, const char *, uint64_t,
+		       TraceBlock *, unsigned *, unsigned *, uint64_t *);
+static int add_index_entry (TraceBlock *, unsigned *, unsigned *,
+			    uint64_t, int64_t, int64_t);
+static int decode_block (const unsigned char *, size_t, unsigned, int64_t,
+			 TraceDef, int64_t, int64_t, TraceCallback, void *);
+static int parse_trace_time (const char *, int64_t, int64_t *);
+static int read_fully (int, void *, size_t, uint64_t);
+static int write_fully (int, const void *, size_t);
+static unsigned char *put_varint (unsigned char *, uint64_t);
+static int get_varint (const unsigned char **, const unsigned char *,
+		       uint64_t *);
+static void put_u32 (unsigned char *, uint32_t);
+static void put_u64 (unsigned char *, uint64_t);
+static uint32_t get_u32 (const unsigned char *);
+static uint64_t get_u64 (const unsigned char *);
+static int64_t timeval_to_ts (const struct timeval *);
+static void ts_to_timeval (int64_t, struct timeval *);
+
+static const char file_magic[8] = "QUITRACE";
+
+#define ZIGZAG(v)	(((uint64_t) (v) << 1) ^ (uint64_t) ((int64_t) (v) >> 63))
+#define UNZIGZAG(u)	((int64_t) ((u) >> 1) ^ -(int64_t) ((u) & 1))
+
+/* Open PATHNAME for recording, creating it if needed.  Up to
+   MAX_SOCKETS sockets are kept track of at once. */
+TraceWriter
+open_trace_writer (pathname, max_sockets)
+     const char *pathname;
+     unsigned max_sockets;
+{
+  TraceWriter w;
+  unsigned char header[FILE_HEADER_SIZE];
+  struct stat st;
+
+  if ((w = calloc (1, sizeof (TraceWriterRec))) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      return 0;
+    }
+  w->fd = -1;
+  w->pathname = pathname;
+  w->block_no = 1;
+  if ((w->buf = malloc (BLOCK_HEADER_SIZE + TRACE_BLOCK_SIZE
+			+ MAX_TRACE_RECORD)) == 0)
+    {
+      fprintf (stderr, "Out of memory\n");
+      destroy_trace_writer (w);
+      return 0;
+    }
+  if ((w->sockets = make_sock_table (max_sockets, sizeof (TraceSockRec))) == 0)
+    {
+      destroy_trace_writer (w);
+      return 0;
+    }
+  if ((w->fd = open (pathname, O_RDWR|O_CREAT, 0644)) == -1
+      || fstat (w->fd, &st) == -1)
+    {
+      fprintf (stderr, "Cannot open trace file %s: %s\n",
+	       pathname, strerror (errno));
+      destroy_trace_writer (w);
+      return 0;
+    }
+  if (st.st_size == 0)
+    {
+      memcpy (header, file_magic, 8);
+      put_u32 (header + 8, TRACE_VERSION);
+      put_u32 (header + 12, 0);
+      if (write_fully (w->fd, header, FILE_HEADER_SIZE) != 0)
+	{
+	  fprintf (stderr, "Cannot write trace file %s: %s\n",
+		   pathname, strerror (errno));
+	  destroy_trace_writer (w);
+	  return 0;
+	}
+      w->end = FILE_HEADER_SIZE;
+      return w;
+    }
+  if (check_file_header (w->fd, pathname) != 0
+      || load_index (w->fd, pathname, st.st_size,
+		     &w->index, &w->n_blocks, &w->index_size, &w->end) != 0)
+    {
+      destroy_trace_writer (w);
+      return 0;
+    }
+  put_u32 (header, TRACE_VERSION);
+  if (ftruncate (w->fd, w->end) == -1
+      || pwrite (w->fd, header, 4, 8) != 4
+      || lseek (w->fd, w->end, SEEK_SET) == (off_t) -1)
+    {
+      fprintf (stderr, "Cannot append to trace file %s: %s\n",
+	       pathname, strerror (errno));
+      destroy_trace_writer (w);
+      return 0;
+    }
+  return w;
+}
+
+/* Add REC to the current block, and write the block if it is full. */
+void
+trace_record (w, rec)
+     TraceWriter w;
+     OutputRecord rec;
+{
+  unsigned char *cp;
+  TraceSock s;
+  int64_t ts;
+  long i;
+  int is_new, tag;
+
+  if (w->failed)
+    return;
+  if (rec->type == RECORD_DROPS)
+    {
+      ts = timeval_to_ts (&(rec->u.drops.tv));
+      cp = w->buf + BLOCK_HEADER_SIZE + w->len;
+      *cp++ = TAG_DROPS;
+      cp = put_varint (cp, note_record_ts (w, ts));
+      cp = put_varint (cp, rec->u.drops.in_errors);
+      cp = put_varint (cp, rec->u.drops.rcvbuf_errors);
+      cp = put_varint (cp, rec->u.drops.lost);
+      cp = put_varint (cp, rec->u.drops.n_sockets);
+      cp = put_varint (cp, rec->u.drops.total_iq);
+      cp = put_varint (cp, rec->u.drops.max_iq);
+      w->len = cp - (w->buf + BLOCK_HEADER_SIZE);
+      if (w->len >= TRACE_BLOCK_SIZE)
+	write_block (w);
+      return;
+    }
+  if ((i = intern_trace_sock (w, &(rec->key), &is_new)) == -1)
+    return;
+  s = (TraceSock) sock_value (w->sockets, i);
+  cp = w->buf + BLOCK_HEADER_SIZE + w->len;
+  if (is_new || s->block != w->block_no || s->pid != rec->owner.pid)
+    {
+      const SockKeyRec *k = &(rec->key);
+      unsigned alen = k->af == AF_INET6 ? 16 : 4;
+      size_t nlen = strlen (rec->netns);
+
+      *cp++ = TAG_DEFINE | (rec->owner.pid != 0 ? TAG_OWNER : 0);
+      *cp++ = k->af;
+      *cp++ = k->proto;
+      cp = put_varint (cp, k->lport);
+      cp = put_varint (cp, k->rport);
+      cp = put_varint (cp, k->inode);
+      memcpy (cp, k->laddr, alen);
+      memcpy (cp + alen, k->raddr, alen);
+      cp += 2 * alen;
+      *cp++ = nlen;
+      memcpy (cp, rec->netns, nlen);
+      cp += nlen;
+      if (rec->owner.pid != 0)
+	{
+	  cp = put_varint (cp, rec->owner.pid);
+	  nlen = strnlen (rec->owner.comm, MAX_COMM - 1);
+	  *cp++ = nlen;
+	  memcpy (cp, rec->owner.comm, nlen);
+	  cp += nlen;
+	  nlen = strnlen (rec->owner.cgroup, MAX_CGROUP - 1);
+	  *cp++ = nlen;
+	  memcpy (cp, rec->owner.cgroup, nlen);
+	  cp += nlen;
+	}
+      s->block = w->block_no;
+      s->pid = rec->owner.pid;
+      s->id = w->n_sockets++;
+      s->iq = 0;
+      s->oq = 0;
+    }
+  ts = timeval_to_ts (rec->type == RECORD_BURST
+		      ? &(rec->u.burst.ev.e_ts) : &(rec->u.entry.tv));
+  if (rec->type == RECORD_BURST)
+    tag = TAG_BURST | (rec->which == BURST_OUTPUT ? TAG_OUTPUT : 0);
+  else
+    tag = TAG_ENTRY | (rec->have_peak ? TAG_PEAK : 0)
+      | (rec->have_peak && rec->u.entry.full > 0 ? TAG_FULL : 0)
+      | (rec->u.entry.lost > 0 ? TAG_LOST : 0)
+      | (rec->u.entry.ts_error > 0 ? TAG_ERROR : 0);
+  *cp++ = tag;
+  cp = put_varint (cp, note_record_ts (w, ts));
+  cp = put_varint (cp, s->id);
+  cp = put_varint (cp, ZIGZAG ((int64_t) rec->iq - s->iq));
+  cp = put_varint (cp, ZIGZAG ((int64_t) rec->oq - s->oq));
+  s->iq = rec->iq;
+  s->oq = rec->oq;
+  if (rec->type == RECORD_BURST)
+    {
+      BufferEvent ev = &(rec->u.burst.ev);
+      uint64_t bits;
+
+      cp = put_varint (cp, ev->s_occ);
+      cp = put_varint (cp, ev->m_occ);
+      cp = put_varint (cp, ev->e_occ);
+      cp = put_varint (cp, ZIGZAG (ts - timeval_to_ts (&(ev->s_ts))));
+      cp = put_varint (cp, ZIGZAG (ts - timeval_to_ts (&(ev->m_ts))));
+      memcpy (&bits, &(rec->u.burst.byte_seconds), 8);
+      put_u64 (cp, bits);
+      cp += 8;
+    }
+  else
+    {
+      if (tag & TAG_PEAK)
+	cp = put_varint (cp, rec->u.entry.peak);
+      if (tag & TAG_FULL)
+	cp = put_varint (cp, rec->u.entry.full);
+      if (tag & TAG_LOST)
+	cp = put_varint (cp, rec->u.entry.lost);
+      if (tag & TAG_ERROR)
+	cp = put_varint (cp, rec->u.entry.ts_error);
+    }
+  w->len = cp - (w->buf + BLOCK_HEADER_SIZE);
+  if (w->len >= TRACE_BLOCK_SIZE)
+    write_block (w);
+}
+
+/* Account for a record at TS in the current block, and return the
+   difference to the previous record, as it is stored. */
+static uint64_t
+note_record_ts (w, ts)
+     TraceWriter w;
+     int64_t ts;
+{
+  int64_t prev_ts = w->prev_ts;
+
+  if (w->n_records++ == 0)
+    w->base_ts = w->min_ts = w->max_ts = prev_ts = ts;
+  if (ts < w->min_ts)
+    w->min_ts = ts;
+  if (ts > w->max_ts)
+    w->max_ts = ts;
+  w->prev_ts = ts;
+  return ZIGZAG (ts - prev_ts);
+}
+
+/* Called after each batch of records: write the current block if its
+   first record is more than TRACE_BLOCK_AGE old, so that a crash does
+   not lose much. */
+void
+end_trace_batch (w)
+     TraceWriter w;
+{
+  struct timeval now;
+
+  current_timeval (&now);
+  if (w->n_records > 0 && timeval_to_ts (&now) - w->base_ts >= TRACE_BLOCK_AGE)
+    write_block (w);
+}
+
+/* Write the last block and the index, and close the file. */
+int
+close_trace_writer (w)
+     TraceWriter w;
+{
+  unsigned char *index;
+  size_t len;
+  unsigned k;
+  int result = 0;
+
+  write_block (w);
+  if (!w->failed)
+    {
+      len = INDEX_HEADER_SIZE + w->n_blocks * INDEX_ENTRY_SIZE + TRAILER_SIZE;
+      if ((index = malloc (len)) == 0)
+	{
+	  fprintf (stderr, "Out of memory\n");
+	  destroy_trace_writer (w);
+	  return -1;
+	}
+      memcpy (index, "QIDX", 4);
+      put_u32 (index + 4, w->n_blocks);
+      for (k = 0; k < w->n_blocks; ++k)
+	{
+	  unsigned char *ep = index + INDEX_HEADER_SIZE + k * INDEX_ENTRY_SIZE;
+
+	  put_u64 (ep, w->index[k].offset);
+	  put_u64 (ep + 8, w->index[k].min_ts);
+	  put_u64 (ep + 16, w->index[k].max_ts);
+	}
+      put_u64 (index + len - TRAILER_SIZE, w->end);
+      memcpy (index + len - TRAILER_SIZE + 8, "QEND", 4);
+      put_u32 (index + len - 4, w->n_blocks);
+      if (write_fully (w->fd, index, len) != 0)
+	{
+	  fprintf (stderr, "Cannot write index to trace file %s: %s\n",
+		   w->pathname, strerror (errno));
+	  result = -1;
+	}
+      free (index);
+    }
+  if (close (w->fd) == -1)
+    {
+      fprintf (stderr, "Cannot close trace file %s: %s\n",
+	       w->pathname, strerror (errno));
+      result = -1;
+    }
+  w->fd = -1;
+  destroy_trace_writer (w);
+  return result;
+}
+
+/* Pass the records of trace file PATHNAME whose time stamps are
+   between FROM and UNTIL, if given, to CALLBACK. */
+int
+replay_trace (pathname, from, until, callback, closure)
+     const char *pathname;
+     const char *from;
+     const char *until;
+     TraceCallback callback;
+     void *closure;
+{
+  TraceBlock index = 0;
+  TraceDef defs = 0;
+  unsigned char header[BLOCK_HEADER_SIZE];
+  unsigned char *payload = 0;
+  unsigned n_blocks = 0, index_size = 0, n_defs = 0, n_sockets, k;
+  size_t payload_size = 0, len;
+  uint64_t end;
+  int64_t from_ts = INT64_MIN, until_ts = INT64_MAX;
+  struct stat st;
+  int fd, result = 0;
+
+  if ((fd = open (pathname, O_RDONLY)) == -1 || fstat (fd, &st) == -1)
+    {
+      fprintf (stderr, "Cannot open trace file %s: %s\n",
+	       pathname, strerror (errno));
+      return -1;
+    }
+  if (check_file_header (fd, pathname) != 0
+      || load_index (fd, pathname, st.st_size,
+		     &index, &n_blocks, &index_size, &end) != 0)
+    {
+      close (fd);
+      return -1;
+    }
+  if (n_blocks > 0
+      && ((from && parse_trace_time (from, index[0].min_ts, &from_ts) != 0)
+	  || (until && parse_trace_time (until, index[0].min_ts, &until_ts) != 0)))
+    {
+      free (index);
+      close (fd);
+      return -1;
+    }
+  for (k = 0; k < n_blocks; ++k)
+    {
+      if (index[k].max_ts < from_ts || index[k].min_ts > until_ts)
+	continue;
+      if (read_fully (fd, header, BLOCK_HEADER_SIZE, index[k].offset) != 0)
+	goto corrupt;
+      len = get_u32 (header + 4);
+      n_sockets = get_u32 (header + 12);
+      if (memcmp (header, "QBLK", 4) != 0
+	  || index[k].offset + BLOCK_HEADER_SIZE + len > end
+	  || n_sockets > len)
+	goto corrupt;
+      if (len > payload_size)
+	{
+	  free (payload);
+	  if ((payload = malloc (len)) == 0)
+	    {
+	      fprintf (stderr, "Out of memory\n");
+	      result = -1;
+	      break;
+	    }
+	  payload_size = len;
+	}
+      if (n_sockets > n_defs)
+	{
+	  free (defs);
+	  if ((defs = malloc (n_sockets * sizeof (TraceDefRec))) == 0)
+	    {
+	      fprintf (stderr, "Out of memory\n");
+	      result = -1;
+	      break;
+	    }
+	  n_defs = n_sockets;
+	}
+      if (read_fully (fd, payload, len, index[k].offset + BLOCK_HEADER_SIZE) != 0
+	  || decode_block (payload, len, n_sockets, get_u64 (header + 16), defs,
+			   from_ts, until_ts, callback, closure) != 0)
+	goto corrupt;
+      continue;
+    corrupt:
+      fprintf (stderr, "Skipping corrupt block at offset %llu in %s\n",
+	       (unsigned long long) index[k].offset, pathname);
+    }
+  free (defs);
+  free (payload);
+  free (index);
+  close (fd);
+  return result;
+}
+
+static void
+destroy_trace_writer (w)
+     TraceWriter w;
+{
+  if (w->fd != -1)
+    close (w->fd);
+  if (w->sockets)
+    destroy_sock_table (w->sockets);
+  free (w->index);
+  free (w->buf);
+  free (w);
+}
+
+static void
+write_block (w)
+     TraceWriter w;
+{
+  unsigned char *hp = w->buf;
+
+  if (w->n_records == 0)
+    return;
+  memcpy (hp, "QBLK", 4);
+  put_u32 (hp + 4, w->len);
+  put_u32 (hp + 8, w->n_records);
+  put_u32 (hp + 12, w->n_sockets);
+  put_u64 (hp + 16, w->base_ts);
+  put_u64 (hp + 24, w->min_ts);
+  put_u64 (hp + 32, w->max_ts);
+  if (write_fully (w->fd, w->buf, BLOCK_HEADER_SIZE + w->len) != 0)
+    {
+      fprintf (stderr, "Cannot write trace file %s: %s; recording stopped\n",
+	       w->pathname, strerror (errno));
+      w->failed = 1;
+    }
+  else if (add_index_entry (&w->index, &w->n_blocks, &w->index_size,
+			    w->end, w->min_ts, w->max_ts) != 0)
+    w->failed = 1;
+  w->end += BLOCK_HEADER_SIZE + w->len;
+  w->len = 0;
+  w->n_records = 0;
+  w->n_sockets = 0;
+  if (++w->block_no == 0)
+    w->block_no = 1;
+  advance_sock_table (w->sockets);
+}
+
+/* Look socket K up in the writer's table.  When the table is full,
+   the sockets not used in the current block are thrown out, and if
+   that is not enough, the block is written so that all of them can
+   go. */
+static long
+intern_trace_sock (w, k, newp)
+     TraceWriter w;
+     const SockKeyRec *k;
+     int *newp;
+{
+  long i;
+
+  if ((i = intern_sock (w->sockets, k, newp)) != -1)
+    return i;
+  sweep_sock_table (w->sockets, 0, 0);
+  if ((i = intern_sock (w->sockets, k, newp)) != -1)
+    return i;
+  write_block (w);
+  sweep_sock_table (w->sockets, 0, 0);
+  return intern_sock (w->sockets, k, newp);
+}
+
+static int
+check_file_header (fd, pathname)
+     int fd;
+     const char *pathname;
+{
+  unsigned char header[FILE_HEADER_SIZE];
+
+  if (read_fully (fd, header, FILE_HEADER_SIZE, 0) != 0
+      || memcmp (header, file_magic, 8) != 0)
+    {
+      fprintf (stderr, "%s is not a qui trace file\n", pathname);
+      return -1;
+    }
+  if (get_u32 (header + 8) < 1 || get_u32 (header + 8) > TRACE_VERSION)
+    {
+      fprintf (stderr, "%s has unsupported trace version %lu\n",
+	       pathname, (unsigned long) get_u32 (header + 8));
+      return -1;
+    }
+  return 0;
+}
+
+/* Read the block index of the trace file open on FD, which is SIZE
+   bytes long, from its end, or rebuild it from the block headers if
+   it is not there.  *ENDP is set to the end of the last complete
+   block. */
+static int
+load_index (fd, pathname, size, indexp, np, sizep, endp)
+     int fd;
+     const char *pathname;
+     uint64_t size;
+     TraceBlock *indexp;
+     unsigned *np;
+     unsigned *sizep;
+     uint64_t *endp;
+{
+  unsigned char buf[BLOCK_HEADER_SIZE];
+  unsigned char *index;
+  uint64_t offset, len;
+  unsigned n, k;
+
+  *indexp = 0;
+  *np = *sizep = 0;
+  if (size >= FILE_HEADER_SIZE + INDEX_HEADER_SIZE + TRAILER_SIZE
+      && read_fully (fd, buf, TRAILER_SIZE, size - TRAILER_SIZE) == 0
+      && memcmp (buf + 8, "QEND", 4) == 0)
+    {
+      offset = get_u64 (buf);
+      n = get_u32 (buf + 12);
+      len = INDEX_HEADER_SIZE + (uint64_t) n * INDEX_ENTRY_SIZE;
+      if (offset >= FILE_HEADER_SIZE && offset + len + TRAILER_SIZE == size)
+	{
+	  if ((index = malloc (len)) == 0)
+	    {
+	      fprintf (stderr, "Out of memory\n");
+	      return -1;
+	    }
+	  if (read_fully (fd, index, len, offset) == 0
+	      && memcmp (index, "QIDX", 4) == 0 && get_u32 (index + 4) == n)
+	    {
+	      for (k = 0; k < n; ++k)
+		{
+		  unsigned char *ep = index + INDEX_HEADER_SIZE + k * INDEX_ENTRY_SIZE;
+
+		  if (add_index_entry (indexp, np, sizep, get_u64 (ep),
+				       get_u64 (ep + 8), get_u64 (ep + 16)) != 0)
+		    {
+		      free (index);
+		      return -1;
+		    }
+		}
+	      free (index);
+	      *endp = offset;
+	      return 0;
+	    }
+	  free (index);
+	}
+    }
+  if (size > FILE_HEADER_SIZE)
+    fprintf (stderr, "No index in trace file %s, scanning it\n", pathname);
+  for (offset = FILE_HEADER_SIZE;
+       offset + BLOCK_HEADER_SIZE <= size;
+       offset += BLOCK_HEADER_SIZE + len)
+    {
+      if (read_fully (fd, buf, BLOCK_HEADER_SIZE, offset) != 0
+	  || memcmp (buf, "QBLK", 4) != 0)
+	break;
+      len = get_u32 (buf + 4);
+      if (offset + BLOCK_HEADER_SIZE + len > size)
+	break;
+      if (add_index_entry (indexp, np, sizep, offset,
+			   get_u64 (buf + 24), get_u64 (buf + 32)) != 0)
+	return -1;
+    }
+  *endp = offset;
+  return 0;
+}
+
+static int
+add_index_entry (indexp, np, sizep, offset, min_ts, max_ts)
+     TraceBlock *indexp;
+     unsigned *np;
+     unsigned *sizep;
+     uint64_t offset;
+     int64_t min_ts;
+     int64_t max_ts;
+{
+  TraceBlock b;
+
+  if (*np == *sizep)
+    {
+      unsigned size = *sizep ? *sizep * 2 : 256;
+
+      if ((b = realloc (*indexp, size * sizeof (TraceBlockRec))) == 0)
+	{
+	  fprintf (stderr, "Out of memory\n");
+	  return -1;
+	}
+      *indexp = b;
+      *sizep = size;
+    }
+  b = &((*indexp)[(*np)++]);
+  b->offset = offset;
+  b->min_ts = min_ts;
+  b->max_ts = max_ts;
+  return 0;
+}
+
+/* Decode the LEN bytes of block payload at BUF, which defines
+   N_SOCKETS sockets into DEFS, and pass the records between FROM_TS
+   and UNTIL_TS to CALLBACK.  Returns -1 if the block is malformed. */
+static int
+decode_block (buf, len, n_sockets, base_ts, defs,
+	      from_ts, until_ts, callback, closure)
+     const unsigned char *buf;
+     size_t len;
+     unsigned n_sockets;
+     int64_t base_ts;
+     TraceDef defs;
+     int64_t from_ts;
+     int64_t until_ts;
+     TraceCallback callback;
+     void *closure;
+{
+  const unsigned char *cp = buf, *end = buf + len;
+  OutputRecordRec rec;
+  TraceDef d;
+  int64_t ts = base_ts;
+  uint64_t v, lport, rport, inode, id, diq, doq;
+  unsigned n_defined = 0, alen, nlen;
+  int tag;
+
+  while (cp < end)
+    {
+      tag = *cp++;
+      if ((tag & TAG_KIND) == TAG_DEFINE)
+	{
+	  if (n_defined >= n_sockets || end - cp < 2)
+	    return -1;
+	  d = &defs[n_defined++];
+	  memset (&(d->key), 0, sizeof (SockKeyRec));
+	  d->key.af = *cp++;
+	  d->key.proto = *cp++;
+	  if ((d->key.af != AF_INET && d->key.af != AF_INET6)
+	      || get_varint (&cp, end, &lport) != 0
+	      || get_varint (&cp, end, &rport) != 0
+	      || get_varint (&cp, end, &inode) != 0)
+	    return -1;
+	  d->key.lport = lport;
+	  d->key.rport = rport;
+	  d->key.inode = inode;
+	  alen = d->key.af == AF_INET6 ? 16 : 4;
+	  if (end - cp < 2 * alen + 1)
+	    return -1;
+	  memcpy (d->key.laddr, cp, alen);
+	  memcpy (d->key.raddr, cp + alen, alen);
+	  cp += 2 * alen;
+	  nlen = *cp++;
+	  if (nlen >= MAX_NETNS_LABEL || end - cp < nlen)
+	    return -1;
+	  memcpy (d->netns, cp, nlen);
+	  d->netns[nlen] = 0;
+	  cp += nlen;
+	  memset (&(d->owner), 0, sizeof (OwnerRec));
+	  if (tag & TAG_OWNER)
+	    {
+	      if (get_varint (&cp, end, &v) != 0 || v == 0 || end - cp < 1
+		  || (nlen = *cp++) >= MAX_COMM || end - cp < nlen + 1)
+		return -1;
+	      d->owner.pid = v;
+	      memcpy (d->owner.comm, cp, nlen);
+	      cp += nlen;
+	      if ((nlen = *cp++) >= MAX_CGROUP || end - cp < nlen)
+		return -1;
+	      memcpy (d->owner.cgroup, cp, nlen);
+	      cp += nlen;
+	    }
+	  d->iq = 0;
+	  d->oq = 0;
+	  continue;
+	}
+      if ((tag & TAG_KIND) == TAG_DROPS)
+	{
+	  uint64_t in_errors, rcvbuf_errors, lost, n_sockets, total, max;
+
+	  if (get_varint (&cp, end, &v) != 0
+	      || get_varint (&cp, end, &in_errors) != 0
+	      || get_varint (&cp, end, &rcvbuf_errors) != 0
+	      || get_varint (&cp, end, &lost) != 0
+	      || get_varint (&cp, end, &n_sockets) != 0
+	      || get_varint (&cp, end, &total) != 0
+	      || get_varint (&cp, end, &max) != 0)
+	    return -1;
+	  ts += UNZIGZAG (v);
+	  memset (&rec, 0, sizeof rec);
+	  rec.type = RECORD_DROPS;
+	  ts_to_timeval (ts, &(rec.u.drops.tv));
+	  rec.u.drops.in_errors = in_errors;
+	  rec.u.drops.rcvbuf_errors = rcvbuf_errors;
+	  rec.u.drops.lost = lost;
+	  rec.u.drops.n_sockets = n_sockets;
+	  rec.u.drops.total_iq = total;
+	  rec.u.drops.max_iq = max;
+	  if (ts >= from_ts && ts <= until_ts)
+	    (* callback) (&rec, closure);
+	  continue;
+	}
+      if (get_varint (&cp, end, &v) != 0
+	  || get_varint (&cp, end, &id) != 0 || id >= n_defined
+	  || get_varint (&cp, end, &diq) != 0
+	  || get_varint (&cp, end, &doq) != 0)
+	return -1;
+      ts += UNZIGZAG (v);
+      d = &defs[id];
+      d->iq += UNZIGZAG (diq);
+      d->oq += UNZIGZAG (doq);
+      rec.key = d->key;
+      rec.iq = d->iq;
+      rec.oq = d->oq;
+      memcpy (rec.netns, d->netns, MAX_NETNS_LABEL);
+      rec.owner = d->owner;
+      if ((tag & TAG_KIND) == TAG_ENTRY)
+	{
+	  rec.type = RECORD_ENTRY;
+	  rec.which = 0;
+	  rec.have_peak = (tag & TAG_PEAK) != 0;
+	  rec.u.entry.peak = rec.u.entry.full = rec.u.entry.lost = 0;
+	  rec.u.entry.ts_error = 0;
+	  if (tag & TAG_PEAK)
+	    {
+	      if (get_varint (&cp, end, &v) != 0)
+		return -1;
+	      rec.u.entry.peak = v;
+	    }
+	  if (tag & TAG_FULL)
+	    {
+	      if (get_varint (&cp, end, &v) != 0)
+		return -1;
+	      rec.u.entry.full = v;
+	    }
+	  if (tag & TAG_LOST)
+	    {
+	      if (get_varint (&cp, end, &v) != 0)
+		return -1;
+	      rec.u.entry.lost = v;
+	    }
+	  if (tag & TAG_ERROR)
+	    {
+	      if (get_varint (&cp, end, &v) != 0)
+		return -1;
+	      rec.u.entry.ts_error = v > UINT32_MAX ? UINT32_MAX : v;
+	    }
+	  ts_to_timeval (ts, &(rec.u.entry.tv));
+	}
+      else if ((tag & TAG_KIND) == TAG_BURST)
+	{
+	  BufferEvent ev = &(rec.u.burst.ev);
+	  uint64_t s_occ, m_occ, e_occ, s_delta, m_delta, bits;
+
+	  if (get_varint (&cp, end, &s_occ) != 0
+	      || get_varint (&cp, end, &m_occ) != 0
+	      || get_varint (&cp, end, &e_occ) != 0
+	      || get_varint (&cp, end, &s_delta) != 0
+	      || get_varint (&cp, end, &m_delta) != 0
+	      || end - cp < 8)
+	    return -1;
+	  rec.type = RECORD_BURST;
+	  rec.which = (tag & TAG_OUTPUT) ? BURST_OUTPUT : BURST_INPUT;
+	  rec.have_peak = 0;
+	  ev->s_occ = s_occ;
+	  ev->m_occ = m_occ;
+	  ev->e_occ = e_occ;
+	  ts_to_timeval (ts - UNZIGZAG (s_delta), &(ev->s_ts));
+	  ts_to_timeval (ts - UNZIGZAG (m_delta), &(ev->m_ts));
+	  ts_to_timeval (ts, &(ev->e_ts));
+	  bits = get_u64 (cp);
+	  cp += 8;
+	  memcpy (&(rec.u.burst.byte_seconds), &bits, 8);
+	}
+      else
+	return -1;
+      if (ts >= from_ts && ts <= until_ts)
+	(* callback) (&rec, closure);
+    }
+  return 0;
+}
+
+/* Convert a time given on the command line to microseconds since the
+   epoch.  It can be @SECONDS since the epoch, YYYY-MM-DD HH:MM[:SS],
+   or just HH:MM[:SS], which means that time on the day that begins
+   the trace, whose first time stamp is FIRST_TS.  Seconds can have a
+   fraction. */
+static int
+parse_trace_time (arg, first_ts, tsp)
+     const char *arg;
+     int64_t first_ts;
+     int64_t *tsp;
+{
+  struct tm tm;
+  const char *rest;
+  char *end;
+  double secs = 0;
+  time_t t;
+
+  if (arg[0] == '@')
+    {
+      secs = strtod (arg + 1, &end);
+      if (end == arg + 1 || *end != 0)
+	goto malformed;
+      *tsp = secs * 1e6;
+      return 0;
+    }
+  memset (&tm, 0, sizeof tm);
+  if ((rest = strptime (arg, "%Y-%m-%d %H:%M", &tm)) == 0
+      && (rest = strptime (arg, "%Y-%m-%dT%H:%M", &tm)) == 0)
+    {
+      t = first_ts / 1000000;
+      if (localtime_r (&t, &tm) == 0
+	  || (rest = strptime (arg, "%H:%M", &tm)) == 0)
+	goto malformed;
+    }
+  if (*rest == ':')
+    {
+      secs = strtod (rest + 1, &end);
+      if (end == rest + 1 || secs < 0 || secs >= 61)
+	goto malformed;
+      rest = end;
+    }
+  if (*rest != 0)
+    goto malformed;
+  tm.tm_sec = 0;
+  tm.tm_isdst = -1;
+  if ((t = mktime (&tm)) == (time_t) -1)
+    goto malformed;
+  *tsp = (int64_t) t * 1000000 + (int64_t) (secs * 1e6 + 0.5);
+  return 0;
+ malformed:
+  fprintf (stderr, "Malformed time %s\n", arg);
+  return -1;
+}
+
+static int
+read_fully (fd, buf, len, offset)
+     int fd;
+     void *buf;
+     size_t len;
+     uint64_t offset;
+{
+  ssize_t n;
+
+  while (len > 0)
+    {
+      if ((n = pread (fd, buf, len, offset)) <= 0)
+	{
+	  if (n == -1 && errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      buf = (char *) buf + n;
+      len -= n;
+      offset += n;
+    }
+  return 0;
+}
+
+static int
+write_fully (fd, buf, len)
+     int fd;
+     const void *buf;
+     size_t len;
+{
+  ssize_t n;
+
+  while (len > 0)
+    {
+      if ((n = write (fd, buf, len)) == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      buf = (const char *) buf + n;
+      len -= n;
+    }
+  return 0;
+}
+
+/* LEB128: seven bits per byte, least significant first, with the high
+   bit set on all but the last byte. */
+static unsigned char *
+put_varint (cp, v)
+     unsigned char *cp;
+     uint64_t v;
+{
+  while (v >= 0x80)
+    {
+      *cp++ = v | 0x80;
+      v >>= 7;
+    }
+  *cp++ = v;
+  return cp;
+}
+
+static int
+get_varint (cpp, end, vp)
+     const unsigned char **cpp;
+     const unsigned char *end;
+     uint64_t *vp;
+{
+  const unsigned char *cp = *cpp;
+  uint64_t v = 0;
+  int shift;
+
+  for (shift = 0; shift < 64 && cp < end; shift += 7)
+    {
+      v |= (uint64_t) (*cp & 0x7f) << shift;
+      if ((*cp++ & 0x80) == 0)
+	{
+	  *cpp = cp;
+	  *vp = v;
+	  return 0;
+	}
+    }
+  return -1;
+}
+
+static void
+put_u32 (cp, v)
+     unsigned char *cp;
+     uint32_t v;
+{
+  int k;
+
+  for (k = 0; k < 4; ++k)
+    cp[k] = v >> (8 * k);
+}
+
+static void
+put_u64 (cp, v)
+     unsigned char *cp;
+     uint64_t v;
+{
+  int k;
+
+  for (k = 0; k < 8; ++k)
+    cp[k] = v >> (8 * k);
+}
+
+static uint32_t
+get_u32 (cp)
+     const unsigned char *cp;
+{
+  return cp[0] | (cp[1] << 8) | (cp[2] << 16) | ((uint32_t) cp[3] << 24);
+}
+
+static uint64_t
+get_u64 (cp)
+     const unsigned char *cp;
+{
+  return get_u32 (cp) | ((uint64_t) get_u32 (cp + 4) << 32);
+}
+
+static int64_t
+timeval_to_ts (tv)
+     const struct timeval *tv;
+{
+  return (int64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static void
+ts_to_timeval (ts, tv)
+     int64_t ts;
+     struct timeval *tv;
+{
+  tv->tv_sec = ts / 1000000;
+  tv->tv_usec = ts % 1000000;
+  if (tv->tv_usec < 0)
+    {
+      tv->tv_usec += 1000000;
+      tv->tv_sec -= 1;
+    }
+}
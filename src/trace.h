@@ -0,0 +1,23 @@
+/*
+ trace.h
+
+ Date Created: Sat Oct 17 18:41:27 2026
+ */
+
+#ifndef __QUI_TRACE_H__
+#define __QUI_TRACE_H__ 1
+
+typedef struct TraceWriterRec *TraceWriter;
+
+/* Called by replay_trace() for each record in the selected time
+   range, in the order they were recorded. */
+typedef void (* TraceCallback) (OutputRecord, void *);
+
+extern TraceWriter open_trace_writer (const char *, unsigned);
+extern void trace_record (TraceWriter, OutputRecord);
+extern void end_trace_batch (TraceWriter);
+extern int close_trace_writer (TraceWriter);
+extern int replay_trace (const char *, const char *, const char *,
+			 TraceCallback, void *);
+
+#endif /* not __QUI_TRACE_H__ */